@@ -1,170 +1,464 @@
-/* file Chip8E.c */
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <SDL.h>
-
-#include "chip8.h"
-#include "view.h"
-
-int poll();
-
-// #define TESTING
-
-#ifdef TESTING
-	#include "minunit.h"
-#endif /* TESTING */
-
-SDL_Event e;
-
-int main(int argc, char **argv)
-{
-	#ifdef TESTING
-		testmain(0, 0);
-		exit(0);
-	#endif /* TESTING */
-
-	if(argc != 2) {
-        printf("Usage: Chip8E.exe <chip8 game file>\n\n");
-        exit(EXIT_FAILURE);
-	}
-
-	initialize();           // Initialize Chip8 system
-	if(loadGame(argv[1]) == -1) {
-        exit(EXIT_FAILURE);
-    }
-
-    if(!windowInit()) {     // Set up SDL rendering
-        exit(EXIT_FAILURE);
-    }
-
-	// Main emulation loop
-	int quit = 0;
-	while(!quit) {
-		emulateCycle();
-
-		// Update SDL window
-		if(*(getDrawFlag())) {
-            windowDraw(getGfx(), NUM_OF_PIXEL_COLS, NUM_OF_PIXEL_ROWS);
-			*(getDrawFlag()) = 0;
-
-            SDL_Delay(DELAY_MS);  // A delay of 16ms between draw operations gives ~60 fps
-		}
-
-		if(poll() == -1)    // Handle keyboard events (press and release), and check if user exited window
-            quit = 1;
-	}
-
-	windowClose();
-	exit(EXIT_SUCCESS);
-}
-
-int poll() {
-    while(SDL_PollEvent(&e) != 0) {     // Handle all SDL events on queue
-        if(e.type == SDL_KEYDOWN) {
-            switch(e.key.keysym.sym) {
-                case SDLK_1:
-                    setKey(0, 1);
-                    break;
-                case SDLK_2:
-                    setKey(1, 1);
-                    break;
-                case SDLK_3:
-                    setKey(2, 1);
-                    break;
-                case SDLK_4:
-                    setKey(3, 1);
-                    break;
-                case SDLK_q:
-                    setKey(4, 1);
-                    break;
-                case SDLK_w:
-                    setKey(5, 1);
-                    break;
-                case SDLK_e:
-                    setKey(6, 1);
-                    break;
-                case SDLK_r:
-                    setKey(7, 1);
-                    break;
-                case SDLK_a:
-                    setKey(8, 1);
-                    break;
-                case SDLK_s:
-                    setKey(9, 1);
-                    break;
-                case SDLK_d:
-                    setKey(10, 1);
-                    break;
-                case SDLK_f:
-                    setKey(11, 1);
-                    break;
-                case SDLK_z:
-                    setKey(12, 1);
-                    break;
-                case SDLK_x:
-                    setKey(13, 1);
-                    break;
-                case SDLK_c:
-                    setKey(14, 1);
-                    break;
-                case SDLK_v:
-                    setKey(15, 1);
-                    break;
-            }
-        } else if(e.type == SDL_KEYUP) {
-                switch(e.key.keysym.sym) {
-                case SDLK_1:
-                    setKey(0, 0);
-                    break;
-                case SDLK_2:
-                    setKey(1, 0);
-                    break;
-                case SDLK_3:
-                    setKey(2, 0);
-                    break;
-                case SDLK_4:
-                    setKey(3, 0);
-                    break;
-                case SDLK_q:
-                    setKey(4, 0);
-                    break;
-                case SDLK_w:
-                    setKey(5, 0);
-                    break;
-                case SDLK_e:
-                    setKey(6, 0);
-                    break;
-                case SDLK_r:
-                    setKey(7, 0);
-                    break;
-                case SDLK_a:
-                    setKey(8, 0);
-                    break;
-                case SDLK_s:
-                    setKey(9, 0);
-                    break;
-                case SDLK_d:
-                    setKey(10, 0);
-                    break;
-                case SDLK_f:
-                    setKey(11, 0);
-                    break;
-                case SDLK_z:
-                    setKey(12, 0);
-                    break;
-                case SDLK_x:
-                    setKey(13, 0);
-                    break;
-                case SDLK_c:
-                    setKey(14, 0);
-                    break;
-                case SDLK_v:
-                    setKey(15, 0);
-            }
-        } else if(e.type == SDL_QUIT)
-            return -1;
-    }
-
-    return 0;
-}
+/* file Chip8E.c */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "chip8.h"
+#include "hrtime.h"
+#include "input.h"
+#include "profile.h"
+#include "rewind.h"
+#include "scheduler.h"
+#include "state.h"
+#include "trace.h"
+#include "triplebuffer.h"
+#include "view.h"
+
+int poll();
+
+// #define TESTING
+
+#ifdef TESTING
+	#include "minunit.h"
+#endif /* TESTING */
+
+// #define BENCHMARK
+
+#ifdef BENCHMARK
+	int benchmain(int argc, char **argv);
+#endif /* BENCHMARK */
+
+SDL_Event e;
+
+// Shared between the emulation thread and the main (input and render) thread
+TripleBuffer frames;
+atomic_uint keyMask;	// Bit k set while key k is down
+atomic_int quit;
+atomic_int traceRequested;	// F12 pressed, the emulation thread dumps the trace
+atomic_int rewindRequested;	// Backspace presses not yet applied, each steps back a second
+SDL_mutex *keyLock;		// Guards sleeping on keyPosted against missing a post
+SDL_cond *keyPosted;	// Signalled when keyMask, rewindRequested or quit change
+
+unsigned int clockHz = DEFAULT_CLOCK_HZ;
+char *loadStateFile = NULL;		// Headless: resume from this save state
+char *saveStateFile = NULL;		// Headless: save the state here after the run
+Rewind *history = NULL;			// Frames the machine can step back to, --rewind
+InputLog *inputLog = NULL;		// Keys recorded with --record, or replayed with --replay
+
+void postKey(unsigned char k, unsigned char s);
+void postRewind();
+int runHeadless(Chip8 *c, unsigned long long cycles, unsigned long long launched);
+int emulationMain(void *data);
+
+int main(int argc, char **argv)
+{
+	#ifdef TESTING
+		testmain(0, 0);
+		exit(0);
+	#endif /* TESTING */
+
+	#ifdef BENCHMARK
+		exit(benchmain(argc, argv));
+	#endif /* BENCHMARK */
+
+	unsigned long long launched = nanoTime();
+
+	char *game = NULL;
+	int engine = ENGINE_INTERPRETER;
+	int headless = 0;
+	unsigned long long cycles = 0;
+	char *traceFile = NULL;
+	unsigned long rewindMB = 0;
+	char *recordFile = NULL;
+	char *replayFile = NULL;
+	int seeded = 0;
+	unsigned long long seed = DEFAULT_SEED;
+	for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--clock") == 0 && i + 1 < argc) {     // Instructions per second, 0 for unlimited
+            clockHz = (unsigned int) strtoul(argv[++i], NULL, 10);
+        } else if(strcmp(argv[i], "--headless") == 0) {     // No window, run a fixed number of instructions
+            headless = 1;
+        } else if(strcmp(argv[i], "--cycles") == 0 && i + 1 < argc) {
+            cycles = strtoull(argv[++i], NULL, 10);
+        } else if(strcmp(argv[i], "--load-state") == 0 && i + 1 < argc) {
+            loadStateFile = argv[++i];
+        } else if(strcmp(argv[i], "--save-state") == 0 && i + 1 < argc) {
+            saveStateFile = argv[++i];
+        } else if(strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {     // Record a trace, dumped on exit, F12 and faults
+            traceFile = argv[++i];
+        } else if(strcmp(argv[i], "--rewind") == 0 && i + 1 < argc) {     // Megabytes of history, Backspace steps back
+            rewindMB = strtoul(argv[++i], NULL, 10);
+        } else if(strcmp(argv[i], "--record") == 0 && i + 1 < argc) {     // Log the keys, written on exit
+            recordFile = argv[++i];
+        } else if(strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {     // Headless: set the keys of a log
+            replayFile = argv[++i];
+        } else if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {     // CXNN random numbers
+            seed = strtoull(argv[++i], NULL, 10);
+            seeded = 1;
+        } else if(strcmp(argv[i], "block") == 0) {      // Select execution engine
+            engine = ENGINE_BLOCK_CACHE;
+        } else if(strcmp(argv[i], "jit") == 0) {
+            engine = ENGINE_JIT;
+        } else if(strcmp(argv[i], "interpreter") == 0) {
+            engine = ENGINE_INTERPRETER;
+        } else if(game == NULL && argv[i][0] != '-') {
+            game = argv[i];
+        } else {
+            game = NULL;
+            break;
+        }
+	}
+
+	// A log replays a run from the ROM as loaded, at a fixed clock and without steps back
+	int misused = (!headless && (loadStateFile != NULL || saveStateFile != NULL || replayFile != NULL))
+		|| (replayFile != NULL && loadStateFile != NULL)
+		|| (recordFile != NULL && (headless || rewindMB != 0 || clockHz == CLOCK_UNLIMITED));
+	if(game == NULL || headless != (cycles != 0) || misused) {
+        printf("Usage: Chip8E.exe <chip8 game file> [interpreter|block|jit] [--clock Hz] [--seed N] [--headless --cycles N [--load-state file] [--save-state file] [--replay file]] [--trace file] [--rewind MB] [--record file]\n\n");
+        exit(EXIT_FAILURE);
+	}
+
+	Chip8 *chip8 = createChip8();   // Initialize Chip8 system
+	if(chip8 == NULL) {
+        exit(EXIT_FAILURE);
+	}
+	setEngine(chip8, engine);
+	setLazyTimers(chip8, 1);	// Timers are computed when read, not ticked per instruction
+	if(seeded)
+		setSeed(chip8, seed);
+
+	if(traceFile != NULL) {
+	#ifdef TRACE
+		if(startTrace(chip8, traceFile) == -1)
+	        exit(EXIT_FAILURE);
+	#else
+        fprintf(stderr, "Error: Tracing needs a build with TRACE defined\n");
+        exit(EXIT_FAILURE);
+	#endif /* TRACE */
+	}
+
+	if(loadGame(chip8, game) == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    if(headless) {      // SDL is never initialized
+        if(replayFile != NULL && (inputLog = loadInputLog(replayFile)) == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        int status = runHeadless(chip8, cycles, launched);
+        destroyInputLog(inputLog);
+        destroyChip8(chip8);
+        exit(status);
+    }
+
+    if(!windowInit()) {     // Set up SDL rendering
+        exit(EXIT_FAILURE);
+    }
+
+	// Emulation runs on its own thread so presenting (vsync, compositor stalls) never stalls it
+	initTripleBuffer(&frames);
+	atomic_init(&keyMask, 0);
+	atomic_init(&quit, 0);
+	atomic_init(&traceRequested, 0);
+	atomic_init(&rewindRequested, 0);
+	if(rewindMB != 0 && (history = createRewind((size_t) rewindMB << 20)) == NULL) {
+        exit(EXIT_FAILURE);
+	}
+	if(recordFile != NULL) {
+		setClock(chip8, clockHz);	// Logged as it starts, initScheduler() sets the same
+		if((inputLog = createInputLog(chip8)) == NULL)
+	        exit(EXIT_FAILURE);
+	}
+	keyLock = SDL_CreateMutex();
+	keyPosted = SDL_CreateCond();
+	if(keyLock == NULL || keyPosted == NULL) {
+        printf("Error: Key signal could not be created! SDL_Error: %s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+	}
+	SDL_Thread *emulation = SDL_CreateThread(emulationMain, "emulation", chip8);
+	if(emulation == NULL) {
+        printf("Error: Emulation thread could not be created! SDL_Error: %s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+	}
+
+	// Present the latest finished frame at display rate
+	while(poll() != -1) {    // Handle keyboard events (press and release), and check if user exited window
+		const Frame *f = readFrame(&frames);
+		if(f != NULL)
+            windowDraw(f->rows, f->dirty, NUM_OF_PIXEL_COLS, NUM_OF_PIXEL_ROWS);
+		else
+            SDL_Delay(1);
+	}
+
+	SDL_LockMutex(keyLock);
+	atomic_store(&quit, 1);
+	SDL_CondSignal(keyPosted);
+	SDL_UnlockMutex(keyLock);
+	SDL_WaitThread(emulation, NULL);
+	SDL_DestroyCond(keyPosted);
+	SDL_DestroyMutex(keyLock);
+
+	windowStats();
+	printf("Idle loop instructions skipped: %llu\n", chip8->elided);
+	#ifdef TRACE
+		if(traceFile != NULL && !(chip8->trace->flags & TRACE_FAULTED))	// A fault already dumped it
+			dumpTrace(chip8);
+	#endif /* TRACE */
+	#ifdef PROFILE
+		printProfile(chip8, stdout);
+	#endif /* PROFILE */
+	if(recordFile != NULL)
+		saveInputLog(inputLog, recordFile);
+	windowClose();
+	destroyInputLog(inputLog);
+	destroyRewind(history);
+	destroyChip8(chip8);
+	exit(EXIT_SUCCESS);
+}
+
+// Runs cycles instructions as fast as possible, the timers ticking at clockHz / 60 instructions so the
+// result does not depend on the host, and prints a summary. A run can resume from a save state and
+// save its own, to checkpoint long jobs. launched is nanoTime() on entering main().
+int runHeadless(Chip8 *c, unsigned long long cycles, unsigned long long launched) {
+	setClock(c, clockHz);
+	if(loadStateFile != NULL && loadState(c, loadStateFile) == -1)
+		return EXIT_FAILURE;
+	if(inputLog != NULL)
+		startReplay(inputLog, c);
+	unsigned long long first = c->cycleCount;
+	unsigned long long start = nanoTime();
+	int reason;
+	if(inputLog != NULL)		// The keys are set on the cycles they were recorded on
+		reason = replayInput(inputLog, c, first + cycles);
+	else
+		reason = runUntil(c, first + cycles);
+	unsigned long long elapsed = nanoTime() - start;
+	unsigned long long executed = c->cycleCount - first;
+	if(reason == FRAME_HALT) {
+		fprintf(stderr, "Error: stuck on an unknown opcode at 0x%03X after %llu cycles\n", c->pc, executed);
+		return EXIT_FAILURE;
+	}
+
+	printf("Cycles: %llu, idle loop instructions skipped: %llu\n", executed, c->elided);
+	printf("Wall time: %.3f ms, %.2f MIPS\n", elapsed / 1e6, elapsed ? executed * 1e3 / elapsed : 0.0);
+	printf("Framebuffer hash: %016llx\n", getGfxHash(c));
+	printf("Startup to first instruction: %.3f ms\n", (start - launched) / 1e6);
+	if(saveStateFile != NULL && saveState(c, saveStateFile) == -1)
+		return EXIT_FAILURE;
+	#ifdef PROFILE
+		printProfile(c, stdout);
+	#endif /* PROFILE */
+	#ifdef TRACE
+		if(c->trace != NULL && !(c->trace->flags & TRACE_FAULTED))
+			dumpTrace(c);
+	#endif /* TRACE */
+
+	return EXIT_SUCCESS;
+}
+
+// Emulation thread: runs the machine at clockHz and publishes a frame after draws
+int emulationMain(void *data) {
+	Chip8 *c = (Chip8*) data;
+	unsigned int keys = 0;
+	Scheduler scheduler;
+	unsigned long long nextCapture = 0;
+
+	initScheduler(&scheduler, c, clockHz);
+	while(!atomic_load_explicit(&quit, memory_order_relaxed)) {
+		if(runScheduler(&scheduler) == 0 || scheduler.idle)     // Ahead of the clock, or waiting on a timer or key
+			waitScheduler(&scheduler);
+		syncTimers(c);    // Beep when the sound timer ran out during the slice
+
+		// Keep a frame of history per timer tick, step back a second per Backspace press
+		if(history != NULL) {
+			int seconds = atomic_exchange_explicit(&rewindRequested, 0, memory_order_relaxed);
+			if(seconds > 0) {
+				rewindFrames(history, c, seconds * TIMER_HZ);
+				keys = 0;    // The keypad went back too, the posted keys are applied again below
+				for(int k = 0; k < KEYPAD_SIZE; k++)
+					keys |= (c->key[k] != 0) << k;
+			}
+			unsigned long long now = nanoTime();
+			if(now >= nextCapture) {
+				captureFrame(history, c);
+				nextCapture = now + 1000000000ull / TIMER_HZ;
+			}
+		}
+
+		if(*(getDrawFlag(c)) || c->dirtyRows) {		// Drawn, or restored by a rewind
+			Frame *f = writeFrame(&frames);
+			memcpy(f->rows, getGfxRows(c), sizeof(f->rows));
+			f->dirty = takeDirtyRows(c);
+			publishFrame(&frames);
+			*(getDrawFlag(c)) = 0;
+		}
+
+		#ifdef TRACE
+			if(atomic_exchange_explicit(&traceRequested, 0, memory_order_relaxed) && c->trace != NULL)
+				dumpTrace(c);
+		#endif /* TRACE */
+
+		// Apply the keys posted by the main thread. A machine parked in FX0A sleeps until a key is
+		// posted, waking once per timer tick only while the sound timer runs.
+		unsigned int posted = atomic_load_explicit(&keyMask, memory_order_relaxed);
+		if(posted == keys && isWaitingForKey(c)) {
+			SDL_LockMutex(keyLock);
+			while(!atomic_load(&quit) && !atomic_load(&rewindRequested) && (posted = atomic_load(&keyMask)) == keys) {
+				if(getSoundTimer(c) == 0)
+					SDL_CondWait(keyPosted, keyLock);
+				else if(SDL_CondWaitTimeout(keyPosted, keyLock, 1000 / TIMER_HZ) == SDL_MUTEX_TIMEDOUT)
+					break;
+			}
+			SDL_UnlockMutex(keyLock);
+			runScheduler(&scheduler);    // Still waiting: counts the time slept towards the timers
+		}
+		if(posted != keys) {
+			for(int k = 0; k < KEYPAD_SIZE; k++)
+				if((posted ^ keys) >> k & 1) {
+					if(inputLog != NULL)
+						recordKey(inputLog, c, k, posted >> k & 1);
+					else
+						setKey(c, k, posted >> k & 1);
+				}
+			keys = posted;
+		}
+	}
+
+	return 0;
+}
+
+void postKey(unsigned char k, unsigned char s) {
+	SDL_LockMutex(keyLock);
+	if(s)
+		atomic_fetch_or(&keyMask, 1u << k);
+	else
+		atomic_fetch_and(&keyMask, ~(1u << k));
+	SDL_CondSignal(keyPosted);
+	SDL_UnlockMutex(keyLock);
+}
+
+void postRewind() {
+	SDL_LockMutex(keyLock);
+	atomic_fetch_add(&rewindRequested, 1);
+	SDL_CondSignal(keyPosted);
+	SDL_UnlockMutex(keyLock);
+}
+
+int poll() {
+    while(SDL_PollEvent(&e) != 0) {     // Handle all SDL events on queue
+        if(e.type == SDL_KEYDOWN) {
+            switch(e.key.keysym.sym) {
+                case SDLK_1:
+                    postKey(0, 1);
+                    break;
+                case SDLK_2:
+                    postKey(1, 1);
+                    break;
+                case SDLK_3:
+                    postKey(2, 1);
+                    break;
+                case SDLK_4:
+                    postKey(3, 1);
+                    break;
+                case SDLK_q:
+                    postKey(4, 1);
+                    break;
+                case SDLK_w:
+                    postKey(5, 1);
+                    break;
+                case SDLK_e:
+                    postKey(6, 1);
+                    break;
+                case SDLK_r:
+                    postKey(7, 1);
+                    break;
+                case SDLK_a:
+                    postKey(8, 1);
+                    break;
+                case SDLK_s:
+                    postKey(9, 1);
+                    break;
+                case SDLK_d:
+                    postKey(10, 1);
+                    break;
+                case SDLK_f:
+                    postKey(11, 1);
+                    break;
+                case SDLK_z:
+                    postKey(12, 1);
+                    break;
+                case SDLK_x:
+                    postKey(13, 1);
+                    break;
+                case SDLK_c:
+                    postKey(14, 1);
+                    break;
+                case SDLK_v:
+                    postKey(15, 1);
+                    break;
+                case SDLK_F12:      // Dump the execution trace
+                    atomic_store(&traceRequested, 1);
+                    break;
+                case SDLK_BACKSPACE:    // Step back a second
+                    postRewind();
+                    break;
+            }
+        } else if(e.type == SDL_KEYUP) {
+                switch(e.key.keysym.sym) {
+                case SDLK_1:
+                    postKey(0, 0);
+                    break;
+                case SDLK_2:
+                    postKey(1, 0);
+                    break;
+                case SDLK_3:
+                    postKey(2, 0);
+                    break;
+                case SDLK_4:
+                    postKey(3, 0);
+                    break;
+                case SDLK_q:
+                    postKey(4, 0);
+                    break;
+                case SDLK_w:
+                    postKey(5, 0);
+                    break;
+                case SDLK_e:
+                    postKey(6, 0);
+                    break;
+                case SDLK_r:
+                    postKey(7, 0);
+                    break;
+                case SDLK_a:
+                    postKey(8, 0);
+                    break;
+                case SDLK_s:
+                    postKey(9, 0);
+                    break;
+                case SDLK_d:
+                    postKey(10, 0);
+                    break;
+                case SDLK_f:
+                    postKey(11, 0);
+                    break;
+                case SDLK_z:
+                    postKey(12, 0);
+                    break;
+                case SDLK_x:
+                    postKey(13, 0);
+                    break;
+                case SDLK_c:
+                    postKey(14, 0);
+                    break;
+                case SDLK_v:
+                    postKey(15, 0);
+            }
+        } else if(e.type == SDL_QUIT)
+            return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,386 @@
+/* file bench.c */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "hrtime.h"
+#include "lockstep.h"
+
+#define BENCH_CYCLES 10000000
+
+// Opcode microbenchmarks
+#define SUITE_WARMUP 1000000		// Instructions run before timing
+#define SUITE_CYCLES 2000000		// Instructions per timed repetition
+#define SUITE_REPS 15				// Timed repetitions, summarized by min, median, mean and deviation
+#define SUITE_UNITS 64				// Copies of the body per loop pass
+
+// Body placeholders resolved when a synthetic ROM is built
+#define JUMP_NEXT 0x1FFF	// 1NNN to the next instruction
+#define CALL_RET 0x2FFF		// 2NNN to a subroutine that only returns
+#define JUMP_V0_NEXT 0xBFFF	// BNNN to the next instruction, V0 is 0
+
+// Reference decoder: walks the opcode switch on every instruction
+static void switchCycle(Chip8 *c) {
+	Instruction in;
+
+	c->opcode = c->memory[c->pc % MEMORY_SIZE] << 8 | c->memory[(c->pc + 1) % MEMORY_SIZE];
+
+	in.execute = decodeOpcode(c->opcode);
+	if(in.execute == NULL)
+		in.execute = &instrUnknown;
+	in.opcode	= c->opcode;
+	in.x		= c->opcode >> 8 & 0x0F;
+	in.y		= c->opcode >> 4 & 0x0F;
+	in.n		= c->opcode & 0x000F;
+	in.nn		= c->opcode & 0x00FF;
+	in.nnn		= c->opcode & 0x0FFF;
+	in.execute(c, &in);
+
+	updateTimers(c);
+}
+
+// Runs BENCH_CYCLES instructions of a ROM and returns instructions per second
+static double run(Chip8 *c, char *file, void (*cycle)(Chip8 *c)) {
+	initialize(c);
+	if(loadGame(c, file) == -1)
+		return 0;
+
+	unsigned long long start = nanoTime();
+	for(int i = 0; i < BENCH_CYCLES; i++)
+		cycle(c);
+	unsigned long long elapsed = nanoTime() - start;
+
+	return BENCH_CYCLES / (elapsed / 1e9);
+}
+
+// As run(), stepping with an execution engine
+static double runEngine(Chip8 *c, char *file, int e) {
+	initialize(c);
+	if(loadGame(c, file) == -1)
+		return 0;
+	setEngine(c, e);
+
+	long executed = 0;
+	unsigned long long start = nanoTime();
+	while(executed < BENCH_CYCLES)
+		executed += emulate(c);
+	unsigned long long elapsed = nanoTime() - start;
+
+	setEngine(c, ENGINE_INTERPRETER);
+
+	return executed / (elapsed / 1e9);
+}
+
+// Instructions per second of a front end loop that checks for a frame after every emulate() call,
+// against one that runs a timer tick's worth of instructions per emulateFrame() call
+static int runFrames(Chip8 *c, char *file) {
+	unsigned long long frames = 0;
+	int n;
+
+	initialize(c);
+	if(loadGame(c, file) == -1)
+		return -1;
+
+	long executed = 0;
+	unsigned long long start = nanoTime();
+	while(executed < BENCH_CYCLES) {
+		executed += emulate(c);
+		if(c->drawFlag) {
+			c->drawFlag = 0;
+			frames++;
+		}
+	}
+	double cycleRate = executed / ((nanoTime() - start) / 1e9);
+
+	initialize(c);
+	loadGame(c, file);
+
+	frames = 0;
+	executed = 0;
+	start = nanoTime();
+	while(executed < BENCH_CYCLES) {
+		emulateFrame(c, c->cyclesPerTick, &n);
+		executed += n;
+		if(c->drawFlag) {
+			c->drawFlag = 0;
+			frames++;
+		}
+	}
+	double frameRate = executed / ((nanoTime() - start) / 1e9);
+
+	printf("%-24s %18.0f %18.0f %7.2fx %10llu\n", file, cycleRate, frameRate, frameRate / cycleRate, frames);
+
+	return 0;
+}
+
+// A synthetic ROM hammering one opcode: the body is repeated SUITE_UNITS times in a loop.
+// Bodies carry what keeps the opcode repeatable, e.g. ANNN resetting I before FX55.
+typedef struct Micro {
+	const char *group;
+	const char *name;
+	unsigned short body[2];
+	int length;
+} Micro;
+
+static const Micro micros[] = {
+	{ "alu", "6XNN", { 0x6A55 }, 1 },
+	{ "alu", "7XNN", { 0x7A01 }, 1 },
+	{ "alu", "8XY0", { 0x8A10 }, 1 },
+	{ "alu", "8XY1", { 0x8A11 }, 1 },
+	{ "alu", "8XY2", { 0x8A12 }, 1 },
+	{ "alu", "8XY3", { 0x8A13 }, 1 },
+	{ "alu", "8XY4", { 0x8A14 }, 1 },
+	{ "alu", "8XY5", { 0x8A15 }, 1 },
+	{ "alu", "8XY6", { 0x8A16 }, 1 },
+	{ "alu", "8XY7", { 0x8A17 }, 1 },
+	{ "alu", "8XYE", { 0x8A1E }, 1 },
+	{ "alu", "CXNN", { 0xCAFF }, 1 },
+	{ "skip", "3XNN", { 0x3105 }, 1 },				// Not taken
+	{ "skip", "4XNN", { 0x4102 }, 1 },
+	{ "skip", "5XY0", { 0x5120 }, 1 },
+	{ "skip", "9XY0", { 0x9110 }, 1 },
+	{ "skip", "EX9E", { 0xE19E }, 1 },
+	{ "skip", "EXA1", { 0xE1A1, 0x7F01 }, 2 },		// Taken, 7F01 never runs
+	{ "draw", "00E0", { 0x00E0 }, 1 },
+	{ "draw", "DXY1", { 0xD121 }, 1 },
+	{ "draw", "DXY5", { 0xD125 }, 1 },
+	{ "draw", "DXYF", { 0xD12F }, 1 },
+	{ "memory", "ANNN", { 0xA900 }, 1 },
+	{ "memory", "FX1E", { 0xF11E }, 1 },
+	{ "memory", "FX29", { 0xF129 }, 1 },
+	{ "memory", "FX33", { 0xF333 }, 1 },
+	{ "memory", "FX55", { 0xA900, 0xFF55 }, 2 },
+	{ "memory", "FX65", { 0xA900, 0xFF65 }, 2 },
+	{ "flow", "1NNN", { JUMP_NEXT }, 1 },
+	{ "flow", "2NNN+00EE", { CALL_RET }, 1 },
+	{ "flow", "BNNN", { JUMP_V0_NEXT }, 1 },
+	{ "timer", "FX07", { 0xFA07 }, 1 },
+	{ "timer", "FX15", { 0xFA15 }, 1 },
+	{ "timer", "FX18", { 0xFA18 }, 1 }
+};
+
+static const char *engineNames[] = { "interpreter", "block", "jit" };
+
+// Builds the ROM of a microbenchmark into rom, returns its size in bytes
+static int buildMicro(const Micro *m, unsigned char *rom) {
+	unsigned short words[16 + 2 * SUITE_UNITS + 2];
+	int n = 0;
+
+	for(int r = 1; r < 15; r++)		// V1 = 1, V2 = 2, ... VE = 14, V0 = VF = 0
+		words[n++] = 0x6000 | r << 8 | r;
+	words[n++] = 0xA000 | MEMORY_FONTSET;
+
+	unsigned short loop = MEMORY_PROGRAM + 2 * n;
+	int end = n + SUITE_UNITS * m->length;
+	unsigned short subroutine = MEMORY_PROGRAM + 2 * (end + 1);
+	for(int u = 0; u < SUITE_UNITS; u++) {
+		for(int i = 0; i < m->length; i++) {
+			unsigned short next = MEMORY_PROGRAM + 2 * (n + 1);
+			switch(m->body[i]) {
+				case JUMP_NEXT:
+					words[n++] = 0x1000 | next;
+					break;
+				case CALL_RET:
+					words[n++] = 0x2000 | subroutine;
+					break;
+				case JUMP_V0_NEXT:
+					words[n++] = 0xB000 | next;
+					break;
+				default:
+					words[n++] = m->body[i];
+			}
+		}
+	}
+	words[n++] = 0x1000 | loop;
+	words[n++] = 0x00EE;
+
+	for(int i = 0; i < n; i++) {
+		rom[2 * i] = words[i] >> 8;
+		rom[2 * i + 1] = words[i] & 0xFF;
+	}
+
+	return 2 * n;
+}
+
+static int compareDoubles(const void *a, const void *b) {
+	double x = *(const double*) a, y = *(const double*) b;
+	return (x > y) - (x < y);
+}
+
+// Times SUITE_REPS repetitions of SUITE_CYCLES instructions after a warmup, the machine already
+// loaded, and prints one line: suite, group, name, engine, instructions, repetitions and the
+// min, median, mean and standard deviation of ns per instruction
+static int measure(Chip8 *c, const char *suite, const char *group, const char *name) {
+	double ns[SUITE_REPS];
+	int n;
+
+	setSeed(c, DEFAULT_SEED);
+	for(long executed = 0; executed < SUITE_WARMUP; executed += n)
+		emulateFrame(c, SUITE_WARMUP, &n);
+
+	for(int r = 0; r < SUITE_REPS; r++) {
+		long executed = 0;
+		unsigned long long start = nanoTime();
+		while(executed < SUITE_CYCLES) {
+			emulateFrame(c, SUITE_CYCLES - executed, &n);
+			executed += n;
+		}
+		ns[r] = (double) (nanoTime() - start) / executed;
+	}
+
+	if(c->elided != 0) {
+		fprintf(stderr, "Error: %s %s skipped idle instructions, timings are meaningless\n", group, name);
+		return -1;
+	}
+
+	double mean = 0, variance = 0;
+	for(int r = 0; r < SUITE_REPS; r++)
+		mean += ns[r] / SUITE_REPS;
+	for(int r = 0; r < SUITE_REPS; r++)
+		variance += (ns[r] - mean) * (ns[r] - mean) / (SUITE_REPS - 1);
+	qsort(ns, SUITE_REPS, sizeof(double), &compareDoubles);
+
+	printf("%s\t%s\t%s\t%s\t%d\t%d\t%.3f\t%.3f\t%.3f\t%.3f\n", suite, group, name, engineNames[getEngine(c)],
+		SUITE_CYCLES, SUITE_REPS, ns[0], ns[SUITE_REPS / 2], mean, variance > 0 ? sqrt(variance) : 0.0);
+	fflush(stdout);
+
+	return 0;
+}
+
+// Microbenchmarks of every opcode class, then the ROM files given as a macro benchmark,
+// on every engine. Tab separated, one measurement per line, for tracking regressions.
+static int runSuite(int argc, char **argv) {
+	unsigned char rom[MEMORY_SIZE - MEMORY_PROGRAM];
+	Chip8 *c = createChip8();
+	if(c == NULL)
+		return 1;
+
+	printf("suite\tgroup\tname\tengine\tinstructions\treps\tns_min\tns_median\tns_mean\tns_stddev\n");
+	for(int i = 0; i < (int) (sizeof(micros) / sizeof(micros[0])); i++) {
+		int size = buildMicro(&micros[i], rom);
+		for(int e = ENGINE_INTERPRETER; e <= ENGINE_JIT; e++) {
+			initialize(c);
+			setEngine(c, e);
+			if(loadRom(c, rom, size) == -1 || measure(c, "micro", micros[i].group, micros[i].name) == -1) {
+				destroyChip8(c);
+				return 1;
+			}
+		}
+	}
+
+	for(int i = 0; i < argc; i++) {
+		for(int e = ENGINE_INTERPRETER; e <= ENGINE_JIT; e++) {
+			initialize(c);
+			setEngine(c, e);
+			if(loadGame(c, argv[i]) == -1 || measure(c, "macro", "rom", argv[i]) == -1) {
+				destroyChip8(c);
+				return 1;
+			}
+		}
+	}
+
+	destroyChip8(c);
+	return 0;
+}
+
+// Lane-instructions per second of the lockstep engine and of as many instances stepped one by one
+static int runLockstep(char *file) {
+	static const int laneCounts[] = { 1, 8, 32, 128, LOCKSTEP_MAX_LANES };
+
+	printf("%-24s %6s %18s %18s %8s\n", "rom", "lanes", "scalar lane-ins/s", "lockstep lane-ins/s", "speedup");
+	for(int n = 0; n < (int) (sizeof(laneCounts) / sizeof(laneCounts[0])); n++) {
+		int lanes = laneCounts[n];
+		Lockstep *l = createLockstep(lanes);
+		if(l == NULL || loadLockstep(l, file) == -1) {
+			destroyLockstep(l);
+			return -1;
+		}
+
+		// Scalar reference on the lane instances: same ROM, each lane holding a different key
+		for(int i = 0; i < lanes; i++) {
+			setKey(l->lanes[i], i % KEYPAD_SIZE, 1);
+			setEngine(l->lanes[i], ENGINE_INTERPRETER);
+			setSeed(l->lanes[i], DEFAULT_SEED);
+		}
+		unsigned long long start = nanoTime();
+		for(int i = 0; i < lanes; i++) {
+			Chip8 *c = l->lanes[i];
+			for(int j = 0; j < BENCH_CYCLES / lanes; j++)
+				emulateCycle(c);
+		}
+		double scalarRate = (double) (BENCH_CYCLES / lanes) * lanes / ((nanoTime() - start) / 1e9);
+
+		// Same lanes in lockstep
+		resetLockstep(l);
+		for(int i = 0; i < lanes; i++) {
+			loadGame(l->lanes[i], file);
+			setKey(l->lanes[i], i % KEYPAD_SIZE, 1);
+		}
+		long executed = 0;
+		start = nanoTime();
+		while(executed < BENCH_CYCLES)
+			executed += emulateLockstep(l);
+		double lockstepRate = executed / ((nanoTime() - start) / 1e9);
+
+		printf("%-24s %6d %18.0f %18.0f %7.2fx\n", file, lanes, scalarRate, lockstepRate, lockstepRate / scalarRate);
+		destroyLockstep(l);
+	}
+
+	return 0;
+}
+
+int benchmain(int argc, char **argv) {
+	if(argc >= 2 && strcmp(argv[1], "--suite") == 0)
+		return runSuite(argc - 2, argv + 2);
+
+	if(argc < 2) {
+		printf("Usage: Chip8E.exe <chip8 game file> ...\n       Chip8E.exe --suite [chip8 game file] ...\n\n");
+		return 1;
+	}
+
+	Chip8 *c = createChip8();
+	if(c == NULL)
+		return 1;
+
+	printf("%-24s %16s %16s %8s %16s %8s %16s %8s %16s %8s\n", "rom", "switch instr/s", "table instr/s", "speedup",
+		"lazy instr/s", "speedup", "block instr/s", "speedup", "jit instr/s", "speedup");
+	for(int i = 1; i < argc; i++) {
+		double switchRate = run(c, argv[i], &switchCycle);
+		double tableRate = run(c, argv[i], &emulateCycle);
+		setLazyTimers(c, 1);
+		double lazyRate = run(c, argv[i], &emulateCycle);
+		setLazyTimers(c, 0);
+		double blockRate = runEngine(c, argv[i], ENGINE_BLOCK_CACHE);
+		double jitRate = runEngine(c, argv[i], ENGINE_JIT);
+
+		if(switchRate == 0 || tableRate == 0 || lazyRate == 0 || blockRate == 0 || jitRate == 0) {
+			destroyChip8(c);
+			return 1;
+		}
+
+		// Lazy timer, block and JIT speedups are relative to emulateCycle()
+		printf("%-24s %16.0f %16.0f %7.2fx %16.0f %7.2fx %16.0f %7.2fx %16.0f %7.2fx\n", argv[i], switchRate, tableRate,
+			tableRate / switchRate, lazyRate, lazyRate / tableRate, blockRate, blockRate / tableRate, jitRate, jitRate / tableRate);
+	}
+
+	printf("\n%-24s %18s %18s %8s %10s\n", "rom", "emulate() instr/s", "frame instr/s", "speedup", "frames");
+	for(int i = 1; i < argc; i++) {
+		if(runFrames(c, argv[i]) == -1) {
+			destroyChip8(c);
+			return 1;
+		}
+	}
+
+	destroyChip8(c);
+
+	printf("\n");
+	for(int i = 1; i < argc; i++) {
+		if(runLockstep(argv[i]) == -1)
+			return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,152 @@
+/* file blockcache.c */
+
+#include <stdlib.h>
+
+#include "blockcache.h"
+#include "jit.h"
+#include "profile.h"
+#include "trace.h"
+
+// Control flow, skips, unknown opcodes, memory stores and timer access close a block
+int endsBlock(InstructionHandler handler) {
+	return handler == &instr1NNN || handler == &instr2NNN || handler == &instr00EE
+		|| handler == &instrBNNN || handler == &instr3XNN || handler == &instr4XNN
+		|| handler == &instr5XY0 || handler == &instr9XY0 || handler == &instrEX9E
+		|| handler == &instrEXA1 || handler == &instrFX0A || handler == &instrFX33
+		|| handler == &instrFX55 || handler == &instr0NNN || handler == &instrUnknown
+		|| handler == &instrFX07 || handler == &instrFX15 || handler == &instrFX18;
+}
+
+static Block * buildBlock(Chip8 *c, unsigned short start) {
+	BlockCache *cache = c->blockCache;
+	if(cache == NULL) {
+		cache = c->blockCache = (BlockCache*) calloc(1, sizeof(BlockCache));
+		if(cache == NULL)
+			return NULL;
+	}
+
+	Block *b = (Block*) malloc(sizeof(Block));
+	if(b == NULL)
+		return NULL;
+
+	b->start = start;
+	b->length = 0;
+	b->hits = 0;
+	b->code = NULL;
+	b->pendingTicks = 0;
+
+	unsigned short address = start;
+	while(b->length < BLOCK_MAX_LENGTH && address < MEMORY_SIZE - 1) {
+		const Instruction *in = decode(c->memory[address] << 8 | c->memory[address + 1]);
+
+		b->ops[b->length++] = in;
+		address += 2;
+
+		if(endsBlock(in->execute))
+			break;
+	}
+
+	cache->blocks[start] = b;
+	cache->blockCount++;
+	for(int i = start; i < address && i < MEMORY_SIZE; i++)
+		cache->coverage[i]++;
+
+	return b;
+}
+
+static void freeBlock(BlockCache *cache, Block *b) {
+	for(int i = b->start; i < b->start + 2 * b->length && i < MEMORY_SIZE; i++)
+		cache->coverage[i]--;
+
+	cache->blocks[b->start] = NULL;
+	cache->blockCount--;
+	free(b);
+}
+
+// Returns the block starting at address, decoding it on first use. Returns NULL where no whole
+// instruction fits before the end of memory, the caller steps that one with emulateCycle().
+Block * getBlock(Chip8 *c, unsigned short address) {
+	if(address >= MEMORY_SIZE - 1)
+		return NULL;
+	if(c->blockCache != NULL && c->blockCache->blocks[address] != NULL)
+		return c->blockCache->blocks[address];
+
+	return buildBlock(c, address);
+}
+
+// Replays a decoded block. Returns the number of instructions executed.
+int runBlock(Chip8 *c, Block *b) {
+	// Only the last instruction may read the timers or store to memory and free b,
+	// so timer ticks are batched around it and b is not touched after it runs
+	int length = b->length;
+	PROFILE_BLOCK(c, b);
+	for(int i = 0; i < length - 1; i++) {
+		b->ops[i]->execute(c, b->ops[i]);
+		TRACE_INSTRUCTION(c, b->start + 2 * i, b->ops[i]->opcode);
+	}
+
+	tickTimers(c, length - 1);
+	unsigned short pc = c->pc;
+	c->instruction = b->ops[length - 1];
+	c->opcode = c->instruction->opcode;
+	c->instruction->execute(c, c->instruction);
+	TRACE_INSTRUCTION(c, pc, c->opcode);
+	updateTimers(c);
+
+	return length;
+}
+
+// Runs the block at pc. Returns the number of instructions executed.
+int emulateBlock(Chip8 *c) {
+	Block *b = getBlock(c, c->pc);
+	if(b == NULL) {
+		emulateCycle(c);
+		return 1;
+	}
+
+	return runBlock(c, b);
+}
+
+// Drops every block that decoded any byte in [address, address + length)
+void invalidateBlocks(Chip8 *c, unsigned short address, int length) {
+	BlockCache *cache = c->blockCache;
+	if(cache == NULL)
+		return;
+
+	int covered = 0;
+	for(int i = address; i < address + length && i < MEMORY_SIZE; i++)
+		covered |= cache->coverage[i];
+	if(!covered)
+		return;
+
+	int first = address - 2 * BLOCK_MAX_LENGTH + 1;
+	if(first < 0)
+		first = 0;
+
+	for(int start = first; start < address + length && start < MEMORY_SIZE; start++) {
+		Block *b = cache->blocks[start];
+		if(b != NULL && start + 2 * b->length > address)
+			freeBlock(cache, b);
+	}
+}
+
+void flushBlocks(Chip8 *c) {
+	BlockCache *cache = c->blockCache;
+	if(cache == NULL)
+		return;
+
+	for(int i = 0; i < MEMORY_SIZE && cache->blockCount > 0; i++) {
+		if(cache->blocks[i] != NULL)
+			freeBlock(cache, cache->blocks[i]);
+	}
+}
+
+void freeBlockCache(Chip8 *c) {
+	if(c->blockCache == NULL)
+		return;
+
+	flushBlocks(c);
+	freeJitCode(c->blockCache);
+	free(c->blockCache);
+	c->blockCache = NULL;
+}
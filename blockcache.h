@@ -0,0 +1,39 @@
+/* file blockcache.h */
+
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include "chip8.h"
+
+// Longest straight-line run decoded into one block
+#define BLOCK_MAX_LENGTH 32
+
+// Decoded basic block starting at a memory address
+typedef struct Block {
+	unsigned short start;
+	unsigned char length;	// Number of instructions
+	const Instruction *ops[BLOCK_MAX_LENGTH];
+
+	// Native translation, see jit.c
+	unsigned int hits;
+	void (*code)(Chip8 *c);
+	unsigned char pendingTicks;	// Timer ticks owed after code() returns
+} Block;
+
+// Per-instance engine state, allocated on first use
+typedef struct BlockCache {
+	Block *blocks[MEMORY_SIZE];				// Indexed by start address
+	int blockCount;
+	unsigned char coverage[MEMORY_SIZE];	// Number of cached blocks decoded from each memory byte
+	struct JitCode *jit;					// Translation buffer, see jit.c
+} BlockCache;
+
+Block * getBlock(Chip8 *c, unsigned short address);
+int runBlock(Chip8 *c, Block *b);
+int emulateBlock(Chip8 *c);
+void invalidateBlocks(Chip8 *c, unsigned short address, int length);
+void flushBlocks(Chip8 *c);
+void freeBlockCache(Chip8 *c);
+int endsBlock(InstructionHandler handler);
+
+#endif /* BLOCKCACHE_H */
@@ -1,580 +1,1170 @@
-/* file chip8.c */
-
-#include <stdio.h>
-#include <stdlib.h>
-
-#include "chip8.h"
-
-// Two byte opcode
-unsigned short opcode;
-void (*instruction)();
-
-// 4K memory
-unsigned char memory[MEMORY_SIZE];
-
-// Registers
-unsigned char V[NUM_OF_REGISTERS];  // V0, V1, ..., V16
-unsigned short I;	                // Index register
-unsigned short pc;
-	                // Program counter
-// Graphics
-unsigned char gfx[NUM_OF_PIXELS];
-unsigned char drawFlag;
-
-// Fontset
-unsigned char chip8Fontset[FONTSET_SIZE] =
-{
-	0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-	0x20, 0x60, 0x20, 0x20, 0x70, // 1
-	0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-	0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-	0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-	0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-	0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-	0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-	0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-	0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-	0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-	0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-	0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-	0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-	0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-	0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-};
-
-// 60Hz timers
-unsigned char delayTimer;
-unsigned char soundTimer;
-
-// Stack
-unsigned short stack[STACK_SIZE];
-unsigned short sp;	                // Stack pointer
-
-// HEX keypad
-unsigned char key[KEYPAD_SIZE] =
-{
-	0, 0, 0, 0,	// 1 2 3 4
-	0, 0, 0, 0,	// Q W E R
-	0, 0, 0, 0,	// A S D F
-	0, 0, 0, 0,	// Z X C V
-};
-
-void initialize() {
-	pc 		= 0x200;	// Program counter starts at 0x200
-	opcode 	= 0;		// Reset current opcode
-	I 		= 0;		// Reset index register
-	sp 		= 0;		// Reset stack pointer
-
-	for(int i = 0; i < MEMORY_SIZE; ++i)    // Clear memory
-		memory[i] = 0;
-    for(int i = 0; i < NUM_OF_REGISTERS; ++i)   // Clear registers
-		V[i] = 0;
-    for(int i = 0; i < STACK_SIZE; ++i)     // Clear stack
-		stack[i] = 0;
-	for(int i = 0; i < NUM_OF_PIXELS; ++i)  // Clear display
-		gfx[i] = 0;
-
-	drawFlag = 0;
-
-	for(int i = 0; i < FONTSET_SIZE; i++)	// Load fontset
-		memory[i + MEMORY_FONTSET] = chip8Fontset[i];
-
-	delayTimer = 0;	// Reset timers
-	soundTimer = 0;
-}
-
-int loadGame(char *file) {
-	FILE *fptr = fopen(file, "rb");
-	if(!fptr) {
-		fprintf(stderr, "Error: Unable to open game file\n");
-		fclose(fptr);
-		return -1;
-	}
-
-	fseek(fptr, 0, SEEK_END);
-	int size = ftell(fptr);
-	fseek(fptr, 0, SEEK_SET);
-
-	if(size > MEMORY_SIZE - MEMORY_PROGRAM) {
-        fprintf(stderr, "Error: Game file larger than Chip8 program memory\n");
-        fclose(fptr);
-        return -1;
-	}
-
-	unsigned char *buffer = (unsigned char*) malloc(sizeof(unsigned char) * size);
-	if(buffer == NULL) {
-        fprintf(stderr, "Error: Unable to allocate buffer memory\n");
-        fclose(fptr);
-        free(buffer);
-        return -1;
-	}
-
-	int n = fread(buffer, 1, size, fptr);
-	if(!n || n != size) {
-		fprintf(stderr, "Error: Unable to read game file\n");
-		fclose(fptr);
-        free(buffer);
-		return -1;
-	}
-
-	for(int i = 0; i < size; i++)
-		memory[MEMORY_PROGRAM + i] = buffer[i];
-
-	fclose(fptr);
-	free(buffer);
-
-	return 0;
-}
-
-void emulateCycle() {
-	// Fetch opcode
-	opcode = memory[pc] << 8 | memory[pc + 1];
-
-	// Decode and execute opcode
-	switch(opcode & 0xF000) {
-		case 0x0000:
-			switch(opcode & 0x000F) {
-				case 0x0000:	// 0x00E0
-					instruction = &instr00E0;
-                    break;
-				case 0x000E:	// 0x00EE
-					instruction = &instr00EE;
-                    break;
-				default:
-					printf("Unknown opcode [0x0000]: 0x%X\n", opcode);
-			}
-            break;
-		case 0x1000:
-			instruction = &instr1NNN;
-			break;
-		case 0x2000:
-			instruction = &instr2NNN;
-			break;
-		case 0x3000:
-			instruction = &instr3XNN;
-			break;
-		case 0x4000:
-			instruction = &instr4XNN;
-			break;
-		case 0x5000:
-			instruction = &instr5XY0;
-			break;
-		case 0x6000:
-			instruction = &instr6XNN;
-			break;
-		case 0x7000:
-			instruction = &instr7XNN;
-			break;
-		case 0x8000:
-			switch(opcode & 0x000F) {
-				case 0x0000:
-					instruction = &instr8XY0;
-					break;
-				case 0x0001:
-					instruction = &instr8XY1;
-					break;
-				case 0x0002:
-					instruction = &instr8XY2;
-					break;
-				case 0x0003:
-					instruction = &instr8XY3;
-					break;
-				case 0x0004:
-					instruction = &instr8XY4;
-					break;
-				case 0x0005:
-					instruction = &instr8XY5;
-					break;
-				case 0x0006:
-					instruction = &instr8XY6;
-					break;
-				case 0x0007:
-					instruction = &instr8XY7;
-					break;
-				case 0x000E:
-					instruction = &instr8XYE;
-					break;
-                default:
-                    printf("Unknown opcode: 0x%X\n", opcode);
-			}
-			break;
-		case 0x9000:
-			instruction = &instr9XY0;
-			break;
-		case 0xA000:
-			instruction = &instrANNN;
-			break;
-		case 0xB000:
-			instruction = &instrBNNN;
-			break;
-		case 0xC000:
-			instruction = &instrCXNN;
-			break;
-		case 0xD000:
-			instruction = &instrDXYN;
-			break;
-		case 0xE000:
-			switch(opcode & 0x00FF) {
-				case 0x009E:
-					instruction = &instrEX9E;
-					break;
-				case 0x00A1:
-					instruction = &instrEXA1;
-					break;
-                default:
-                    printf("Unknown opcode: 0x%X\n", opcode);
-			}
-			break;
-		case 0xF000:
-			switch(opcode & 0x00FF) {
-				case 0x0007:
-					instruction = &instrFX07;
-					break;
-				case 0x000A:
-					instruction = &instrFX0A;
-					break;
-				case 0x0015:
-					instruction = &instrFX15;
-					break;
-				case 0x0018:
-					instruction = &instrFX18;
-					break;
-				case 0x001E:
-					instruction = &instrFX1E;
-					break;
-				case 0x0029:
-					instruction = &instrFX29;
-					break;
-				case 0x0033:
-					instruction = &instrFX33;
-					break;
-				case 0x0055:
-					instruction = &instrFX55;
-					break;
-				case 0x0065:
-					instruction = &instrFX65;
-					break;
-			}
-			break;
-		default:
-			printf("Unknown opcode: 0x%X\n", opcode);
-	}
-
-	if(*instruction != NULL)
-		instruction();
-
-	// Update timers
-	if(delayTimer > 0)
-		delayTimer--;
-
-	if(soundTimer > 0) {
-		if(soundTimer == 1)
-			printf("\a");
-		soundTimer--;
-	}
-}
-
-unsigned char * getDrawFlag() {
-	return &drawFlag;
-}
-
-unsigned char * getGfx() {
-    return gfx;
-}
-
-void setKey(unsigned char k, unsigned char s) {
-    if(k > KEYPAD_SIZE - 1) {
-        printf("Error: Key index overflow");
-        return;
-    }
-    if(s != 1 && s != 0)
-        return;
-
-    key[k] = s;
-}
-
-/* The 35 CPU instructions */
-
-// 0NNN Call: Calls RCA 1802 program at address NNN. Not necessary for most ROMs.
-void instr0NNN() {
-	fprintf(stderr, "CPU instruction 0x0NNN (Call RCA 1802 program at address NNN) is not supported\n");
-	exit(EXIT_FAILURE);
-}
-
-// 00E0 Display - disp_clear: Clears the screen
-void instr00E0() {
-	for(int i = 0; i < NUM_OF_PIXELS; i++)
-		gfx[i] = 0;
-	drawFlag = 1;
-	pc += 2;
-}
-
-// 00EE Flow - return;: Returns from a subroutine
-void instr00EE() {
-	pc = stack[--sp];
-	pc += 2;
-}
-
-// 1NNN Flow - Goto NNN;: Jumps to address NNN.
-void instr1NNN() {
-	pc = opcode & 0x0FFF;
-}
-
-// 2NNN Flow - *(0xNNN)(): Calls subroutine at NNN
-void instr2NNN() {
-	stack[sp++] = pc;
-	pc = opcode & 0x0FFF;
-}
-
-// 3XNN Cond - if(Vx == NN): Skips the next instruction if Vx equals NN.
-void instr3XNN() {
-	if(V[(unsigned char) (opcode >> 8 & 0x0F)] == (unsigned char) opcode)
-		pc += 4;
-	else
-		pc += 2;
-}
-
-// 4XNN Cond - if(Vx != NN): Skips the next instruction if Vx does not equal NN.
-void instr4XNN() {
-	if(V[(unsigned char) (opcode >> 8 & 0x0F)] != (unsigned char) opcode)
-		pc += 4;
-	else
-		pc += 2;
-}
-
-// 5XY0 Cond - if(Vx == Vy): Skips the next instruction if Vx equals Vy.
-void instr5XY0() {
-	if(V[(unsigned char) (opcode >> 8 & 0x0F)] == V[(unsigned char) (opcode >> 4 & 0x0F)])
-		pc += 4;
-	else
-		pc += 2;
-}
-
-// 6XNN Const - Vx = NN: Sets Vx to NN.
-void instr6XNN() {
-	V[(unsigned char) (opcode >> 8 & 0x0F)] = (unsigned char) opcode;
-	pc += 2;
-}
-
-// 7XNN Const - Vx += NN: Adds NN to Vx. (Carry flag is not changed)
-void instr7XNN() {
-	V[(unsigned char) (opcode >> 8 & 0x0F)] += (unsigned char) opcode;
-	pc += 2;
-}
-
-// 8XY0 Assign - Vx = Vy: Sets Vx to the value of Vy.
-void instr8XY0() {
-	V[(unsigned char) (opcode >> 8 & 0x0F)] = V[(unsigned char) (opcode >> 4 & 0x0F)];
-	pc += 2;
-}
-
-// 8XY1 BitOp - Vx = Vx | Vy: Sets Vx to Vx OR Vy (Bitwise OR)
-void instr8XY1() {
-	V[(unsigned char) (opcode >> 8 & 0x0F)] |= V[(unsigned char) (opcode >> 4 & 0x0F)];
-	pc += 2;
-}
-
-// 8XY2 BitOp - Vx = Vx & Vy: Sets Vx to Vx AND Vy (Bitwise AND)
-void instr8XY2() {
-	V[(unsigned char) (opcode >> 8 & 0x0F)] &= V[(unsigned char) (opcode >> 4 & 0x0F)];
-	pc += 2;
-}
-
-// 8XY3 BitOp - Vx = Vx ^ Vy: Sets Vx to Vx XOR Vy
-void instr8XY3() {
-	V[(unsigned char) (opcode >> 8 & 0x0F)] ^= V[(unsigned char) (opcode >> 4 & 0x0F)];
-	pc += 2;
-}
-
-// 8XY4 Math - Vx += Vy: Adds Vy to Vx. VF is set to 1 when there's a carry, and to 0 when there isn't.
-void instr8XY4() {
-	if(V[(opcode & 0x00F0) >> 4] > (0xFF - V[(opcode & 0x0F00) >> 8]))
-		V[0xF] = 1; // Carry
-	else
-		V[0xF] = 0;
-
-	V[(opcode & 0x0F00) >> 8] += V[(opcode & 0x00F0) >> 4];
-	pc += 2;
-}
-
-// 8XY5 Math - Vx -= Vy: Vy is subtracted from Vx. VF is set to 0 when there's a borrow and 1 when there isn't.
-void instr8XY5() {
-	// Vx = V[(unsigned char) (opcode >> 8 & 0x0F)];
-	// Vy = V[(unsigned char) (opcode >> 4 & 0x0F)];
-	if(V[(unsigned char) (opcode >> 8 & 0x0F)] > V[(unsigned char) (opcode >> 4 & 0x0F)])
-		V[0xF] = 1;
-	else
-		V[0xF] = 0;
-
-    V[(unsigned char) (opcode >> 8 & 0x0F)] = V[(unsigned char) (opcode >> 8 & 0x0F)] - V[(unsigned char) (opcode >> 4 & 0x0F)];
-	pc += 2;
-}
-
-// 8XY6 BitOp - Vx = Vy >> 1: Shifts Vy right by one and stores the result to Vx. Set register VF to the least significant bit prior to the shift
-void instr8XY6() {
-	V[(unsigned char) (opcode >> 8 & 0x0F)] = V[(unsigned char) (opcode >> 4 & 0x0F)] >> 1;
-
-	V[0xF] = V[(unsigned char) (opcode >> 4 & 0x0F)] & 1;
-	pc += 2;
-}
-
-// 8XY7 Math - Vx = Vy - Vx: Sets Vx to Vy minus Vx. VF is set to 0 when there's a borrow and 1 when there isn't.
-void instr8XY7() {
-	if(V[(unsigned char) (opcode >> 4 & 0x0F)] > V[(unsigned char) (opcode >> 8 & 0x0F)])
-		V[0xF] = 1;
-	else
-		V[0xF] = 0;
-
-	V[(unsigned char) (opcode >> 8 & 0x0F)] = V[(unsigned char) (opcode >> 4 & 0x0F)] - V[(unsigned char) (opcode >> 8 & 0x0F)];
-
-	pc += 2;
-}
-
-// 8XYE BitOp - Vx = Vy << 1: Store the value of register VY shifted left one bit in register VX. Set register VF to the most significant bit prior to the shift
-void instr8XYE() {
-	V[(unsigned char) (opcode >> 8 & 0x0F)] = V[(unsigned char) (opcode >> 4 & 0x0F)] << 1;
-
-	V[0xF] = V[(unsigned char) (opcode >> 4 & 0x0F)] >> 7 & 1;
-	pc += 2;
-}
-
-// 9XY0 Cond - if(Vx != Vy): Skips the next instruction if Vx doesn't equal Vy.
-void instr9XY0() {
-	if(V[(unsigned char) (opcode >> 8 & 0x0F)] != V[(unsigned char) (opcode >> 4 & 0x0F)])
-		pc += 4;
-	else
-		pc += 2;
-}
-
-// ANNN MEM - I = NNN: Sets I to the address NNN.
-void instrANNN() {
-	I = opcode & 0x0FFF;
-	pc += 2;
-}
-
-// BNNN Flow - PC = V0 + NNN: Jumps to the address NNN plus V0.
-void instrBNNN() {
-	pc = V[0] + (opcode & 0x0FFF);
-}
-
-// CXNN Rand - Vx = rand() & NN: Sets Vx to the result of a bitwise AND operation on a random number and NN.
-void instrCXNN() {
-	V[(unsigned char) (opcode >> 8 & 0x0F)] = (rand() % 256) & (unsigned char) opcode;
-	pc += 2;
-}
-
-// Disp - draw(Vx, Vy, N): Draws a sprite at coordinate (VX, VY) that has a width of 8 pixels and a height of N pixels.
-void instrDXYN() {
-	unsigned short x = V[(opcode & 0x0F00) >> 8];
-    unsigned short y = V[(opcode & 0x00F0) >> 4];
-    unsigned short height = opcode & 0x000F;
-    unsigned short pixel;
-
-    V[0xF] = 0;
-    for (int yline = 0; yline < height; yline++) {
-        pixel = memory[I + yline];
-        for(int xline = 0; xline < 8; xline++) {
-            if((pixel & (0x80 >> xline)) != 0) {
-                if(gfx[(x + xline + ((y + yline) * 64))] == 1)
-                    V[0xF] = 1;
-                gfx[x + xline + ((y + yline) * 64)] ^= 1;
-            }
-        }
-    }
-
-    drawFlag = 1;
-    pc += 2;
-}
-
-// EX9E KeyOp - if(key() == Vx): Skips the next instruction if the key stored in Vx is pressed.
-void instrEX9E() {
-	if(key[V[(unsigned char) (opcode >> 8 & 0x0F)]] == 1)
-		pc += 4;
-	else
-		pc += 2;
-}
-
-// EXA1 KeyOp - if(key() != Vx): Skips the next instruction if the key stored in Vx is not pressed.
-void instrEXA1() {
-	if(key[V[(unsigned char) (opcode >> 8 & 0x0F)]] == 0)
-		pc += 4;
-	else
-		pc += 2;
-}
-
-// FX07 Timer - Vx = get_delay(): Sets Vx to the value of the delay timer.
-void instrFX07() {
-	V[(unsigned char) (opcode >> 8 & 0x0F)] = delayTimer;
-	pc += 2;
-}
-
-// FX0A KeyOp - Vx = get_key(): A key press is awaited, and then stored in VX.
-void instrFX0A() {
-    char pressed = 0;
-
-    for(int i = 0; i < KEYPAD_SIZE; i++) {
-        if(key[i]) {
-            V[(unsigned char) (opcode >> 8 & 0x0F)] = i;
-            pressed = 1;
-        }
-    }
-    if(!pressed) {
-        return;
-    }
-
-	pc += 2;
-}
-
-// FX15 Timer - delay_timer(Vx): Sets the delay timer to Vx.
-void instrFX15() {
-	delayTimer = V[(unsigned char) (opcode >> 8 & 0x0F)];
-
-	pc += 2;
-}
-
-// FX18 Sound - sound_timer(Vx): Sets the sound timer to Vx.
-void instrFX18() {
-	soundTimer = V[(unsigned char) (opcode >> 8 & 0x0F)];
-
-	pc += 2;
-}
-
-// FX1E MEM - I += Vx: Adds Vx to I.
-void instrFX1E() {
-	I += V[(unsigned char) (opcode >> 8 & 0x0F)];
-	pc += 2;
-}
-
-// FX29 MEM - I = sprite_addr[Vx]: Sets I to the location of the sprite for the character in Vx.
-void instrFX29() {
-    I = V[(unsigned char) (opcode >> 8 & 0x0F)] * 0x5 + MEMORY_FONTSET;
-    pc += 2;
-}
-
-// FX33 BCD: Store binary-coded decimal representation of VX at the addresses I, I + 1 and I + 2
-void instrFX33() {
-	memory[I]	  = V[(opcode & 0x0F00) >> 8] / 100;
-	memory[I + 1] = (V[(opcode & 0x0F00) >> 8] / 10) % 10;
-	memory[I + 2] = (V[(opcode & 0x0F00) >> 8] % 100) % 10;
-	pc += 2;
-}
-
-// FX55 MEM - reg_dump(Vx, &I): Stores V0 to Vx (including Vx) in memory starting at address I.
-void instrFX55() {
-	for(int i = 0; i <= ((unsigned char) (opcode >> 8 & 0x0F)); i++) {
-		memory[I + i] = V[i];
-	}
-
-	I += ((opcode & 0x0F00) >> 8) + 1;
-	pc += 2;
-}
-
-// FX65 MEM - reg_load(Vx, &I): Fills V0 to Vx (including Vx) with values from memory starting at address I.
-void instrFX65() {
-	for(int i = 0; i <= ((unsigned char) (opcode >> 8 & 0x0F)); i++) {
-		V[i] = memory[I + i];
-	}
-
-	I += ((opcode & 0x0F00) >> 8) + 1;
-	pc += 2;
-}
+/* file chip8.c */
+
+#include <limits.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+	#include <malloc.h>
+#endif
+
+#include "chip8.h"
+#include "blockcache.h"
+#include "jit.h"
+#include "profile.h"
+#include "trace.h"
+
+// Pre-decoded instructions, indexed by the full 16-bit opcode
+Instruction decodeTable[65536];
+
+// Memory hash of an initialized machine, every one holds the same memory
+static unsigned long long initialHash;
+
+static atomic_int tablesState;	// 0 not built, 1 being built, 2 built
+
+// Fontset
+unsigned char chip8Fontset[FONTSET_SIZE] =
+{
+	0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+	0x20, 0x60, 0x20, 0x20, 0x70, // 1
+	0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+	0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+	0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+	0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+	0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+	0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+	0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+	0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+	0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+	0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+	0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+	0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+	0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+	0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
+
+static void countInstructions(Chip8 *c, unsigned int *countdown, unsigned long long n);
+static void applyTicks(Chip8 *c, unsigned long long ticks);
+static void countdownExpired(Chip8 *c);
+static int skipIdle(Chip8 *c, int budget, int *skipped);
+static unsigned long long hashByte(unsigned int address, unsigned char value);
+static unsigned long long hashRow(unsigned int row, unsigned long long pixels);
+static unsigned long long hashMemory(const unsigned char *memory);
+static void buildDecodeTable();
+
+_Static_assert(offsetof(Chip8, tickCountdown) + sizeof(((Chip8*) 0)->tickCountdown) <= 64, "Chip8 hot registers must fit in one cache line");
+
+// Builds the tables shared by every instance: the decode table and the hash of initialized memory.
+// Runs once, whichever thread comes first builds them while the others wait. initialize() calls it,
+// hosts that create machines on several threads may call it up front.
+void initTables() {
+	if(atomic_load_explicit(&tablesState, memory_order_acquire) == 2)
+		return;
+
+	int expected = 0;
+	if(atomic_compare_exchange_strong(&tablesState, &expected, 1)) {
+		unsigned char memory[MEMORY_SIZE] = { 0 };
+		memcpy(memory + MEMORY_FONTSET, chip8Fontset, FONTSET_SIZE);
+		initialHash = hashMemory(memory);
+		buildDecodeTable();
+		atomic_store_explicit(&tablesState, 2, memory_order_release);
+	} else {
+		while(atomic_load_explicit(&tablesState, memory_order_acquire) != 2)
+			;
+	}
+}
+
+Chip8 * createChip8() {
+	Chip8 *c;
+#ifdef _WIN32
+	c = (Chip8*) _aligned_malloc(sizeof(Chip8), _Alignof(Chip8));
+#else
+	c = (Chip8*) aligned_alloc(_Alignof(Chip8), sizeof(Chip8));
+#endif
+	if(c == NULL) {
+		fprintf(stderr, "Error: Unable to allocate Chip8 instance\n");
+		return NULL;
+	}
+
+	memset(c, 0, sizeof(Chip8));
+	initialize(c);
+
+	return c;
+}
+
+void destroyChip8(Chip8 *c) {
+	if(c == NULL)
+		return;
+
+	freeBlockCache(c);
+	free(c->profile);
+#ifdef TRACE
+	stopTrace(c);
+#endif
+#ifdef _WIN32
+	_aligned_free(c);
+#else
+	free(c);
+#endif
+}
+
+void initialize(Chip8 *c) {
+	c->pc 		= 0x200;	// Program counter starts at 0x200
+	c->opcode 	= 0;		// Reset current opcode
+	c->I 		= 0;		// Reset index register
+	c->sp 		= 0;		// Reset stack pointer
+
+	for(int i = 0; i < MEMORY_SIZE; ++i)    // Clear memory
+		c->memory[i] = 0;
+    for(int i = 0; i < NUM_OF_REGISTERS; ++i)   // Clear registers
+		c->V[i] = 0;
+    for(int i = 0; i < STACK_SIZE; ++i)     // Clear stack
+		c->stack[i] = 0;
+	for(int i = 0; i < NUM_OF_PIXEL_ROWS; ++i)  // Clear display
+		c->gfx[i] = 0;
+
+	c->drawFlag = 0;
+	c->dirtyRows = ~0u;		// Display was cleared
+	c->image = NULL;			// No longer the memory any branch shares
+	c->dirtyPages = ALL_PAGES;	// Memory was rewritten
+	c->elided = 0;
+	c->keyWait = 0;
+	c->cycleCount = 0;
+	setSeed(c, DEFAULT_SEED);
+
+	for(int i = 0; i < FONTSET_SIZE; i++)	// Load fontset
+		c->memory[i + MEMORY_FONTSET] = chip8Fontset[i];
+
+	initTables();	// Decode every opcode once
+	c->memoryHash = initialHash;
+	c->staleRows = ~0u;
+
+	c->delayTimer = 0;	// Reset timers
+	c->soundTimer = 0;
+	setClock(c, DEFAULT_CLOCK_HZ);
+
+	flushBlocks(c);	// Memory was rewritten
+}
+
+int loadGame(Chip8 *c, char *file) {
+	FILE *fptr = fopen(file, "rb");
+	if(!fptr) {
+		fprintf(stderr, "Error: Unable to open game file\n");
+		fclose(fptr);
+		return -1;
+	}
+
+	fseek(fptr, 0, SEEK_END);
+	int size = ftell(fptr);
+	fseek(fptr, 0, SEEK_SET);
+
+	if(size > MEMORY_SIZE - MEMORY_PROGRAM) {
+        fprintf(stderr, "Error: Game file larger than Chip8 program memory\n");
+        fclose(fptr);
+        return -1;
+	}
+
+	unsigned char *buffer = (unsigned char*) malloc(sizeof(unsigned char) * size);
+	if(buffer == NULL) {
+        fprintf(stderr, "Error: Unable to allocate buffer memory\n");
+        fclose(fptr);
+        free(buffer);
+        return -1;
+	}
+
+	int n = fread(buffer, 1, size, fptr);
+	if(!n || n != size) {
+		fprintf(stderr, "Error: Unable to read game file\n");
+		fclose(fptr);
+        free(buffer);
+		return -1;
+	}
+
+	fclose(fptr);
+	int loaded = loadRom(c, buffer, size);
+	free(buffer);
+
+	return loaded;
+}
+
+// Copies a program image to MEMORY_PROGRAM, e.g. a ROM built in memory
+int loadRom(Chip8 *c, const unsigned char *rom, int size) {
+	if(size > MEMORY_SIZE - MEMORY_PROGRAM) {
+        fprintf(stderr, "Error: Game file larger than Chip8 program memory\n");
+        return -1;
+	}
+
+	for(int i = 0; i < size; i++) {
+		c->memoryHash ^= hashByte(MEMORY_PROGRAM + i, c->memory[MEMORY_PROGRAM + i]) ^ hashByte(MEMORY_PROGRAM + i, rom[i]);
+		c->memory[MEMORY_PROGRAM + i] = rom[i];
+	}
+	c->dirtyPages = ALL_PAGES;
+	flushBlocks(c);
+
+	return 0;
+}
+
+// Opcode at pc. BNNN can jump up to 0x10FE and 00EE returns to any saved address, so the fetch
+// wraps around the end of memory like the accesses through I.
+static inline unsigned short fetchOpcode(const Chip8 *c, unsigned short pc) {
+	return c->memory[pc % MEMORY_SIZE] << 8 | c->memory[(pc + 1) % MEMORY_SIZE];
+}
+
+void emulateCycle(Chip8 *c) {
+	// Fetch opcode
+	unsigned short pc = c->pc;
+	unsigned short opcode = fetchOpcode(c, pc);
+	PROFILE_INSTRUCTION(c, pc, opcode);
+
+	// Decode and execute opcode
+	c->opcode = opcode;
+	c->instruction = &decodeTable[opcode];
+	c->instruction->execute(c, c->instruction);
+	TRACE_INSTRUCTION(c, pc, opcode);
+
+	updateTimers(c);
+}
+
+// Counts one instruction, the timers tick every cyclesPerTick instructions.
+// With lazy timers the countdown only counts instructions, see syncTimers().
+void updateTimers(Chip8 *c) {
+	if(--c->tickCountdown == 0)
+		countdownExpired(c);
+}
+
+// Ticks the timers when tickCountdown reaches 0
+static void countdownExpired(Chip8 *c) {
+	if(c->lazyTimers) {
+		syncTimers(c);
+		return;
+	}
+
+	c->tickCountdown = c->cyclesPerTick;
+	if(c->cyclesPerTick != 0)
+		applyTicks(c, 1);
+}
+
+// Same as n calls to updateTimers()
+void tickTimers(Chip8 *c, int n) {
+	if(n <= 0)
+		return;
+
+	if(c->lazyTimers) {
+		if((unsigned int) n >= c->tickCountdown)
+			syncTimers(c);
+		c->tickCountdown -= n;
+		return;
+	}
+
+	countInstructions(c, &c->tickCountdown, n);
+}
+
+// Runs n instructions' worth of ticks against countdown, the instructions left until the next tick
+static void countInstructions(Chip8 *c, unsigned int *countdown, unsigned long long n) {
+	if(n < *countdown || c->cyclesPerTick == 0) {
+		*countdown -= (unsigned int) n;
+		return;
+	}
+
+	n -= *countdown;
+	applyTicks(c, 1 + n / c->cyclesPerTick);
+	*countdown = c->cyclesPerTick - (unsigned int) (n % c->cyclesPerTick);
+}
+
+// Applies timer ticks, beeping when the sound timer runs out
+static void applyTicks(Chip8 *c, unsigned long long ticks) {
+	if(ticks == 0)
+		return;
+
+	c->delayTimer = c->delayTimer > ticks ? c->delayTimer - ticks : 0;
+
+	if(c->soundTimer > 0) {
+		if(c->soundTimer <= ticks) {
+			fprintf(stderr, "\a");	// stdout may carry a headless host's results
+			c->soundTimer = 0;
+		} else {
+			c->soundTimer -= ticks;
+		}
+	}
+}
+
+// Applies ticks driven by the wall clock, after the ones owed by instructions already run
+void decrementTimers(Chip8 *c, int ticks) {
+	if(ticks <= 0)
+		return;
+
+	syncTimers(c);
+	applyTicks(c, ticks);
+}
+
+// Lazy timers: the timers hold their value as of the last sync and tickCountdown counts
+// down from LAZY_COUNTDOWN, so running instructions costs nothing beyond the decrement.
+// Syncing applies the ticks the eager model would have applied over the instructions
+// since, against tickPhase. Called before the timers are read or written, and by the
+// front end once per slice so the beep is not late.
+void syncTimers(Chip8 *c) {
+	if(!c->lazyTimers)
+		return;
+
+	countInstructions(c, &c->tickPhase, LAZY_COUNTDOWN - c->tickCountdown);
+	c->tickCountdown = LAZY_COUNTDOWN;
+}
+
+// Switches between ticking the timers as instructions run and computing them on demand.
+// Both give the same timer values after every instruction.
+void setLazyTimers(Chip8 *c, int lazy) {
+	if(!lazy == !c->lazyTimers)
+		return;
+
+	if(lazy) {
+		c->tickPhase = c->tickCountdown;
+		c->tickCountdown = LAZY_COUNTDOWN;
+	} else {
+		syncTimers(c);
+		c->tickCountdown = c->tickPhase;
+	}
+	c->lazyTimers = lazy != 0;
+}
+
+unsigned char getDelayTimer(Chip8 *c) {
+	syncTimers(c);
+	return c->delayTimer;
+}
+
+unsigned char getSoundTimer(Chip8 *c) {
+	syncTimers(c);
+	return c->soundTimer;
+}
+
+// Instructions per second the timers are derived from: a timer tick every hz / 60 instructions.
+// CLOCK_UNLIMITED leaves ticking to the caller, see scheduler.c. Restored by initialize().
+void setClock(Chip8 *c, unsigned int hz) {
+	c->cyclesPerTick = hz == CLOCK_UNLIMITED ? 0 : (hz + TIMER_HZ / 2) / TIMER_HZ;
+	if(hz != CLOCK_UNLIMITED && c->cyclesPerTick == 0)
+		c->cyclesPerTick = 1;
+
+	if(c->lazyTimers) {
+		c->tickPhase = c->cyclesPerTick;
+		c->tickCountdown = LAZY_COUNTDOWN;
+	} else {
+		c->tickCountdown = c->cyclesPerTick;
+	}
+}
+
+void setEngine(Chip8 *c, int e) {
+	c->engine = e;
+}
+
+int getEngine(Chip8 *c) {
+	return c->engine;
+}
+
+static int step(Chip8 *c) {
+	switch(c->engine) {
+		case ENGINE_BLOCK_CACHE:
+			return emulateBlock(c);
+		case ENGINE_JIT:
+			return emulateJit(c);
+		default:
+			emulateCycle(c);
+			return 1;
+	}
+}
+
+// Advances the machine with the selected engine. Returns the number of instructions executed.
+int emulate(Chip8 *c) {
+	int n = step(c);
+	c->cycleCount += n;
+	return n;
+}
+
+// Runs up to cycles instructions with the current engine in one call, so the caller polls input
+// and renders once per frame rather than once per instruction. Stops early after an instruction
+// that draws, or when the machine idles (see skipIdle()). Stores the number of instructions
+// executed, skipped ones included (a block can overrun the budget), and returns the FRAME_* reason.
+int emulateFrame(Chip8 *c, int cycles, int *executed) {
+	unsigned char drawn = c->drawFlag;	// Only draws by this frame's instructions end it early
+	int reason = FRAME_DONE;
+	int n = 0;
+	int skipped;
+
+	c->drawFlag = 0;
+	if(c->keyWait) {
+		reason = skipIdle(c, cycles, &n);
+	} else if(c->engine != ENGINE_INTERPRETER) {
+		while(n < cycles && reason == FRAME_DONE) {
+			unsigned short pc = c->pc;
+			n += step(c);
+
+			if(c->drawFlag) {
+				reason = FRAME_DRAW;
+			} else if((unsigned short) (pc - c->pc) <= 4) {
+				reason = skipIdle(c, cycles - n, &skipped);
+				n += skipped;
+			}
+		}
+	} else {
+		while(n < cycles && reason == FRAME_DONE) {
+			// No timer tick falls inside a run, so the countdown only reaches 0 on its last
+			// instruction and the timers are ticked once after it
+			int run = cycles - n;
+			if(c->tickCountdown != 0 && c->tickCountdown < (unsigned int) run)
+				run = c->tickCountdown;
+
+			int i = 0;
+			int backward = 0;
+			while(i < run) {
+				unsigned short pc = c->pc;
+				unsigned short opcode = fetchOpcode(c, pc);
+				PROFILE_INSTRUCTION(c, pc, opcode);
+				c->opcode = opcode;
+				c->instruction = &decodeTable[opcode];
+				c->instruction->execute(c, c->instruction);
+				TRACE_INSTRUCTION(c, pc, opcode);
+				c->tickCountdown--;
+				i++;
+
+				// Idle loops end in a jump back by at most two instructions
+				backward = (unsigned short) (pc - c->pc) <= 4;
+				if(c->drawFlag | backward)
+					break;
+			}
+
+			if(c->tickCountdown == 0)
+				countdownExpired(c);
+			n += i;
+
+			if(c->drawFlag) {
+				reason = FRAME_DRAW;
+			} else if(backward) {
+				reason = skipIdle(c, cycles - n, &skipped);
+				n += skipped;
+			}
+		}
+	}
+
+	c->drawFlag |= drawn;
+	c->cycleCount += n;
+	*executed = n;
+	return reason;
+}
+
+// Runs the machine until its cycle count reaches until exactly. A block can overrun the budget by
+// less than its length, so the selected engine stops BLOCK_MAX_LENGTH short and the interpreter,
+// which cannot, runs the rest. Returns FRAME_HALT if the machine got stuck on an unknown opcode
+// before, FRAME_DONE otherwise.
+int runUntil(Chip8 *c, unsigned long long until) {
+	int n, reason = FRAME_DONE;
+
+	while(reason != FRAME_HALT && c->cycleCount + BLOCK_MAX_LENGTH < until) {
+		unsigned long long budget = until - c->cycleCount - BLOCK_MAX_LENGTH;
+		reason = emulateFrame(c, budget > INT_MAX ? INT_MAX : (int) budget, &n);
+	}
+
+	int engine = c->engine;
+	setEngine(c, ENGINE_INTERPRETER);
+	while(reason != FRAME_HALT && c->cycleCount < until)
+		reason = emulateFrame(c, (int) (until - c->cycleCount), &n);
+	setEngine(c, engine);
+
+	return reason == FRAME_HALT ? FRAME_HALT : FRAME_DONE;
+}
+
+// Fast-forwards a machine idling at pc, where running the next instructions would change
+// nothing but the timers:
+//  - 1NNN jumping to itself, or FX0A waiting for a key: the rest of the budget is skipped, only
+//    the timers or a key can get the program going again
+//  - FX07, 3XNN or 4XNN, 1NNN back to the FX07, polling the delay timer: the passes before the
+//    tick that lets the loop exit only read values that keep it looping, so they are skipped
+// Stores the number of instructions skipped, also added to elided. Returns FRAME_KEY or FRAME_IDLE
+// when the machine idled through the budget, FRAME_HALT on an unknown opcode and FRAME_DONE otherwise.
+static int skipIdle(Chip8 *c, int budget, int *skipped) {
+	unsigned short pc = c->pc;
+	int reason = FRAME_DONE;
+	int skip = 0;
+
+	*skipped = 0;
+	if(budget < 0)
+		budget = 0;
+
+	if(c->keyWait) {
+		tickTimers(c, budget);
+		c->elided += budget;
+		*skipped = budget;
+		return FRAME_KEY;
+	}
+
+	if(pc > MEMORY_SIZE - 6)
+		return reason;
+
+	const Instruction *in = &decodeTable[c->memory[pc] << 8 | c->memory[pc + 1]];
+	if(in->execute == &instrUnknown)
+		return FRAME_HALT;
+
+	if(in->execute == &instr1NNN && in->nnn == pc) {
+		skip = budget;
+		tickTimers(c, skip);
+		reason = FRAME_IDLE;
+	} else if(in->execute == &instrFX07) {
+		const Instruction *test = &decodeTable[c->memory[pc + 2] << 8 | c->memory[pc + 3]];
+		const Instruction *jump = &decodeTable[c->memory[pc + 4] << 8 | c->memory[pc + 5]];
+		if((test->execute != &instr3XNN && test->execute != &instr4XNN) || test->x != in->x
+			|| jump->execute != &instr1NNN || jump->nnn != pc)
+			return reason;
+
+		// 3XNN leaves the loop once the timer reads NN, 4XNN once it no longer does
+		unsigned char delay = getDelayTimer(c);
+		if((delay == test->nn) != (test->execute == &instr4XNN))
+			return reason;
+
+		// Ticks until a pass reads a value that leaves the loop, 0 if none will. With at least 3
+		// instructions per tick every value is read by some pass, with fewer one may be missed,
+		// so only the passes up to the next tick are skipped.
+		unsigned int ticks;
+		if(test->execute == &instr3XNN)
+			ticks = test->nn < delay ? delay - test->nn : 0;
+		else
+			ticks = delay > 0;
+		if(c->cyclesPerTick < 3 && ticks > 1)
+			ticks = 1;
+
+		int passes = budget / 3;
+		unsigned long long untilExit = ULLONG_MAX / 2;	// Instructions until that tick, never by default
+		if(c->cyclesPerTick != 0 && ticks != 0)
+			untilExit = (c->lazyTimers ? c->tickPhase : c->tickCountdown) + (unsigned long long) (ticks - 1) * c->cyclesPerTick;
+		if((untilExit + 2) / 3 < (unsigned long long) passes)
+			passes = (int) ((untilExit + 2) / 3);	// Passes whose FX07 runs before that tick
+		else
+			reason = FRAME_IDLE;
+
+		if(passes == 0)
+			return reason;
+
+		// The last pass skipped leaves the value it read in Vx
+		skip = 3 * passes;
+		tickTimers(c, skip - 3);
+		c->V[in->x] = getDelayTimer(c);
+		tickTimers(c, 3);
+		in = jump;
+	} else {
+		return reason;
+	}
+
+	c->opcode = in->opcode;
+	c->instruction = in;
+	c->elided += skip;
+	*skipped = skip;
+
+	return reason;
+}
+
+InstructionHandler decodeOpcode(unsigned short opcode) {
+	switch(opcode & 0xF000) {
+		case 0x0000:
+			switch(opcode & 0x000F) {
+				case 0x0000:	// 0x00E0
+					return &instr00E0;
+				case 0x000E:	// 0x00EE
+					return &instr00EE;
+			}
+			break;
+		case 0x1000:
+			return &instr1NNN;
+		case 0x2000:
+			return &instr2NNN;
+		case 0x3000:
+			return &instr3XNN;
+		case 0x4000:
+			return &instr4XNN;
+		case 0x5000:
+			return &instr5XY0;
+		case 0x6000:
+			return &instr6XNN;
+		case 0x7000:
+			return &instr7XNN;
+		case 0x8000:
+			switch(opcode & 0x000F) {
+				case 0x0000:
+					return &instr8XY0;
+				case 0x0001:
+					return &instr8XY1;
+				case 0x0002:
+					return &instr8XY2;
+				case 0x0003:
+					return &instr8XY3;
+				case 0x0004:
+					return &instr8XY4;
+				case 0x0005:
+					return &instr8XY5;
+				case 0x0006:
+					return &instr8XY6;
+				case 0x0007:
+					return &instr8XY7;
+				case 0x000E:
+					return &instr8XYE;
+			}
+			break;
+		case 0x9000:
+			return &instr9XY0;
+		case 0xA000:
+			return &instrANNN;
+		case 0xB000:
+			return &instrBNNN;
+		case 0xC000:
+			return &instrCXNN;
+		case 0xD000:
+			return &instrDXYN;
+		case 0xE000:
+			switch(opcode & 0x00FF) {
+				case 0x009E:
+					return &instrEX9E;
+				case 0x00A1:
+					return &instrEXA1;
+			}
+			break;
+		case 0xF000:
+			switch(opcode & 0x00FF) {
+				case 0x0007:
+					return &instrFX07;
+				case 0x000A:
+					return &instrFX0A;
+				case 0x0015:
+					return &instrFX15;
+				case 0x0018:
+					return &instrFX18;
+				case 0x001E:
+					return &instrFX1E;
+				case 0x0029:
+					return &instrFX29;
+				case 0x0033:
+					return &instrFX33;
+				case 0x0055:
+					return &instrFX55;
+				case 0x0065:
+					return &instrFX65;
+			}
+			break;
+	}
+
+	return NULL;
+}
+
+static void buildDecodeTable() {
+	for(int i = 0; i < 65536; i++) {
+		Instruction *in = &decodeTable[i];
+
+		in->execute = decodeOpcode(i);
+		if(in->execute == NULL)
+			in->execute = &instrUnknown;
+
+		in->opcode	= i;
+		in->x		= i >> 8 & 0x0F;
+		in->y		= i >> 4 & 0x0F;
+		in->n		= i & 0x000F;
+		in->nn		= i & 0x00FF;
+		in->nnn		= i & 0x0FFF;
+	}
+}
+
+const Instruction * decode(unsigned short opcode) {
+	initTables();
+
+	return &decodeTable[opcode];
+}
+
+unsigned char * getDrawFlag(Chip8 *c) {
+	return &c->drawFlag;
+}
+
+// Framebuffer as one byte (0 or 1) per pixel, row by row
+unsigned char * getGfx(Chip8 *c) {
+	expandGfx(c->gfx, c->pixels, ~0u);
+	return c->pixels;
+}
+
+// Framebuffer as NUM_OF_PIXEL_ROWS words, column 0 in the most significant bit
+unsigned long long * getGfxRows(Chip8 *c) {
+	return c->gfx;
+}
+
+// Expands the rows selected by mask, bit n for row n, into one byte per pixel
+void expandGfx(const unsigned long long *rows, unsigned char *pixels, unsigned int mask) {
+	for(int y = 0; y < NUM_OF_PIXEL_ROWS; y++) {
+		if(!(mask >> y & 1))
+			continue;
+		for(int x = 0; x < NUM_OF_PIXEL_COLS; x++)
+			pixels[y * NUM_OF_PIXEL_COLS + x] = rows[y] >> (NUM_OF_PIXEL_COLS - 1 - x) & 1;
+	}
+}
+
+// Returns the rows changed since the last call, bit n for row n, for the display to redraw
+unsigned int takeDirtyRows(Chip8 *c) {
+	unsigned int dirty = c->dirtyRows;
+	c->dirtyRows = 0;
+	return dirty;
+}
+
+// 64-bit FNV-1a hash of the framebuffer rows
+unsigned long long getGfxHash(Chip8 *c) {
+	unsigned long long hash = 0xCBF29CE484222325ULL;
+
+	for(int i = 0; i < NUM_OF_PIXEL_ROWS; i++) {
+		hash ^= c->gfx[i];
+		hash *= 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+
+// State hashes. Memory is hashed Zobrist style: the XOR of one key per byte, a mix of address and
+// value. A store changes it by the keys of the old and the new value, so FX33 and FX55 keep
+// memoryHash up to date. Framebuffer rows are hashed the same way, but drawing changes many rows
+// per instruction, so DXYN and 00E0 only mark them stale and getStateHash() rehashes those.
+static unsigned long long mixHash(unsigned long long k) {
+	k ^= k >> 33;
+	k *= 0xFF51AFD7ED558CCDULL;
+	k ^= k >> 33;
+	k *= 0xC4CEB9FE1A85EC53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+static unsigned long long hashByte(unsigned int address, unsigned char value) {
+	return mixHash(0xA0761D6478BD642FULL ^ (address << 8 | value));
+}
+
+static unsigned long long hashRow(unsigned int row, unsigned long long pixels) {
+	return mixHash(pixels ^ (row + 1) * 0x9E3779B97F4A7C15ULL);
+}
+
+static unsigned long long hashMemory(const unsigned char *memory) {
+	unsigned long long hash = 0;
+	for(int i = 0; i < MEMORY_SIZE; i++)
+		hash ^= hashByte(i, memory[i]);
+	return hash;
+}
+
+static unsigned long long hashGfx(Chip8 *c) {
+	unsigned long long hash = 0;
+	for(int i = 0; i < NUM_OF_PIXEL_ROWS; i++)
+		hash ^= hashRow(i, c->gfx[i]);
+	return hash;
+}
+
+// Chains the registers, stack, timers and key wait into a content hash
+static unsigned long long hashRegisters(Chip8 *c, unsigned long long hash) {
+	unsigned long long words[1 + (NUM_OF_REGISTERS + sizeof(c->stack)) / 8];
+
+	words[0] = c->pc | (unsigned long long) c->I << 16 | (unsigned long long) c->sp << 32
+		| (unsigned long long) c->keyWait << 40 | (unsigned long long) getDelayTimer(c) << 48
+		| (unsigned long long) getSoundTimer(c) << 56;
+	memcpy(words + 1, c->V, NUM_OF_REGISTERS);
+	memcpy((unsigned char*) (words + 1) + NUM_OF_REGISTERS, c->stack, sizeof(c->stack));
+	for(int i = 0; i < (int) (sizeof(words) / 8); i++)
+		hash = mixHash(hash ^ words[i]);
+	return hash;
+}
+
+// 64-bit hash of the machine state, for telling visited states apart: registers, stack, timers,
+// memory and framebuffer. Costs a few dozen instructions plus two per row drawn since the last call.
+unsigned long long getStateHash(Chip8 *c) {
+	if(c->staleRows == ~0u) {	// After initialize() or a restore
+		c->gfxHash = 0;
+		for(int i = 0; i < NUM_OF_PIXEL_ROWS; i++) {
+			c->rowHashes[i] = hashRow(i, c->gfx[i]);
+			c->gfxHash ^= c->rowHashes[i];
+		}
+	} else {
+		for(unsigned int rows = c->staleRows; rows; rows &= rows - 1) {
+			int i = __builtin_ctz(rows);
+			unsigned long long hash = hashRow(i, c->gfx[i]);
+			c->gfxHash ^= c->rowHashes[i] ^ hash;
+			c->rowHashes[i] = hash;
+		}
+	}
+	c->staleRows = 0;
+
+	return hashRegisters(c, c->memoryHash ^ c->gfxHash);
+}
+
+// getStateHash() computed from scratch
+unsigned long long computeStateHash(Chip8 *c) {
+	return hashRegisters(c, hashMemory(c->memory) ^ hashGfx(c));
+}
+
+// Recomputes the memory hash after memory was written other than by instructions or loadRom()
+void rehashMemory(Chip8 *c) {
+	c->memoryHash = hashMemory(c->memory);
+}
+
+void setKey(Chip8 *c, unsigned char k, unsigned char s) {
+    if(k > KEYPAD_SIZE - 1) {
+        printf("Error: Key index overflow");
+        return;
+    }
+    if(s != 1 && s != 0)
+        return;
+
+    c->key[k] = s;
+    if(s)
+        c->keyWait = 0;     // FX0A runs again and takes the key
+}
+
+// Seeds the machine's CXNN generator, so a run repeats exactly. Every seed, 0 included, is
+// scrambled (splitmix64) into a valid state.
+void setSeed(Chip8 *c, unsigned long long seed) {
+	unsigned long long z = seed + 0x9E3779B97F4A7C15ull;
+	z = (z ^ z >> 30) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ z >> 27) * 0x94D049BB133111EBull;
+	z ^= z >> 31;
+	c->rng = z != 0 ? z : 1;
+}
+
+// Non-zero while FX0A waits for a key press, nothing but the timers changes until setKey() reports one
+int isWaitingForKey(Chip8 *c) {
+	return c->keyWait;
+}
+
+/* The 35 CPU instructions */
+
+// Any opcode that does not decode to one of the 35 instructions
+void instrUnknown(Chip8 *c, const Instruction *in) {
+	TRACE_FAULT(c, in);
+	fprintf(stderr, "Unknown opcode: 0x%X\n", in->opcode);
+}
+
+// 0NNN Call: Calls RCA 1802 program at address NNN. Not necessary for most ROMs.
+void instr0NNN(Chip8 *c, const Instruction *in) {
+	fprintf(stderr, "CPU instruction 0x0NNN (Call RCA 1802 program at address NNN) is not supported\n");
+	exit(EXIT_FAILURE);
+}
+
+// 00E0 Display - disp_clear: Clears the screen
+void instr00E0(Chip8 *c, const Instruction *in) {
+	unsigned int rows = 0;
+	for(int i = 0; i < NUM_OF_PIXEL_ROWS; i++)	// Only rows with lit pixels change
+		if(c->gfx[i])
+			rows |= 1u << i;
+	c->dirtyRows |= rows;
+	c->staleRows |= rows;
+	memset(c->gfx, 0, sizeof(c->gfx));
+	c->drawFlag = 1;
+	c->pc += 2;
+}
+
+// 00EE Flow - return;: Returns from a subroutine
+void instr00EE(Chip8 *c, const Instruction *in) {
+	c->pc = c->stack[--c->sp];
+	c->pc += 2;
+}
+
+// 1NNN Flow - Goto NNN;: Jumps to address NNN.
+void instr1NNN(Chip8 *c, const Instruction *in) {
+	c->pc = in->nnn;
+}
+
+// 2NNN Flow - *(0xNNN)(): Calls subroutine at NNN
+void instr2NNN(Chip8 *c, const Instruction *in) {
+	c->stack[c->sp++] = c->pc;
+	c->pc = in->nnn;
+}
+
+// 3XNN Cond - if(Vx == NN): Skips the next instruction if Vx equals NN.
+void instr3XNN(Chip8 *c, const Instruction *in) {
+	if(c->V[in->x] == in->nn)
+		c->pc += 4;
+	else
+		c->pc += 2;
+}
+
+// 4XNN Cond - if(Vx != NN): Skips the next instruction if Vx does not equal NN.
+void instr4XNN(Chip8 *c, const Instruction *in) {
+	if(c->V[in->x] != in->nn)
+		c->pc += 4;
+	else
+		c->pc += 2;
+}
+
+// 5XY0 Cond - if(Vx == Vy): Skips the next instruction if Vx equals Vy.
+void instr5XY0(Chip8 *c, const Instruction *in) {
+	if(c->V[in->x] == c->V[in->y])
+		c->pc += 4;
+	else
+		c->pc += 2;
+}
+
+// 6XNN Const - Vx = NN: Sets Vx to NN.
+void instr6XNN(Chip8 *c, const Instruction *in) {
+	c->V[in->x] = in->nn;
+	c->pc += 2;
+}
+
+// 7XNN Const - Vx += NN: Adds NN to Vx. (Carry flag is not changed)
+void instr7XNN(Chip8 *c, const Instruction *in) {
+	c->V[in->x] += in->nn;
+	c->pc += 2;
+}
+
+// 8XY0 Assign - Vx = Vy: Sets Vx to the value of Vy.
+void instr8XY0(Chip8 *c, const Instruction *in) {
+	c->V[in->x] = c->V[in->y];
+	c->pc += 2;
+}
+
+// 8XY1 BitOp - Vx = Vx | Vy: Sets Vx to Vx OR Vy (Bitwise OR)
+void instr8XY1(Chip8 *c, const Instruction *in) {
+	c->V[in->x] |= c->V[in->y];
+	c->pc += 2;
+}
+
+// 8XY2 BitOp - Vx = Vx & Vy: Sets Vx to Vx AND Vy (Bitwise AND)
+void instr8XY2(Chip8 *c, const Instruction *in) {
+	c->V[in->x] &= c->V[in->y];
+	c->pc += 2;
+}
+
+// 8XY3 BitOp - Vx = Vx ^ Vy: Sets Vx to Vx XOR Vy
+void instr8XY3(Chip8 *c, const Instruction *in) {
+	c->V[in->x] ^= c->V[in->y];
+	c->pc += 2;
+}
+
+// 8XY4 Math - Vx += Vy: Adds Vy to Vx. VF is set to 1 when there's a carry, and to 0 when there isn't.
+void instr8XY4(Chip8 *c, const Instruction *in) {
+	if(c->V[in->y] > (0xFF - c->V[in->x]))
+		c->V[0xF] = 1; // Carry
+	else
+		c->V[0xF] = 0;
+
+	c->V[in->x] += c->V[in->y];
+	c->pc += 2;
+}
+
+// 8XY5 Math - Vx -= Vy: Vy is subtracted from Vx. VF is set to 0 when there's a borrow and 1 when there isn't.
+void instr8XY5(Chip8 *c, const Instruction *in) {
+	// Vx = V[in->x];
+	// Vy = V[in->y];
+	if(c->V[in->x] > c->V[in->y])
+		c->V[0xF] = 1;
+	else
+		c->V[0xF] = 0;
+
+    c->V[in->x] = c->V[in->x] - c->V[in->y];
+	c->pc += 2;
+}
+
+// 8XY6 BitOp - Vx = Vy >> 1: Shifts Vy right by one and stores the result to Vx. Set register VF to the least significant bit prior to the shift
+void instr8XY6(Chip8 *c, const Instruction *in) {
+	c->V[in->x] = c->V[in->y] >> 1;
+
+	c->V[0xF] = c->V[in->y] & 1;
+	c->pc += 2;
+}
+
+// 8XY7 Math - Vx = Vy - Vx: Sets Vx to Vy minus Vx. VF is set to 0 when there's a borrow and 1 when there isn't.
+void instr8XY7(Chip8 *c, const Instruction *in) {
+	if(c->V[in->y] > c->V[in->x])
+		c->V[0xF] = 1;
+	else
+		c->V[0xF] = 0;
+
+	c->V[in->x] = c->V[in->y] - c->V[in->x];
+
+	c->pc += 2;
+}
+
+// 8XYE BitOp - Vx = Vy << 1: Store the value of register VY shifted left one bit in register VX. Set register VF to the most significant bit prior to the shift
+void instr8XYE(Chip8 *c, const Instruction *in) {
+	c->V[in->x] = c->V[in->y] << 1;
+
+	c->V[0xF] = c->V[in->y] >> 7 & 1;
+	c->pc += 2;
+}
+
+// 9XY0 Cond - if(Vx != Vy): Skips the next instruction if Vx doesn't equal Vy.
+void instr9XY0(Chip8 *c, const Instruction *in) {
+	if(c->V[in->x] != c->V[in->y])
+		c->pc += 4;
+	else
+		c->pc += 2;
+}
+
+// ANNN MEM - I = NNN: Sets I to the address NNN.
+void instrANNN(Chip8 *c, const Instruction *in) {
+	c->I = in->nnn;
+	c->pc += 2;
+}
+
+// BNNN Flow - PC = V0 + NNN: Jumps to the address NNN plus V0.
+void instrBNNN(Chip8 *c, const Instruction *in) {
+	c->pc = c->V[0] + in->nnn;
+}
+
+// CXNN Rand - Vx = rand() & NN: Sets Vx to the result of a bitwise AND operation on a random number and NN.
+// The random number is the top byte of the machine's xorshift64* generator, see setSeed().
+void instrCXNN(Chip8 *c, const Instruction *in) {
+	unsigned long long x = c->rng;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	c->rng = x;
+	c->V[in->x] = (unsigned char) ((x * 0x2545F4914F6CDD1Dull) >> 56) & in->nn;
+	c->pc += 2;
+}
+
+// Disp - draw(Vx, Vy, N): Draws a sprite at coordinate (VX, VY) that has a width of 8 pixels and a height of N pixels.
+// The sprite starts at (VX mod 64, VY mod 32) and is clipped at the screen edges. VF is set when a lit pixel is erased.
+void instrDXYN(Chip8 *c, const Instruction *in) {
+	unsigned short x = c->V[in->x] % NUM_OF_PIXEL_COLS;
+	unsigned short y = c->V[in->y] % NUM_OF_PIXEL_ROWS;
+	unsigned short height = in->n;
+	unsigned long long collision = 0;
+
+	if(height > NUM_OF_PIXEL_ROWS - y)
+		height = NUM_OF_PIXEL_ROWS - y;
+
+	for(int yline = 0; yline < height; yline++) {
+		unsigned long long sprite = (unsigned long long) c->memory[(c->I + yline) % MEMORY_SIZE] << (NUM_OF_PIXEL_COLS - 8) >> x;
+
+		collision |= c->gfx[y + yline] & sprite;
+		c->gfx[y + yline] ^= sprite;
+	}
+
+	c->V[0xF] = collision != 0;
+	unsigned int rows = (unsigned int) (((1ULL << height) - 1) << y);
+	c->dirtyRows |= rows;
+	c->staleRows |= rows;
+	c->drawFlag = 1;
+	c->pc += 2;
+}
+
+// EX9E KeyOp - if(key() == Vx): Skips the next instruction if the key stored in Vx is pressed.
+void instrEX9E(Chip8 *c, const Instruction *in) {
+	if(c->key[c->V[in->x]] == 1)
+		c->pc += 4;
+	else
+		c->pc += 2;
+}
+
+// EXA1 KeyOp - if(key() != Vx): Skips the next instruction if the key stored in Vx is not pressed.
+void instrEXA1(Chip8 *c, const Instruction *in) {
+	if(c->key[c->V[in->x]] == 0)
+		c->pc += 4;
+	else
+		c->pc += 2;
+}
+
+// FX07 Timer - Vx = get_delay(): Sets Vx to the value of the delay timer.
+void instrFX07(Chip8 *c, const Instruction *in) {
+	syncTimers(c);
+	c->V[in->x] = c->delayTimer;
+	c->pc += 2;
+}
+
+// FX0A KeyOp - Vx = get_key(): A key press is awaited, and then stored in VX.
+void instrFX0A(Chip8 *c, const Instruction *in) {
+    char pressed = 0;
+
+    for(int i = 0; i < KEYPAD_SIZE; i++) {
+        if(c->key[i]) {
+            c->V[in->x] = i;
+            pressed = 1;
+        }
+    }
+    if(!pressed) {
+        c->keyWait = 1;     // Parked until setKey() reports a press
+        return;
+    }
+
+	c->keyWait = 0;
+	c->pc += 2;
+}
+
+// FX15 Timer - delay_timer(Vx): Sets the delay timer to Vx.
+void instrFX15(Chip8 *c, const Instruction *in) {
+	syncTimers(c);
+	c->delayTimer = c->V[in->x];
+
+	c->pc += 2;
+}
+
+// FX18 Sound - sound_timer(Vx): Sets the sound timer to Vx.
+void instrFX18(Chip8 *c, const Instruction *in) {
+	syncTimers(c);
+	c->soundTimer = c->V[in->x];
+
+	c->pc += 2;
+}
+
+// FX1E MEM - I += Vx: Adds Vx to I.
+void instrFX1E(Chip8 *c, const Instruction *in) {
+	c->I += c->V[in->x];
+	c->pc += 2;
+}
+
+// FX29 MEM - I = sprite_addr[Vx]: Sets I to the location of the sprite for the character in Vx.
+void instrFX29(Chip8 *c, const Instruction *in) {
+    c->I = c->V[in->x] * 0x5 + MEMORY_FONTSET;
+    c->pc += 2;
+}
+
+// Records the pages of memory a store wrote, see branchMachine()
+static void markPages(Chip8 *c, unsigned int address, int length) {
+	unsigned int last = address + length - 1;
+	if(address >= MEMORY_SIZE)
+		return;
+	if(last >= MEMORY_SIZE)
+		last = MEMORY_SIZE - 1;
+	c->dirtyPages |= (2u << last / MEMORY_PAGE_SIZE) - (1u << address / MEMORY_PAGE_SIZE);
+}
+
+// Writes a byte of memory, keeping memoryHash
+static void storeByte(Chip8 *c, unsigned int address, unsigned char value) {
+	c->memoryHash ^= hashByte(address, c->memory[address]) ^ hashByte(address, value);
+	c->memory[address] = value;
+}
+
+// Stores length bytes from I on and drops the blocks decoded from them. I may point anywhere in
+// its 16 bits (FX1E does not wrap it), addresses wrap around the end of memory.
+static void storeAtI(Chip8 *c, const unsigned char *values, int length) {
+	unsigned int start = c->I % MEMORY_SIZE;
+	int first = length < MEMORY_SIZE - (int) start ? length : MEMORY_SIZE - (int) start;
+
+	for(int i = 0; i < length; i++)
+		storeByte(c, (start + i) % MEMORY_SIZE, values[i]);
+	invalidateBlocks(c, start, first);
+	markPages(c, start, first);
+	if(first < length) {
+		invalidateBlocks(c, 0, length - first);
+		markPages(c, 0, length - first);
+	}
+}
+
+// FX33 BCD: Store binary-coded decimal representation of VX at the addresses I, I + 1 and I + 2
+void instrFX33(Chip8 *c, const Instruction *in) {
+	unsigned char digits[3] = { c->V[in->x] / 100, (c->V[in->x] / 10) % 10, (c->V[in->x] % 100) % 10 };
+
+	storeAtI(c, digits, 3);
+	c->pc += 2;
+}
+
+// FX55 MEM - reg_dump(Vx, &I): Stores V0 to Vx (including Vx) in memory starting at address I.
+void instrFX55(Chip8 *c, const Instruction *in) {
+	storeAtI(c, c->V, in->x + 1);
+
+	c->I += in->x + 1;
+	c->pc += 2;
+}
+
+// FX65 MEM - reg_load(Vx, &I): Fills V0 to Vx (including Vx) with values from memory starting at address I.
+void instrFX65(Chip8 *c, const Instruction *in) {
+	for(int i = 0; i <= in->x; i++) {
+		c->V[i] = c->memory[(c->I + i) % MEMORY_SIZE];
+	}
+
+	c->I += in->x + 1;
+	c->pc += 2;
+}
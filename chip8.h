@@ -1,70 +1,194 @@
-/* file chip8.h */
-
-#ifndef CHIP8_H
-#define CHIP8_H
-
-// CPU Specs
-#define MEMORY_SIZE 4096
-#define NUM_OF_REGISTERS 16
-#define NUM_OF_PIXEL_COLS 64
-#define NUM_OF_PIXEL_ROWS 32
-#define NUM_OF_PIXELS (NUM_OF_PIXEL_COLS * NUM_OF_PIXEL_ROWS)
-#define STACK_SIZE 16
-#define KEYPAD_SIZE 16
-#define FONTSET_SIZE 80
-
-// Memory map
-#define MEMORY_START 0
-#define MEMORY_FONTSET 0x050
-#define MEMORY_PROGRAM 0x200
-
-// SDL DELAY
-#define DELAY_MS 16
-
-void initialize();
-int loadGame(char *file);
-void emulateCycle();
-unsigned char * getDrawFlag();
-unsigned char * getGfx();
-void setKey(unsigned char k, unsigned char s);
-void delay(int milliSecs);
-void terminate();
-
-// CPU instructions
-void instr0NNN();
-void instr00E0();
-void instr00EE();
-void instr1NNN();
-void instr2NNN();
-void instr3XNN();
-void instr4XNN();
-void instr5XY0();
-void instr6XNN();
-void instr7XNN();
-void instr8XY0();
-void instr8XY1();
-void instr8XY2();
-void instr8XY3();
-void instr8XY4();
-void instr8XY5();
-void instr8XY6();
-void instr8XY7();
-void instr8XYE();
-void instr9XY0();
-void instrANNN();
-void instrBNNN();
-void instrCXNN();
-void instrDXYN();
-void instrEX9E();
-void instrEXA1();
-void instrFX07();
-void instrFX0A();
-void instrFX15();
-void instrFX18();
-void instrFX1E();
-void instrFX29();
-void instrFX33();
-void instrFX55();
-void instrFX65();
-
-#endif /* CHIP8_H */
+/* file chip8.h */
+
+#ifndef CHIP8_H
+#define CHIP8_H
+
+// CPU Specs
+#define MEMORY_SIZE 4096
+#define NUM_OF_REGISTERS 16
+#define NUM_OF_PIXEL_COLS 64
+#define NUM_OF_PIXEL_ROWS 32
+#define NUM_OF_PIXELS (NUM_OF_PIXEL_COLS * NUM_OF_PIXEL_ROWS)
+#define STACK_SIZE 16
+#define KEYPAD_SIZE 16
+#define FONTSET_SIZE 80
+
+// Memory map
+#define MEMORY_START 0
+#define MEMORY_FONTSET 0x050
+#define MEMORY_PROGRAM 0x200
+
+// Memory pages, the unit branches of a machine share (see state.h)
+#define MEMORY_PAGE_SIZE 256
+#define NUM_OF_PAGES (MEMORY_SIZE / MEMORY_PAGE_SIZE)
+#define ALL_PAGES ((1u << NUM_OF_PAGES) - 1)
+
+// SDL DELAY
+#define DELAY_MS 16
+
+// Timing
+#define TIMER_HZ 60				// Delay and sound timer rate
+#define DEFAULT_CLOCK_HZ 600	// Instructions per second
+#define CLOCK_UNLIMITED 0		// As fast as possible, timers follow the wall clock
+#define LAZY_COUNTDOWN 0xFFFFFFFFu	// Instructions counted between syncs of lazy timers
+
+// CXNN random numbers
+#define DEFAULT_SEED 1			// Seed of a freshly initialized machine, see setSeed()
+
+// Execution engines
+#define ENGINE_INTERPRETER 0	// Reference: decode and execute one instruction per step
+#define ENGINE_BLOCK_CACHE 1	// Replay pre-decoded basic blocks
+#define ENGINE_JIT 2			// Translate hot basic blocks to x86-64, replay the rest
+
+// Reasons emulateFrame() returns
+#define FRAME_DONE 0	// Instruction budget used up
+#define FRAME_DRAW 1	// An instruction drew, drawFlag is set
+#define FRAME_HALT 2	// Stuck on an unknown opcode
+#define FRAME_IDLE 3	// Idling until a timer tick or key press, the rest of the budget was skipped
+#define FRAME_KEY 4		// FX0A waiting for a key press, the rest of the budget was skipped
+
+// Decoded instruction: handler plus the operands pre-extracted from its opcode
+typedef struct Chip8 Chip8;
+typedef struct Instruction Instruction;
+typedef void (*InstructionHandler)(Chip8 *c, const Instruction *in);
+
+struct Instruction {
+	InstructionHandler execute;
+	unsigned short opcode;
+	unsigned short nnn;	// Address
+	unsigned char nn;	// 8-bit constant
+	unsigned char n;	// 4-bit constant
+	unsigned char x;	// Register index Vx
+	unsigned char y;	// Register index Vy
+};
+
+struct BlockCache;
+struct MemoryImage;
+struct Profile;
+struct Trace;
+
+// One Chip8 machine. The registers used by almost every instruction share the first cache line,
+// the 4K memory and framebuffer follow. Everything before pixels is machine state, copied as one
+// block by takeSnapshot() (see state.h); what follows belongs to the host.
+struct Chip8 {
+	// Hot
+	_Alignas(64) unsigned short pc;		// Program counter
+	unsigned short I;					// Index register
+	unsigned short sp;					// Stack pointer
+	unsigned short opcode;				// Current opcode
+	unsigned char V[NUM_OF_REGISTERS];	// V0, V1, ..., VF
+	unsigned char delayTimer;			// 60Hz timers
+	unsigned char soundTimer;
+	unsigned char drawFlag;
+	unsigned short stack[STACK_SIZE];
+	unsigned int tickCountdown;			// Instructions until the next timer tick, or until the next sync of lazy timers
+
+	// Cold
+	_Alignas(64) unsigned char key[KEYPAD_SIZE];	// HEX keypad
+	unsigned char memory[MEMORY_SIZE];
+	unsigned long long gfx[NUM_OF_PIXEL_ROWS];	// One row per word, column 0 in the most significant bit
+	unsigned long long cycleCount;		// Instructions run by emulate() and emulateFrame(), skipped ones included
+	unsigned long long rng;				// CXNN generator state, never 0
+	unsigned long long memoryHash;		// Memory part of getStateHash(), kept by the stores
+	unsigned int cyclesPerTick;			// Instructions per timer tick, 0 when the wall clock ticks the timers
+	unsigned int tickPhase;				// Lazy timers: instructions until the next tick as of the last sync
+	unsigned char lazyTimers;			// Timers computed on demand, see syncTimers()
+	unsigned char keyWait;				// FX0A found no key down, cleared by a press
+
+	// Host
+	unsigned char pixels[NUM_OF_PIXELS];		// One byte per pixel, expanded by getGfx()
+	unsigned int dirtyRows;						// Rows changed since takeDirtyRows(), bit n for row n
+	unsigned int staleRows;						// Rows changed since getStateHash(), bit n for row n
+	unsigned long long gfxHash;					// Framebuffer part of getStateHash(), as of its last call
+	unsigned long long rowHashes[NUM_OF_PIXEL_ROWS];
+	const struct MemoryImage *image;	// Memory as shared by shareMemory(), NULL if never shared
+	unsigned int dirtyPages;			// Pages of memory that may differ from image, bit p for page p
+	const Instruction *instruction;		// Current decoded instruction
+
+	// Execution engine
+	int engine;
+	unsigned long long elided;			// Instructions of idle loops skipped by emulateFrame()
+	struct BlockCache *blockCache;		// Allocated by the block and JIT engines on first use
+	struct Profile *profile;			// Execution counts, allocated in PROFILE builds (see profile.h)
+	struct Trace *trace;				// Ring buffer of executed instructions while tracing (see trace.h)
+};
+
+// Instances come from createChip8() or zero-initialized storage passed to initialize()
+void initTables();
+Chip8 * createChip8();
+void destroyChip8(Chip8 *c);
+void initialize(Chip8 *c);
+int loadGame(Chip8 *c, char *file);
+int loadRom(Chip8 *c, const unsigned char *rom, int size);
+void emulateCycle(Chip8 *c);
+void updateTimers(Chip8 *c);
+void tickTimers(Chip8 *c, int n);
+void decrementTimers(Chip8 *c, int ticks);
+void setClock(Chip8 *c, unsigned int hz);
+void syncTimers(Chip8 *c);
+void setLazyTimers(Chip8 *c, int lazy);
+unsigned char getDelayTimer(Chip8 *c);
+unsigned char getSoundTimer(Chip8 *c);
+void setEngine(Chip8 *c, int e);
+int getEngine(Chip8 *c);
+int emulate(Chip8 *c);
+int emulateFrame(Chip8 *c, int cycles, int *executed);
+int runUntil(Chip8 *c, unsigned long long until);
+unsigned char * getDrawFlag(Chip8 *c);
+unsigned char * getGfx(Chip8 *c);
+unsigned long long * getGfxRows(Chip8 *c);
+void expandGfx(const unsigned long long *rows, unsigned char *pixels, unsigned int mask);
+unsigned int takeDirtyRows(Chip8 *c);
+unsigned long long getGfxHash(Chip8 *c);
+unsigned long long getStateHash(Chip8 *c);
+unsigned long long computeStateHash(Chip8 *c);
+void rehashMemory(Chip8 *c);
+void setKey(Chip8 *c, unsigned char k, unsigned char s);
+void setSeed(Chip8 *c, unsigned long long seed);
+int isWaitingForKey(Chip8 *c);
+void delay(int milliSecs);
+void terminate();
+
+// Decoding
+InstructionHandler decodeOpcode(unsigned short opcode);
+const Instruction * decode(unsigned short opcode);
+
+// CPU instructions
+void instrUnknown(Chip8 *c, const Instruction *in);
+void instr0NNN(Chip8 *c, const Instruction *in);
+void instr00E0(Chip8 *c, const Instruction *in);
+void instr00EE(Chip8 *c, const Instruction *in);
+void instr1NNN(Chip8 *c, const Instruction *in);
+void instr2NNN(Chip8 *c, const Instruction *in);
+void instr3XNN(Chip8 *c, const Instruction *in);
+void instr4XNN(Chip8 *c, const Instruction *in);
+void instr5XY0(Chip8 *c, const Instruction *in);
+void instr6XNN(Chip8 *c, const Instruction *in);
+void instr7XNN(Chip8 *c, const Instruction *in);
+void instr8XY0(Chip8 *c, const Instruction *in);
+void instr8XY1(Chip8 *c, const Instruction *in);
+void instr8XY2(Chip8 *c, const Instruction *in);
+void instr8XY3(Chip8 *c, const Instruction *in);
+void instr8XY4(Chip8 *c, const Instruction *in);
+void instr8XY5(Chip8 *c, const Instruction *in);
+void instr8XY6(Chip8 *c, const Instruction *in);
+void instr8XY7(Chip8 *c, const Instruction *in);
+void instr8XYE(Chip8 *c, const Instruction *in);
+void instr9XY0(Chip8 *c, const Instruction *in);
+void instrANNN(Chip8 *c, const Instruction *in);
+void instrBNNN(Chip8 *c, const Instruction *in);
+void instrCXNN(Chip8 *c, const Instruction *in);
+void instrDXYN(Chip8 *c, const Instruction *in);
+void instrEX9E(Chip8 *c, const Instruction *in);
+void instrEXA1(Chip8 *c, const Instruction *in);
+void instrFX07(Chip8 *c, const Instruction *in);
+void instrFX0A(Chip8 *c, const Instruction *in);
+void instrFX15(Chip8 *c, const Instruction *in);
+void instrFX18(Chip8 *c, const Instruction *in);
+void instrFX1E(Chip8 *c, const Instruction *in);
+void instrFX29(Chip8 *c, const Instruction *in);
+void instrFX33(Chip8 *c, const Instruction *in);
+void instrFX55(Chip8 *c, const Instruction *in);
+void instrFX65(Chip8 *c, const Instruction *in);
+
+#endif /* CHIP8_H */
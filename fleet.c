@@ -0,0 +1,361 @@
+/* file fleet.c */
+
+/*
+ * Headless batch runner: executes every job of a manifest on a pool of
+ * worker threads and prints one result line per job. Does not use SDL.
+ *
+ * Manifest lines: <chip8 game file> <cycles> [input script]
+ * Input script lines: <cycle> <key 0-F> <state 0|1>
+ * Blank lines and lines starting with # are skipped in both.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <unistd.h>
+#endif
+
+#include "chip8.h"
+#include "hrtime.h"
+
+#define MAX_PATH_LENGTH 1024
+#define MAX_WORKERS 256
+
+typedef struct InputEvent {
+	unsigned long long cycle;
+	unsigned char key;
+	unsigned char state;
+} InputEvent;
+
+typedef struct Job {
+	char rom[MAX_PATH_LENGTH];
+	char input[MAX_PATH_LENGTH];	// Empty when the job has no input script
+	unsigned long long cycles;
+
+	// Result
+	int failed;
+	unsigned long long executed;
+	unsigned long long elided;		// Instructions of idle loops skipped
+	unsigned long long gfxHash;
+	double wallMs;
+} Job;
+
+// Job indices owned by one worker. The owner pops from the bottom, thieves take from the top.
+typedef struct Deque {
+	pthread_mutex_t lock;
+	int *jobs;
+	int top;
+	int bottom;
+} Deque;
+
+typedef struct Worker {
+	pthread_t thread;
+	int id;
+	int engine;
+} Worker;
+
+static Job *jobs = NULL;
+static int numOfJobs = 0;
+static Deque deques[MAX_WORKERS];
+static int numOfWorkers = 0;
+
+static int numOfCores() {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (int) n : 1;
+#endif
+}
+
+static int readManifest(char *file) {
+	FILE *fptr = fopen(file, "r");
+	if(!fptr) {
+		fprintf(stderr, "Error: Unable to open manifest file\n");
+		return -1;
+	}
+
+	char line[3 * MAX_PATH_LENGTH];
+	int capacity = 0;
+	while(fgets(line, sizeof(line), fptr)) {
+		char rom[MAX_PATH_LENGTH];
+		char input[MAX_PATH_LENGTH] = "";
+		unsigned long long cycles;
+
+		if(line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+			continue;
+		if(sscanf(line, "%1023s %llu %1023s", rom, &cycles, input) < 2) {
+			fprintf(stderr, "Error: Malformed manifest line: %s", line);
+			fclose(fptr);
+			return -1;
+		}
+
+		if(numOfJobs == capacity) {
+			capacity = capacity ? 2 * capacity : 64;
+			Job *grown = (Job*) realloc(jobs, sizeof(Job) * capacity);
+			if(grown == NULL) {
+				fprintf(stderr, "Error: Unable to allocate job memory\n");
+				fclose(fptr);
+				return -1;
+			}
+			jobs = grown;
+		}
+
+		Job *job = &jobs[numOfJobs++];
+		memset(job, 0, sizeof(Job));
+		strcpy(job->rom, rom);
+		strcpy(job->input, input);
+		job->cycles = cycles;
+	}
+
+	fclose(fptr);
+	return 0;
+}
+
+// Reads an input script into a cycle-ordered event array. Returns the number of events or -1.
+static int readInput(char *file, InputEvent **events) {
+	FILE *fptr = fopen(file, "r");
+	if(!fptr) {
+		fprintf(stderr, "Error: Unable to open input script %s\n", file);
+		return -1;
+	}
+
+	char line[256];
+	int count = 0;
+	int capacity = 0;
+	*events = NULL;
+	while(fgets(line, sizeof(line), fptr)) {
+		unsigned long long cycle;
+		unsigned int key, state;
+
+		if(line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+			continue;
+		if(sscanf(line, "%llu %x %u", &cycle, &key, &state) != 3 || key >= KEYPAD_SIZE || state > 1
+				|| (count > 0 && cycle < (*events)[count - 1].cycle)) {
+			fprintf(stderr, "Error: Malformed input script line in %s: %s", file, line);
+			fclose(fptr);
+			free(*events);
+			return -1;
+		}
+
+		if(count == capacity) {
+			capacity = capacity ? 2 * capacity : 64;
+			InputEvent *grown = (InputEvent*) realloc(*events, sizeof(InputEvent) * capacity);
+			if(grown == NULL) {
+				fclose(fptr);
+				free(*events);
+				return -1;
+			}
+			*events = grown;
+		}
+
+		(*events)[count].cycle = cycle;
+		(*events)[count].key = key;
+		(*events)[count].state = state;
+		count++;
+	}
+
+	fclose(fptr);
+	return count;
+}
+
+static void runJob(Chip8 *c, Job *job, int engine) {
+	InputEvent *events = NULL;
+	int numOfEvents = 0;
+
+	unsigned long long start = nanoTime();
+
+	if(job->input[0] != '\0' && (numOfEvents = readInput(job->input, &events)) == -1) {
+		job->failed = 1;
+		return;
+	}
+
+	initialize(c);
+	setEngine(c, engine);
+	if(loadGame(c, job->rom) == -1) {
+		job->failed = 1;
+		free(events);
+		return;
+	}
+
+	int next = 0;
+	while(c->cycleCount < job->cycles) {		// initialize() starts the count at 0
+		while(next < numOfEvents && events[next].cycle <= c->cycleCount) {
+			setKey(c, events[next].key, events[next].state);
+			next++;
+		}
+
+		// Run up to the next key change, idle loops are skipped
+		unsigned long long until = job->cycles;
+		if(next < numOfEvents && events[next].cycle < until)
+			until = events[next].cycle;
+
+		if(runUntil(c, until) == FRAME_HALT) {
+			fprintf(stderr, "Error: %s stuck on an unknown opcode at 0x%03X\n", job->rom, c->pc);
+			job->failed = 1;
+			break;
+		}
+	}
+
+	job->executed = c->cycleCount;
+	job->elided = c->elided;
+	job->gfxHash = getGfxHash(c);
+	job->wallMs = (nanoTime() - start) / 1e6;
+
+	free(events);
+}
+
+static int popJob(Deque *d) {
+	int job = -1;
+
+	pthread_mutex_lock(&d->lock);
+	if(d->bottom > d->top)
+		job = d->jobs[--d->bottom];
+	pthread_mutex_unlock(&d->lock);
+
+	return job;
+}
+
+static int stealJob(Deque *d) {
+	int job = -1;
+
+	pthread_mutex_lock(&d->lock);
+	if(d->bottom > d->top)
+		job = d->jobs[d->top++];
+	pthread_mutex_unlock(&d->lock);
+
+	return job;
+}
+
+static void * workerMain(void *arg) {
+	Worker *w = (Worker*) arg;
+	Chip8 *c = createChip8();
+	if(c == NULL) {	// The other workers steal this worker's jobs, main() fails those left over
+		fprintf(stderr, "Error: Worker %d has no machine to run jobs on\n", w->id);
+		return NULL;
+	}
+
+	for(;;) {
+		int job = popJob(&deques[w->id]);
+
+		// Own deque is empty: steal from the others, starting with the next worker
+		for(int i = 1; job == -1 && i < numOfWorkers; i++)
+			job = stealJob(&deques[(w->id + i) % numOfWorkers]);
+
+		if(job == -1)
+			break;	// No job is ever added after start, so every deque is drained
+
+		runJob(c, &jobs[job], w->engine);
+	}
+
+	destroyChip8(c);
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	int threads = numOfCores();
+	int engine = ENGINE_INTERPRETER;
+	char *manifest = NULL;
+
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+		} else if(strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+			i++;
+			if(strcmp(argv[i], "block") == 0) {
+				engine = ENGINE_BLOCK_CACHE;
+			} else if(strcmp(argv[i], "jit") == 0) {
+				engine = ENGINE_JIT;
+			} else if(strcmp(argv[i], "interpreter") != 0) {
+				fprintf(stderr, "Error: Unknown engine %s\n", argv[i]);
+				exit(EXIT_FAILURE);
+			}
+		} else if(manifest == NULL) {
+			manifest = argv[i];
+		} else {
+			manifest = NULL;
+			break;
+		}
+	}
+
+	if(manifest == NULL || threads < 1) {
+		printf("Usage: fleet.exe [-j threads] [-e interpreter|block|jit] <manifest file>\n\n");
+		exit(EXIT_FAILURE);
+	}
+	if(threads > MAX_WORKERS)
+		threads = MAX_WORKERS;
+
+	if(readManifest(manifest) == -1)
+		exit(EXIT_FAILURE);
+	if(threads > numOfJobs)
+		threads = numOfJobs > 0 ? numOfJobs : 1;
+	numOfWorkers = threads;
+
+	// Deal the jobs out round-robin
+	for(int i = 0; i < numOfWorkers; i++) {
+		pthread_mutex_init(&deques[i].lock, NULL);
+		deques[i].jobs = (int*) malloc(sizeof(int) * (numOfJobs / numOfWorkers + 1));
+		deques[i].top = 0;
+		deques[i].bottom = 0;
+		if(deques[i].jobs == NULL) {
+			fprintf(stderr, "Error: Unable to allocate job queue memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for(int i = 0; i < numOfJobs; i++) {
+		Deque *d = &deques[i % numOfWorkers];
+		d->jobs[d->bottom++] = i;
+	}
+
+	initTables();	// Before any worker creates a machine
+
+	unsigned long long start = nanoTime();
+
+	Worker workers[MAX_WORKERS];
+	for(int i = 0; i < numOfWorkers; i++) {
+		workers[i].id = i;
+		workers[i].engine = engine;
+		if(pthread_create(&workers[i].thread, NULL, &workerMain, &workers[i]) != 0) {
+			fprintf(stderr, "Error: Unable to start worker thread\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for(int i = 0; i < numOfWorkers; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	// Jobs still queued were left by workers that could not allocate a machine, with none to steal them
+	for(int i = 0; i < numOfWorkers; i++)
+		for(int j = deques[i].top; j < deques[i].bottom; j++)
+			jobs[deques[i].jobs[j]].failed = 1;
+
+	double totalMs = (nanoTime() - start) / 1e6;
+
+	// Results, in manifest order
+	int failures = 0;
+	printf("job\trom\tcycles\tgfx_hash\twall_ms\telided\n");
+	for(int i = 0; i < numOfJobs; i++) {
+		Job *job = &jobs[i];
+		if(job->failed) {
+			printf("%d\t%s\tFAILED\t-\t-\t-\n", i, job->rom);
+			failures++;
+		} else {
+			printf("%d\t%s\t%llu\t%016llx\t%.3f\t%llu\n", i, job->rom, job->executed, job->gfxHash, job->wallMs, job->elided);
+		}
+	}
+	fprintf(stderr, "%d jobs on %d threads in %.3f ms, %d failed\n", numOfJobs, numOfWorkers, totalMs, failures);
+
+	for(int i = 0; i < numOfWorkers; i++) {
+		pthread_mutex_destroy(&deques[i].lock);
+		free(deques[i].jobs);
+	}
+	free(jobs);
+
+	exit(failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
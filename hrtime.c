@@ -0,0 +1,42 @@
+/* file hrtime.c */
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <time.h>
+#endif
+
+#include "hrtime.h"
+
+unsigned long long nanoTime() {
+#ifdef _WIN32
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+
+	if(frequency.QuadPart == 0)
+		QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+
+	return (unsigned long long) (counter.QuadPart / frequency.QuadPart) * 1000000000ULL
+		+ (unsigned long long) (counter.QuadPart % frequency.QuadPart) * 1000000000ULL / frequency.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+void sleepNanos(unsigned long long ns) {
+#ifdef _WIN32
+	Sleep((DWORD) ((ns + 999999) / 1000000));
+#else
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	while(nanosleep(&ts, &ts) == -1)
+		;	// Interrupted, sleep the remainder
+#endif
+}
@@ -0,0 +1,12 @@
+/* file hrtime.h */
+
+#ifndef HRTIME_H
+#define HRTIME_H
+
+// Monotonic clock in nanoseconds, for pacing and benchmarks
+unsigned long long nanoTime();
+
+// Sleeps for at least ns nanoseconds
+void sleepNanos(unsigned long long ns);
+
+#endif /* HRTIME_H */
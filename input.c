@@ -0,0 +1,211 @@
+/* file input.c */
+
+/*
+ * Input logs. A run is decided by the program, the clock, the CXNN
+ * generator and the keys, so a log of the key transitions stamped with
+ * the machine's cycleCount, plus the generator state and keypad it began
+ * with, replays the run bit for bit at any speed and with any engine.
+ * Each event takes two bytes for most runs: the instructions since the
+ * previous event as a varint, then the key and its new state.
+ *
+ * A log replays on the machine it was recorded from, the same ROM freshly
+ * loaded or the same save state.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "input.h"
+
+// Starts a log of the keys set on c from now on
+InputLog * createInputLog(Chip8 *c) {
+	InputLog *log = (InputLog*) calloc(1, sizeof(InputLog));
+	if(log == NULL) {
+		fprintf(stderr, "Error: Unable to allocate input log\n");
+		return NULL;
+	}
+
+	log->cyclesPerTick = c->cyclesPerTick;
+	log->start = log->last = c->cycleCount;
+	log->rng = c->rng;
+	for(int k = 0; k < KEYPAD_SIZE; k++)
+		log->keys |= (c->key[k] != 0) << k;
+
+	return log;
+}
+
+void destroyInputLog(InputLog *log) {
+	if(log == NULL)
+		return;
+
+	free(log->events);
+	free(log);
+}
+
+// Sets a key as setKey() does and logs it if it changed
+void recordKey(InputLog *log, Chip8 *c, unsigned char k, unsigned char s) {
+	if(k < KEYPAD_SIZE && (s == 0 || s == 1) && c->key[k] != s) {
+		if(log->size + 11 > log->capacity) {	// Room for the longest event
+			size_t capacity = log->capacity ? 2 * log->capacity : 4096;
+			unsigned char *events = (unsigned char*) realloc(log->events, capacity);
+			if(events == NULL) {
+				fprintf(stderr, "Error: Unable to grow input log, key not recorded\n");
+				setKey(c, k, s);
+				return;
+			}
+			log->events = events;
+			log->capacity = capacity;
+		}
+
+		unsigned char *p = log->events + log->size;
+		unsigned long long delta = c->cycleCount - log->last;
+		for(; delta >= 0x80; delta >>= 7)
+			*p++ = (unsigned char) (delta | 0x80);
+		*p++ = (unsigned char) delta;
+		*p++ = (unsigned char) (k | s << 4);
+		log->size = p - log->events;
+		log->last = c->cycleCount;
+	}
+
+	setKey(c, k, s);
+}
+
+// Decodes the event at *pos, following one at cycle last. Returns 0 at the end of the log.
+static int readEvent(InputLog *log, size_t *pos, unsigned long long last, unsigned long long *cycle, unsigned char *event) {
+	unsigned long long delta = 0;
+
+	for(int shift = 0; *pos < log->size && shift < 64; shift += 7) {
+		unsigned char byte = log->events[(*pos)++];
+		delta |= (unsigned long long) (byte & 0x7F) << shift;
+		if(byte < 0x80) {
+			if(*pos == log->size)
+				return 0;
+			*event = log->events[(*pos)++];
+			*cycle = last + delta;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Puts the machine back where recording started: the recorded clock (if it differs), generator state,
+// cycle count and keypad. Replaying begins at the first event.
+void startReplay(InputLog *log, Chip8 *c) {
+	if(c->cyclesPerTick != log->cyclesPerTick)
+		setClock(c, log->cyclesPerTick * TIMER_HZ);
+	c->cycleCount = log->start;
+	c->rng = log->rng;
+	for(int k = 0; k < KEYPAD_SIZE; k++)
+		setKey(c, k, log->keys >> k & 1);
+
+	log->last = log->start;
+	log->next = 0;
+}
+
+// Runs the machine up to cycle until, setting each logged key on the cycle it was set while recording.
+// Returns FRAME_HALT if the machine got stuck on an unknown opcode before, FRAME_DONE otherwise.
+int replayInput(InputLog *log, Chip8 *c, unsigned long long until) {
+	for(;;) {
+		size_t pos = log->next;
+		unsigned long long cycle;
+		unsigned char event;
+		int due = readEvent(log, &pos, log->last, &cycle, &event) && cycle <= until;
+
+		if(runUntil(c, due ? cycle : until) == FRAME_HALT)
+			return FRAME_HALT;
+		if(!due)
+			return FRAME_DONE;
+
+		setKey(c, event & 0xF, event >> 4 & 1);
+		log->next = pos;
+		log->last = cycle;
+	}
+}
+
+static unsigned char * put(unsigned char *p, unsigned long long value, int size) {
+	for(int i = 0; i < size; i++)
+		*p++ = (unsigned char) (value >> 8 * i);
+	return p;
+}
+
+static unsigned long long get(const unsigned char *p, int size) {
+	unsigned long long value = 0;
+	for(int i = size - 1; i >= 0; i--)
+		value = value << 8 | p[i];
+	return value;
+}
+
+int saveInputLog(InputLog *log, const char *file) {
+	unsigned char header[INPUT_HEADER_SIZE];
+	unsigned char *p = header;
+
+	memcpy(p, INPUT_MAGIC, 4);
+	p = put(p + 4, INPUT_VERSION, 2);
+	p = put(p, log->cyclesPerTick, 4);
+	p = put(p, log->start, 8);
+	p = put(p, log->rng, 8);
+	p = put(p, log->keys, 2);
+	put(p, log->size, 4);
+
+	FILE *fptr = fopen(file, "wb");
+	if(!fptr) {
+		fprintf(stderr, "Error: Unable to open input log file\n");
+		return -1;
+	}
+
+	int failed = fwrite(header, 1, INPUT_HEADER_SIZE, fptr) != INPUT_HEADER_SIZE
+		|| fwrite(log->events, 1, log->size, fptr) != log->size;
+	if(fclose(fptr) != 0 || failed) {
+		fprintf(stderr, "Error: Unable to write input log file\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+InputLog * loadInputLog(const char *file) {
+	unsigned char header[INPUT_HEADER_SIZE];
+
+	FILE *fptr = fopen(file, "rb");
+	if(!fptr) {
+		fprintf(stderr, "Error: Unable to open input log file\n");
+		return NULL;
+	}
+
+	if(fread(header, 1, INPUT_HEADER_SIZE, fptr) != INPUT_HEADER_SIZE || memcmp(header, INPUT_MAGIC, 4) != 0) {
+		fprintf(stderr, "Error: Not an input log\n");
+		fclose(fptr);
+		return NULL;
+	}
+	if(get(header + 4, 2) != INPUT_VERSION) {
+		fprintf(stderr, "Error: Unsupported input log version\n");
+		fclose(fptr);
+		return NULL;
+	}
+
+	InputLog *log = (InputLog*) calloc(1, sizeof(InputLog));
+	size_t size = (size_t) get(header + 28, 4);
+	if(log == NULL || (log->events = (unsigned char*) malloc(size ? size : 1)) == NULL) {
+		fprintf(stderr, "Error: Unable to allocate input log\n");
+		free(log);
+		fclose(fptr);
+		return NULL;
+	}
+
+	log->cyclesPerTick = (unsigned int) get(header + 6, 4);
+	log->start = log->last = get(header + 10, 8);
+	log->rng = get(header + 18, 8);
+	log->keys = (unsigned int) get(header + 26, 2);
+	log->size = log->capacity = size;
+	int truncated = fread(log->events, 1, size, fptr) != size;
+	fclose(fptr);
+	if(truncated) {
+		fprintf(stderr, "Error: Input log truncated\n");
+		destroyInputLog(log);
+		return NULL;
+	}
+
+	return log;
+}
@@ -0,0 +1,39 @@
+/* file input.h */
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+
+#include "chip8.h"
+
+// Input log layout, all fields little endian:
+//  magic "C8IN", u16 version, u32 cyclesPerTick, u64 first cycle, u64 CXNN generator state,
+//  u16 keypad (bit k for key k), u32 size of the events
+//  events: varint instructions since the previous event (or the first cycle), u8 key | pressed << 4
+#define INPUT_MAGIC "C8IN"
+#define INPUT_VERSION 1
+#define INPUT_HEADER_SIZE 32
+
+// Key presses and releases of one run, stamped with the machine's cycleCount, together with what
+// else decides the run: clock, generator state and keypad when recording started
+typedef struct InputLog {
+	unsigned int cyclesPerTick;
+	unsigned long long start;
+	unsigned long long rng;
+	unsigned int keys;
+	unsigned char *events;
+	size_t size, capacity;
+	unsigned long long last;	// Cycle of the last event recorded, or replayed
+	size_t next;				// Replay position in events
+} InputLog;
+
+InputLog * createInputLog(Chip8 *c);
+void destroyInputLog(InputLog *log);
+void recordKey(InputLog *log, Chip8 *c, unsigned char k, unsigned char s);
+int saveInputLog(InputLog *log, const char *file);
+InputLog * loadInputLog(const char *file);
+void startReplay(InputLog *log, Chip8 *c);
+int replayInput(InputLog *log, Chip8 *c, unsigned long long until);
+
+#endif /* INPUT_H */
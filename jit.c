@@ -0,0 +1,340 @@
+/* file jit.c */
+
+/*
+ * x86-64 translator for hot basic blocks. Straight-line ALU, constant,
+ * index register and skip/jump instructions become native code operating
+ * on the Chip8 instance in place; everything else (draw, keys, timers,
+ * BCD, stores, calls) is a call into the instr* handler with the decoded
+ * Instruction. Within a block pc is a compile-time constant and only
+ * written back before handler calls and on exit.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+	#define JIT_X86_64
+	#ifdef _WIN32
+		#include <windows.h>
+	#else
+		#include <sys/mman.h>
+	#endif
+#endif
+
+#include "jit.h"
+#include "profile.h"
+#include "trace.h"
+
+// Translation buffer of one instance
+typedef struct JitCode {
+	unsigned char *buffer;
+	unsigned char *cursor;	// Where compileBlock() emits the next byte
+	int used;
+	int unavailable;	// Executable memory could not be allocated
+} JitCode;
+
+#ifdef JIT_X86_64
+
+// Largest translation of a single block
+#define JIT_BLOCK_CODE_MAX (BLOCK_MAX_LENGTH * 48 + 64)
+
+// Displacements from the Chip8 pointer held in rbx
+#define OFFSET_PC ((unsigned char) offsetof(Chip8, pc))
+#define OFFSET_I ((unsigned char) offsetof(Chip8, I))
+#define OFFSET_V ((unsigned char) offsetof(Chip8, V))
+
+static void emitByte(JitCode *jit, unsigned char b) {
+	*jit->cursor++ = b;
+}
+
+static void emit(JitCode *jit, int count, ...) {
+	va_list args;
+	va_start(args, count);
+	for(int i = 0; i < count; i++)
+		emitByte(jit, (unsigned char) va_arg(args, int));
+	va_end(args);
+}
+
+static void emitWord(JitCode *jit, unsigned short w) {
+	emitByte(jit, w & 0xFF);
+	emitByte(jit, w >> 8);
+}
+
+static void emitDword(JitCode *jit, unsigned int d) {
+	for(int i = 0; i < 4; i++)
+		emitByte(jit, d >> (8 * i) & 0xFF);
+}
+
+static void emitQuad(JitCode *jit, unsigned long long q) {
+	for(int i = 0; i < 8; i++)
+		emitByte(jit, q >> (8 * i) & 0xFF);
+}
+
+// mov word [rbx + offset], imm16
+static void emitStoreWord(JitCode *jit, unsigned char offset, unsigned short w) {
+	emit(jit, 4, 0x66, 0xC7, 0x43, offset);
+	emitWord(jit, w);
+}
+
+// pc = address
+static void emitStorePc(JitCode *jit, unsigned short address) {
+	emitStoreWord(jit, OFFSET_PC, address);
+}
+
+// Opcode byte op with ModRM reg, [rbx + V + x]
+static void emitVx(JitCode *jit, unsigned char op, unsigned char reg, unsigned char x) {
+	emitByte(jit, op);
+	emitByte(jit, 0x43 | reg << 3);
+	emitByte(jit, OFFSET_V + x);
+}
+
+// call f(c, p): the first argument is the Chip8 pointer in rbx
+static void emitCallPointer(JitCode *jit, const void *f, const void *p) {
+#ifdef _WIN32
+	emit(jit, 3, 0x48, 0x89, 0xD9);	// mov rcx, rbx
+	emit(jit, 2, 0x48, 0xBA);	// mov rdx, imm64
+#else
+	emit(jit, 3, 0x48, 0x89, 0xDF);	// mov rdi, rbx
+	emit(jit, 2, 0x48, 0xBE);	// mov rsi, imm64
+#endif
+	emitQuad(jit, (unsigned long long) (size_t) p);
+	emit(jit, 2, 0x48, 0xB8);	// mov rax, imm64
+	emitQuad(jit, (unsigned long long) (size_t) f);
+	emit(jit, 2, 0xFF, 0xD0);	// call rax
+}
+
+// call f(c, n)
+static void emitCallInt(JitCode *jit, const void *f, int n) {
+#ifdef _WIN32
+	emit(jit, 3, 0x48, 0x89, 0xD9);	// mov rcx, rbx
+	emitByte(jit, 0xBA);	// mov edx, imm32
+#else
+	emit(jit, 3, 0x48, 0x89, 0xDF);	// mov rdi, rbx
+	emitByte(jit, 0xBE);	// mov esi, imm32
+#endif
+	emitDword(jit, n);
+	emit(jit, 2, 0x48, 0xB8);	// mov rax, imm64
+	emitQuad(jit, (unsigned long long) (size_t) f);
+	emit(jit, 2, 0xFF, 0xD0);	// call rax
+}
+
+// pc update for a skip at address once the flags are set.
+// jccNoSkip is the short jump taken when the next instruction is not skipped.
+static void emitSkipTail(JitCode *jit, unsigned char jccNoSkip, unsigned short address) {
+	emitStorePc(jit, address + 2);
+	emit(jit, 2, jccNoSkip, 0x06);	// jcc over the next 6-byte store
+	emitStorePc(jit, address + 4);
+}
+
+static int usesTimers(InstructionHandler h) {
+	return h == &instrFX07 || h == &instrFX15 || h == &instrFX18;
+}
+
+// Emits native code for in at address. Returns 0 if it needs its handler instead.
+static int emitNative(JitCode *jit, const Instruction *in, unsigned short address) {
+	InstructionHandler h = in->execute;
+	unsigned char x = in->x;
+	unsigned char y = in->y;
+
+	if(h == &instr6XNN) {
+		emitVx(jit, 0xC6, 0, x); emitByte(jit, in->nn);	// mov byte Vx, nn
+	} else if(h == &instr7XNN) {
+		emitVx(jit, 0x80, 0, x); emitByte(jit, in->nn);	// add byte Vx, nn
+	} else if(h == &instr8XY0) {
+		emitVx(jit, 0x8A, 0, y);	// mov al, Vy
+		emitVx(jit, 0x88, 0, x);	// mov Vx, al
+	} else if(h == &instr8XY1 || h == &instr8XY2 || h == &instr8XY3) {
+		emitVx(jit, 0x8A, 0, y);
+		emitVx(jit, h == &instr8XY1 ? 0x08 : h == &instr8XY2 ? 0x20 : 0x30, 0, x);	// or/and/xor Vx, al
+	} else if(h == &instr8XY4 && x != 0xF && y != 0xF) {
+		emitVx(jit, 0x8A, 0, x);	// mov al, Vx
+		emitVx(jit, 0x02, 0, y);	// add al, Vy
+		emit(jit, 3, 0x0F, 0x92, 0xC2);	// setc dl
+		emitVx(jit, 0x88, 0, x);	// mov Vx, al
+		emitVx(jit, 0x88, 2, 0xF);	// mov VF, dl
+	} else if((h == &instr8XY5 || h == &instr8XY7) && x != 0xF && y != 0xF) {
+		unsigned char a = h == &instr8XY5 ? x : y;
+		unsigned char b = h == &instr8XY5 ? y : x;
+		emitVx(jit, 0x8A, 0, a);	// mov al, Va
+		emitVx(jit, 0x8A, 1, b);	// mov cl, Vb
+		emit(jit, 2, 0x38, 0xC8);	// cmp al, cl
+		emit(jit, 3, 0x0F, 0x97, 0xC2);	// seta dl
+		emit(jit, 2, 0x28, 0xC8);	// sub al, cl
+		emitVx(jit, 0x88, 0, x);	// mov Vx, al
+		emitVx(jit, 0x88, 2, 0xF);	// mov VF, dl
+	} else if(h == &instr8XY6 || h == &instr8XYE) {
+		// VF is taken from Vy after Vx is written, as the handler does
+		emitVx(jit, 0x8A, 0, y);
+		if(h == &instr8XY6)
+			emit(jit, 2, 0xD0, 0xE8);	// shr al, 1
+		else
+			emit(jit, 2, 0xD0, 0xE0);	// shl al, 1
+		emitVx(jit, 0x88, 0, x);
+		emitVx(jit, 0x8A, 0, y);
+		if(h == &instr8XY6)
+			emit(jit, 2, 0x24, 0x01);	// and al, 1
+		else
+			emit(jit, 3, 0xC0, 0xE8, 0x07);	// shr al, 7
+		emitVx(jit, 0x88, 0, 0xF);
+	} else if(h == &instrANNN) {
+		emitStoreWord(jit, OFFSET_I, in->nnn);
+	} else if(h == &instrFX1E) {
+		emit(jit, 4, 0x0F, 0xB6, 0x43, OFFSET_V + x);	// movzx eax, Vx
+		emit(jit, 4, 0x66, 0x01, 0x43, OFFSET_I);	// add I, ax
+	} else if(h == &instr1NNN) {
+		emitStorePc(jit, in->nnn);
+	} else if(h == &instr3XNN || h == &instr4XNN) {
+		emitVx(jit, 0x80, 7, x); emitByte(jit, in->nn);	// cmp byte Vx, nn
+		emitSkipTail(jit, h == &instr3XNN ? 0x75 : 0x74, address);	// jne / je
+	} else if(h == &instr5XY0 || h == &instr9XY0) {
+		emitVx(jit, 0x8A, 0, y);	// mov al, Vy
+		emitVx(jit, 0x38, 0, x);	// cmp Vx, al
+		emitSkipTail(jit, h == &instr5XY0 ? 0x75 : 0x74, address);
+	} else {
+		return 0;
+	}
+
+	return 1;
+}
+
+static JitCode * allocateCode(BlockCache *cache) {
+	JitCode *jit = cache->jit = (JitCode*) calloc(1, sizeof(JitCode));
+	if(jit == NULL)
+		return NULL;
+
+#ifdef _WIN32
+	jit->buffer = (unsigned char*) VirtualAlloc(NULL, JIT_CODE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+	jit->buffer = (unsigned char*) mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(jit->buffer == MAP_FAILED)
+		jit->buffer = NULL;
+#endif
+	jit->unavailable = jit->buffer == NULL;
+
+	return jit;
+}
+
+static void resetTranslations(BlockCache *cache) {
+	for(int i = 0; i < MEMORY_SIZE; i++) {
+		if(cache->blocks[i] != NULL) {
+			cache->blocks[i]->code = NULL;
+			cache->blocks[i]->hits = 0;
+		}
+	}
+	cache->jit->used = 0;
+}
+
+static void compileBlock(BlockCache *cache, Block *b) {
+	JitCode *jit = cache->jit;
+	if(jit == NULL && (jit = allocateCode(cache)) == NULL)
+		return;
+	if(jit->unavailable)
+		return;
+	if(jit->used + JIT_BLOCK_CODE_MAX > JIT_CODE_SIZE)
+		resetTranslations(cache);
+
+	unsigned char *start = jit->buffer + jit->used;
+	jit->cursor = start;
+
+	// Prologue: rbx = c, stack aligned for calls
+	emitByte(jit, 0x53);	// push rbx
+#ifdef _WIN32
+	emit(jit, 3, 0x48, 0x89, 0xCB);	// mov rbx, rcx
+	emit(jit, 4, 0x48, 0x83, 0xEC, 0x20);	// sub rsp, 32 (shadow space)
+#else
+	emit(jit, 3, 0x48, 0x89, 0xFB);	// mov rbx, rdi
+#endif
+
+	int pending = 0;	// Timer ticks owed by instructions so far
+	unsigned short address = b->start;
+	int nativeEnd = 0;
+	for(int i = 0; i < b->length; i++) {
+		const Instruction *in = b->ops[i];
+
+		nativeEnd = emitNative(jit, in, address);
+		if(!nativeEnd) {
+			if(usesTimers(in->execute) && pending > 0) {
+				emitCallInt(jit, &tickTimers, pending);
+				pending = 0;
+			}
+			emitStorePc(jit, address);
+			emitCallPointer(jit, in->execute, in);
+		}
+
+		pending++;
+		address += 2;
+	}
+
+	// Straight-line blocks cut at BLOCK_MAX_LENGTH fall through to the next address
+	if(nativeEnd && !endsBlock(b->ops[b->length - 1]->execute))
+		emitStorePc(jit, address);
+
+	// Epilogue
+#ifdef _WIN32
+	emit(jit, 4, 0x48, 0x83, 0xC4, 0x20);	// add rsp, 32
+#endif
+	emit(jit, 2, 0x5B, 0xC3);	// pop rbx; ret
+
+	jit->used += jit->cursor - start;
+	b->pendingTicks = pending;
+	b->code = (void (*)(Chip8*)) start;
+}
+
+#endif /* JIT_X86_64 */
+
+void freeJitCode(BlockCache *cache) {
+	JitCode *jit = cache->jit;
+	if(jit == NULL)
+		return;
+
+#ifdef JIT_X86_64
+	if(jit->buffer != NULL) {
+	#ifdef _WIN32
+		VirtualFree(jit->buffer, 0, MEM_RELEASE);
+	#else
+		munmap(jit->buffer, JIT_CODE_SIZE);
+	#endif
+	}
+#endif
+	free(jit);
+	cache->jit = NULL;
+}
+
+int jitAvailable(Chip8 *c) {
+#ifdef JIT_X86_64
+	return c->blockCache == NULL || c->blockCache->jit == NULL || !c->blockCache->jit->unavailable;
+#else
+	return 0;
+#endif
+}
+
+// Runs the block at pc, natively once it is hot. Returns the number of instructions executed.
+int emulateJit(Chip8 *c) {
+	Block *b = getBlock(c, c->pc);
+	if(b == NULL) {
+		emulateCycle(c);
+		return 1;
+	}
+
+#ifdef JIT_X86_64
+	if(b->code == NULL && ++b->hits >= JIT_THRESHOLD)
+		compileBlock(c->blockCache, b);
+
+	if(b->code != NULL && !TRACING(c)) {	// Traced instructions are replayed one by one
+		// The block can be invalidated by its own FX33/FX55, so copy what is needed first
+		int length = b->length;
+		int pendingTicks = b->pendingTicks;
+		c->instruction = b->ops[length - 1];
+		PROFILE_BLOCK(c, b);
+
+		b->code(c);
+
+		c->opcode = c->instruction->opcode;
+		tickTimers(c, pendingTicks);
+		return length;
+	}
+#endif
+
+	return runBlock(c, b);
+}
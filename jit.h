@@ -0,0 +1,18 @@
+/* file jit.h */
+
+#ifndef JIT_H
+#define JIT_H
+
+#include "blockcache.h"
+
+// Replays of a block before it is translated to native code
+#define JIT_THRESHOLD 16
+
+// Executable memory reserved for the translations of one instance
+#define JIT_CODE_SIZE (256 * 1024)
+
+int emulateJit(Chip8 *c);
+int jitAvailable(Chip8 *c);
+void freeJitCode(BlockCache *cache);
+
+#endif /* JIT_H */
@@ -0,0 +1,466 @@
+/* file lockstep.c */
+
+/*
+ * Lockstep engine: every step picks the lowest pc among the lanes and runs
+ * its instruction on all lanes sitting at that pc with the same opcode, so
+ * lanes that diverged at a skip or key test wait for each other and merge
+ * again. A lane parked at a lower pc, in FX0A or a jump to itself, would be
+ * picked forever, so a lane that falls LOCKSTEP_MAX_LAG instructions behind
+ * is run first until it is halfway caught up. Register-only instructions
+ * (6XNN, 7XNN, 8XYN, 3XNN, 4XNN, 5XY0, 9XY0) run 32 lanes per AVX2
+ * operation; jumps, calls, ANNN and FX1E are simple per-lane loops over the
+ * SoA arrays; everything else copies the lane's registers into its Chip8
+ * instance and calls the instr* handler.
+ * Timers are only brought up to date then, so no step pays for them.
+ * Built without AVX2 the register-only instructions take the handler path.
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __AVX2__
+	#include <immintrin.h>
+#endif
+
+#ifdef _WIN32
+	#include <malloc.h>
+#endif
+
+#include "lockstep.h"
+
+Lockstep * createLockstep(int lanes) {
+	if(lanes < 1 || lanes > LOCKSTEP_MAX_LANES) {
+		fprintf(stderr, "Error: Lockstep lane count must be 1 to %d\n", LOCKSTEP_MAX_LANES);
+		return NULL;
+	}
+
+	Lockstep *l;
+#ifdef _WIN32
+	l = (Lockstep*) _aligned_malloc(sizeof(Lockstep), _Alignof(Lockstep));
+#else
+	l = (Lockstep*) aligned_alloc(_Alignof(Lockstep), sizeof(Lockstep));
+#endif
+	if(l == NULL) {
+		fprintf(stderr, "Error: Unable to allocate lockstep lanes\n");
+		return NULL;
+	}
+
+	memset(l, 0, sizeof(Lockstep));
+	l->numOfLanes = lanes;
+	for(int i = lanes; i < LOCKSTEP_MAX_LANES; i++)	// Never the lowest pc
+		l->pc[i] = 0xFFFF;
+	for(int i = 0; i < lanes; i++) {
+		if((l->lanes[i] = createChip8()) == NULL) {
+			destroyLockstep(l);
+			return NULL;
+		}
+	}
+
+	resetLockstep(l);
+	return l;
+}
+
+void destroyLockstep(Lockstep *l) {
+	if(l == NULL)
+		return;
+
+	for(int i = 0; i < l->numOfLanes; i++)
+		destroyChip8(l->lanes[i]);
+#ifdef _WIN32
+	_aligned_free(l);
+#else
+	free(l);
+#endif
+}
+
+// Copies the SoA registers of a lane into its Chip8 instance. The stack is left out,
+// only 2NNN and 00EE use it and they run on the SoA arrays.
+static void scatterLane(Lockstep *l, int lane) {
+	Chip8 *c = l->lanes[lane];
+
+	c->pc = l->pc[lane];
+	c->I = l->I[lane];
+	c->sp = l->sp[lane];
+	for(int r = 0; r < NUM_OF_REGISTERS; r++)
+		c->V[r] = l->V[r][lane];
+
+	// Timers catch up with the instructions the lane ran since
+	for(unsigned long long n = l->executed[lane] - l->timed[lane]; n > 0; ) {
+		int step = n > INT_MAX ? INT_MAX : (int) n;
+		tickTimers(c, step);
+		n -= step;
+	}
+	l->timed[lane] = l->executed[lane];
+}
+
+// Copies the registers of a lane's Chip8 instance back into the SoA arrays
+static void gatherLane(Lockstep *l, int lane) {
+	Chip8 *c = l->lanes[lane];
+
+	l->pc[lane] = c->pc;
+	l->I[lane] = c->I;
+	l->sp[lane] = c->sp;
+	for(int r = 0; r < NUM_OF_REGISTERS; r++)
+		l->V[r][lane] = c->V[r];
+}
+
+// Initializes every lane and takes over its registers
+void resetLockstep(Lockstep *l) {
+	for(int i = 0; i < l->numOfLanes; i++) {
+		initialize(l->lanes[i]);
+		gatherLane(l, i);
+		for(int s = 0; s < STACK_SIZE; s++)
+			l->stack[s][i] = 0;
+		l->executed[i] = 0;
+		l->timed[i] = 0;
+	}
+
+	memset(l->written, 0, sizeof(l->written));
+	l->steps = 0;
+	l->lagging = -1;
+}
+
+int loadLockstep(Lockstep *l, char *file) {
+	resetLockstep(l);
+	for(int i = 0; i < l->numOfLanes; i++) {
+		if(loadGame(l->lanes[i], file) == -1)
+			return -1;
+	}
+
+	return 0;
+}
+
+// Returns the Chip8 instance of a lane with its registers brought up to date
+Chip8 * getLane(Lockstep *l, int lane) {
+	scatterLane(l, lane);
+	for(int s = 0; s < STACK_SIZE; s++)
+		l->lanes[lane]->stack[s] = l->stack[s][lane];
+	return l->lanes[lane];
+}
+
+#ifdef __AVX2__
+
+static inline __m256i loadLanes(const void *p) {
+	return _mm256_load_si256((const __m256i*) p);
+}
+
+// Writes value to the lanes selected by mask
+static inline void storeLanes(void *p, __m256i value, __m256i mask) {
+	_mm256_store_si256((__m256i*) p, _mm256_blendv_epi8(loadLanes(p), value, mask));
+}
+
+static unsigned short lowestPc(Lockstep *l) {
+	__m256i low = _mm256_set1_epi16(-1);
+	for(int i = 0; i < l->numOfLanes; i += 16)
+		low = _mm256_min_epu16(low, loadLanes(l->pc + i));
+
+	__m128i half = _mm_min_epu16(_mm256_castsi256_si128(low), _mm256_extracti128_si256(low, 1));
+	return _mm_cvtsi128_si32(_mm_minpos_epu16(half)) & 0xFFFF;
+}
+
+// Marks the lanes at pc in group. Returns their number.
+static int selectGroup(Lockstep *l, unsigned short pc) {
+	const __m256i target = _mm256_set1_epi16(pc);
+	int count = 0;
+
+	for(int i = 0; i < l->numOfLanes; i += 32) {
+		__m256i low = _mm256_cmpeq_epi16(loadLanes(l->pc + i), target);
+		__m256i high = _mm256_cmpeq_epi16(loadLanes(l->pc + i + 16), target);
+		__m256i group = _mm256_permute4x64_epi64(_mm256_packs_epi16(low, high), 0xD8);
+
+		_mm256_store_si256((__m256i*) (l->group + i), group);
+		count += __builtin_popcount(_mm256_movemask_epi8(group));
+	}
+
+	return count;
+}
+
+static void countExecuted(Lockstep *l) {
+	for(int i = 0; i < l->numOfLanes; i += 4) {
+		int group;
+		memcpy(&group, l->group + i, sizeof(group));
+		if(group == 0)
+			continue;
+
+		__m256i executed = loadLanes(l->executed + i);	// Selected lanes are -1
+		_mm256_store_si256((__m256i*) (l->executed + i), _mm256_sub_epi64(executed, _mm256_cvtepi8_epi64(_mm_cvtsi32_si128(group))));
+	}
+}
+
+// Sets a 16-bit register of the group to value, plus 2 in lanes whose skip condition holds
+static void storeGroupWords(Lockstep *l, unsigned short *dst, unsigned short value, int skips) {
+	const __m256i base = _mm256_set1_epi16(value);
+	const __m256i two = _mm256_set1_epi16(2);
+
+	for(int i = 0; i < l->numOfLanes; i += 16) {
+		__m256i group = _mm256_cvtepi8_epi16(_mm_load_si128((const __m128i*) (l->group + i)));
+		__m256i result = base;
+		if(skips)
+			result = _mm256_add_epi16(base, _mm256_and_si256(_mm256_cvtepi8_epi16(_mm_load_si128((const __m128i*) (l->skip + i))), two));
+		storeLanes(dst + i, result, group);
+	}
+}
+
+// Runs a register-only instruction on the group, 32 lanes at a time. Returns 0 if in is not one.
+static int vectorStep(Lockstep *l, const Instruction *in, unsigned short pc) {
+	InstructionHandler h = in->execute;
+	int flagSafe = in->x != 0xF && in->y != 0xF;	// VF is not an operand
+	int shiftSafe = flagSafe && in->x != in->y;		// Vy is not overwritten before the flag is taken
+
+	int skips = h == &instr3XNN || h == &instr4XNN || h == &instr5XY0 || h == &instr9XY0;
+	int flags = ((h == &instr8XY4 || h == &instr8XY5 || h == &instr8XY7) && flagSafe)
+		|| ((h == &instr8XY6 || h == &instr8XYE) && shiftSafe);
+	int plain = h == &instr6XNN || h == &instr7XNN || h == &instr8XY0 || h == &instr8XY1
+		|| h == &instr8XY2 || h == &instr8XY3;
+
+	if(!skips && !flags && !plain)
+		return 0;
+
+	const __m256i one = _mm256_set1_epi8(1);
+	const __m256i nn = _mm256_set1_epi8((char) in->nn);
+	unsigned char *vx = l->V[in->x];
+	unsigned char *vy = l->V[in->y];
+	unsigned char *vf = l->V[0xF];
+
+	for(int i = 0; i < l->numOfLanes; i += 32) {
+		__m256i group = loadLanes(l->group + i);
+		if(!_mm256_movemask_epi8(group))
+			continue;
+
+		__m256i x = loadLanes(vx + i);
+		__m256i y = loadLanes(vy + i);
+		__m256i result, flag = _mm256_setzero_si256();
+
+		if(skips) {
+			__m256i equal = h == &instr3XNN || h == &instr4XNN ? _mm256_cmpeq_epi8(x, nn) : _mm256_cmpeq_epi8(x, y);
+			if(h == &instr4XNN || h == &instr9XY0)
+				equal = _mm256_xor_si256(equal, _mm256_set1_epi8(-1));
+			_mm256_store_si256((__m256i*) (l->skip + i), equal);
+			continue;
+		}
+
+		if(h == &instr6XNN) {
+			result = nn;
+		} else if(h == &instr7XNN) {
+			result = _mm256_add_epi8(x, nn);
+		} else if(h == &instr8XY0) {
+			result = y;
+		} else if(h == &instr8XY1) {
+			result = _mm256_or_si256(x, y);
+		} else if(h == &instr8XY2) {
+			result = _mm256_and_si256(x, y);
+		} else if(h == &instr8XY3) {
+			result = _mm256_xor_si256(x, y);
+		} else if(h == &instr8XY4) {
+			result = _mm256_add_epi8(x, y);	// Carry where the saturating sum differs
+			flag = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_adds_epu8(x, y), result), one);
+		} else if(h == &instr8XY5) {
+			result = _mm256_sub_epi8(x, y);	// VF = Vx > Vy
+			flag = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(x, y), y), one);
+		} else if(h == &instr8XY7) {
+			result = _mm256_sub_epi8(y, x);	// VF = Vy > Vx
+			flag = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(x, y), x), one);
+		} else if(h == &instr8XY6) {
+			result = _mm256_and_si256(_mm256_srli_epi16(y, 1), _mm256_set1_epi8(0x7F));
+			flag = _mm256_and_si256(y, one);
+		} else {	// 8XYE
+			result = _mm256_add_epi8(y, y);
+			flag = _mm256_and_si256(_mm256_srli_epi16(y, 7), one);
+		}
+
+		storeLanes(vx + i, result, group);
+		if(flags)
+			storeLanes(vf + i, flag, group);
+	}
+
+	storeGroupWords(l, l->pc, pc + 2, skips);
+	return 1;
+}
+
+#else
+
+static unsigned short lowestPc(Lockstep *l) {
+	unsigned short pc = l->pc[0];
+	for(int i = 1; i < l->numOfLanes; i++)
+		if(l->pc[i] < pc)
+			pc = l->pc[i];
+
+	return pc;
+}
+
+static int selectGroup(Lockstep *l, unsigned short pc) {
+	int count = 0;
+
+	for(int i = 0; i < l->numOfLanes; i++) {
+		l->group[i] = l->pc[i] == pc ? 0xFF : 0;
+		count += l->group[i] & 1;
+	}
+
+	return count;
+}
+
+static void countExecuted(Lockstep *l) {
+	for(int i = 0; i < l->numOfLanes; i++)
+		l->executed[i] += l->group[i] & 1;
+}
+
+static void storeGroupWords(Lockstep *l, unsigned short *dst, unsigned short value, int skips) {
+	for(int i = 0; i < l->numOfLanes; i++)
+		if(l->group[i])
+			dst[i] = value + (skips && l->skip[i] ? 2 : 0);
+}
+
+static int vectorStep(Lockstep *l, const Instruction *in, unsigned short pc) {
+	return 0;
+}
+
+#endif /* __AVX2__ */
+
+// Flow and index register instructions on the SoA arrays. Returns 0 if in is not one.
+static int laneStep(Lockstep *l, const Instruction *in, unsigned short pc) {
+	InstructionHandler h = in->execute;
+
+	if(h == &instr1NNN) {
+		storeGroupWords(l, l->pc, in->nnn, 0);
+	} else if(h == &instrANNN) {
+		storeGroupWords(l, l->I, in->nnn, 0);
+		storeGroupWords(l, l->pc, pc + 2, 0);
+	} else if(h == &instr2NNN) {
+		for(int i = 0; i < l->numOfLanes; i++) {
+			if(l->group[i]) {
+				l->stack[l->sp[i]++][i] = l->pc[i];
+				l->pc[i] = in->nnn;
+			}
+		}
+	} else if(h == &instr00EE) {
+		for(int i = 0; i < l->numOfLanes; i++)
+			if(l->group[i])
+				l->pc[i] = l->stack[--l->sp[i]][i] + 2;
+	} else if(h == &instrFX1E) {
+		for(int i = 0; i < l->numOfLanes; i++) {
+			if(l->group[i]) {
+				l->I[i] += l->V[in->x][i];
+				l->pc[i] += 2;
+			}
+		}
+	} else {
+		return 0;
+	}
+
+	return 1;
+}
+
+// Keeps only the group lanes whose memory holds the same opcode at pc as the lagging lane,
+// or else the first of them
+static unsigned short splitPatched(Lockstep *l, unsigned short pc, int *count) {
+	int leader = 0;
+	while(!l->group[leader])
+		leader++;
+	if(l->lagging >= 0 && l->group[l->lagging])
+		leader = l->lagging;
+
+	unsigned char *m = l->lanes[leader]->memory;
+	unsigned short opcode = m[pc] << 8 | m[pc + 1];
+	for(int i = 0; i < l->numOfLanes; i++) {
+		m = l->lanes[i]->memory;
+		if(l->group[i] && (m[pc] << 8 | m[pc + 1]) != opcode) {
+			l->group[i] = 0;	// Runs in a later step
+			(*count)--;
+		}
+	}
+
+	return opcode;
+}
+
+// The lowest pc, or the lagging lane's while one is being caught up
+static unsigned short schedulePc(Lockstep *l) {
+	if(l->lagging < 0 && ++l->steps % LOCKSTEP_LAG_INTERVAL == 0) {
+		int slowest = 0;
+		unsigned long long most = 0;
+		for(int i = 0; i < l->numOfLanes; i++) {
+			if(l->executed[i] < l->executed[slowest])
+				slowest = i;
+			if(l->executed[i] > most)
+				most = l->executed[i];
+		}
+		if(most - l->executed[slowest] > LOCKSTEP_MAX_LAG) {
+			l->lagging = slowest;
+			l->caughtUp = most - LOCKSTEP_MAX_LAG / 2;
+		}
+	}
+
+	if(l->lagging >= 0) {
+		if(l->executed[l->lagging] < l->caughtUp)
+			return l->pc[l->lagging];
+		l->lagging = -1;
+	}
+
+	return lowestPc(l);
+}
+
+// Marks the addresses an FX33/FX55 run on a lane stores to, from the lane's I before it ran
+static void markWritten(Lockstep *l, int lane, const Instruction *in) {
+	int stores = in->execute == &instrFX33 ? 3 : in->execute == &instrFX55 ? in->x + 1 : 0;
+
+	for(int j = 0; j < stores; j++)
+		l->written[(l->I[lane] + j) % MEMORY_SIZE] = 1;
+}
+
+// Steps the group lanes one by one as the interpreter does, for a pc where no whole instruction
+// fits in memory
+static void stepLanes(Lockstep *l) {
+	for(int i = 0; i < l->numOfLanes; i++) {
+		if(!l->group[i])
+			continue;
+
+		Chip8 *c = getLane(l, i);
+		emulateCycle(c);
+		markWritten(l, i, c->instruction);	// I of the lane is not gathered yet
+		l->timed[i]++;	// emulateCycle() ticked the timers for this instruction
+		gatherLane(l, i);
+		for(int s = 0; s < STACK_SIZE; s++)
+			l->stack[s][i] = c->stack[s];
+	}
+}
+
+// Executes one instruction on every lane at the scheduled pc. Returns the number of lanes that ran.
+int emulateLockstep(Lockstep *l) {
+	unsigned short pc = schedulePc(l);
+	int count = selectGroup(l, pc);
+
+	if(pc >= MEMORY_SIZE - 1) {	// The fetch wraps around the end of memory, as emulateCycle() does it
+		stepLanes(l);
+		countExecuted(l);
+		return count;
+	}
+
+	unsigned short opcode;
+	if(l->written[pc] || l->written[pc + 1]) {
+		opcode = splitPatched(l, pc, &count);
+	} else {
+		unsigned char *m = l->lanes[0]->memory;
+		opcode = m[pc] << 8 | m[pc + 1];
+	}
+
+	const Instruction *in = decode(opcode);
+	if(!vectorStep(l, in, pc) && !laneStep(l, in, pc)) {
+		for(int i = 0; i < l->numOfLanes; i++) {
+			if(!l->group[i])
+				continue;
+
+			markWritten(l, i, in);
+			Chip8 *c = l->lanes[i];
+			scatterLane(l, i);
+			c->opcode = opcode;
+			c->instruction = in;
+			in->execute(c, in);
+			gatherLane(l, i);
+		}
+	}
+
+	countExecuted(l);	// After the handlers, whose lanes' timers must not tick for this instruction yet
+
+	return count;
+}
@@ -0,0 +1,48 @@
+/* file lockstep.h */
+
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include "chip8.h"
+
+// Most machines stepped together, a multiple of the 32 byte lanes of an AVX2 register
+#define LOCKSTEP_MAX_LANES 256
+
+// Instructions a lane may fall behind the lane furthest ahead before it is run ahead of lower pcs,
+// checked every LOCKSTEP_LAG_INTERVAL steps
+#define LOCKSTEP_MAX_LAG 1024
+#define LOCKSTEP_LAG_INTERVAL 64
+
+// Many machines running the same ROM, registers stored structure-of-arrays (V[r][lane]) so that
+// lanes sharing a pc execute one instruction together. Memory, keypad and framebuffer stay in
+// one Chip8 instance per lane, as do the timers, which catch up with the lane's instruction count
+// whenever the lane runs a handler. Registers and timers are only current after getLane(). All
+// lanes must start from the same memory image, so code that no lane has stored over is read from
+// lane 0.
+typedef struct Lockstep {
+	_Alignas(32) unsigned char V[NUM_OF_REGISTERS][LOCKSTEP_MAX_LANES];
+	_Alignas(32) unsigned char group[LOCKSTEP_MAX_LANES];	// 0xFF for the lanes executing this step
+	_Alignas(32) unsigned char skip[LOCKSTEP_MAX_LANES];	// 0xFF for the lanes whose condition holds
+	_Alignas(32) unsigned short pc[LOCKSTEP_MAX_LANES];	// 0xFFFF past the last lane
+	_Alignas(32) unsigned short I[LOCKSTEP_MAX_LANES];
+	unsigned short sp[LOCKSTEP_MAX_LANES];
+	unsigned short stack[STACK_SIZE][LOCKSTEP_MAX_LANES];
+	_Alignas(32) unsigned long long executed[LOCKSTEP_MAX_LANES];	// Instructions executed by each lane
+	unsigned long long timed[LOCKSTEP_MAX_LANES];	// Instructions the lane's timers have been ticked for
+	unsigned char written[MEMORY_SIZE];	// Addresses stored to by FX33/FX55 in any lane
+	unsigned int steps;
+	int lagging;						// Lane being caught up, -1 when none
+	unsigned long long caughtUp;		// Instructions after which the lagging lane is caught up
+
+	Chip8 *lanes[LOCKSTEP_MAX_LANES];
+	int numOfLanes;
+} Lockstep;
+
+Lockstep * createLockstep(int lanes);
+void destroyLockstep(Lockstep *l);
+void resetLockstep(Lockstep *l);
+int loadLockstep(Lockstep *l, char *file);
+int emulateLockstep(Lockstep *l);
+Chip8 * getLane(Lockstep *l, int lane);
+
+#endif /* LOCKSTEP_H */
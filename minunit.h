@@ -1,16 +1,16 @@
-#ifndef MINUNIT_H
-#define MINUNIT_H
-
-/* file: minunit.h */
-
-/*
- * Credit: JTN002 - MinUnit -- a minimal unit testing framework for C
- * http://www.jera.com/techinfo/jtns/jtn002.html
-*/
-
- #define mu_assert(message, test) do { if (!(test)) return message; } while (0)
- #define mu_run_test(test) do { char *message = test(); tests_run++; \
-                                if (message) return message; } while (0)
- extern int tests_run;
-
-#endif /* MINUNIT_H */
+#ifndef MINUNIT_H
+#define MINUNIT_H
+
+/* file: minunit.h */
+
+/*
+ * Credit: JTN002 - MinUnit -- a minimal unit testing framework for C
+ * http://www.jera.com/techinfo/jtns/jtn002.html
+*/
+
+ #define mu_assert(message, test) do { if (!(test)) return message; } while (0)
+ #define mu_run_test(test) do { char *message = test(); tests_run++; \
+                                if (message) return message; } while (0)
+ extern int tests_run;
+
+#endif /* MINUNIT_H */
@@ -0,0 +1,172 @@
+/* file profile.c */
+
+/*
+ * Execution profile of one machine: every instruction run is counted by
+ * opcode and by address, through the PROFILE_* hooks in the interpreter,
+ * block and JIT paths (the JIT counts a whole block before running it).
+ * printProfile() turns the counts into the opcode class mix, the hottest
+ * addresses, the basic blocks ranked by the instructions spent in them and
+ * a heatmap of the 4K memory. Instructions skipped in idle loops are not
+ * counted, they are in Chip8.elided.
+ */
+
+#include <stdlib.h>
+
+#include "profile.h"
+
+#define PROFILE_TOP 16			// Entries listed per ranking
+#define PROFILE_DOMINANT 10		// Percent of all instructions that flags a basic block as dominant
+#define HEATMAP_COLS 64			// Instruction slots (2 bytes) per heatmap row
+
+static const char heatLevels[] = " .:-=+*#%@";
+
+static const struct {
+	InstructionHandler handler;
+	const char *name;
+} opcodeClasses[] = {
+	{ &instr0NNN, "0NNN" }, { &instr00E0, "00E0" }, { &instr00EE, "00EE" }, { &instr1NNN, "1NNN" },
+	{ &instr2NNN, "2NNN" }, { &instr3XNN, "3XNN" }, { &instr4XNN, "4XNN" }, { &instr5XY0, "5XY0" },
+	{ &instr6XNN, "6XNN" }, { &instr7XNN, "7XNN" }, { &instr8XY0, "8XY0" }, { &instr8XY1, "8XY1" },
+	{ &instr8XY2, "8XY2" }, { &instr8XY3, "8XY3" }, { &instr8XY4, "8XY4" }, { &instr8XY5, "8XY5" },
+	{ &instr8XY6, "8XY6" }, { &instr8XY7, "8XY7" }, { &instr8XYE, "8XYE" }, { &instr9XY0, "9XY0" },
+	{ &instrANNN, "ANNN" }, { &instrBNNN, "BNNN" }, { &instrCXNN, "CXNN" }, { &instrDXYN, "DXYN" },
+	{ &instrEX9E, "EX9E" }, { &instrEXA1, "EXA1" }, { &instrFX07, "FX07" }, { &instrFX0A, "FX0A" },
+	{ &instrFX15, "FX15" }, { &instrFX18, "FX18" }, { &instrFX1E, "FX1E" }, { &instrFX29, "FX29" },
+	{ &instrFX33, "FX33" }, { &instrFX55, "FX55" }, { &instrFX65, "FX65" }, { &instrUnknown, "????" }
+};
+
+#define NUM_OF_CLASSES ((int) (sizeof(opcodeClasses) / sizeof(opcodeClasses[0])))
+
+// An address, opcode class or basic block and the instructions run there
+typedef struct Entry {
+	unsigned long long count;
+	int index;		// Address or class
+	int length;		// Instructions in a basic block
+} Entry;
+
+static Profile * getProfile(Chip8 *c) {
+	if(c->profile == NULL)
+		c->profile = (Profile*) calloc(1, sizeof(Profile));
+	return c->profile;
+}
+
+void profileInstruction(Chip8 *c, unsigned short pc, unsigned short opcode) {
+	Profile *p = getProfile(c);
+	if(p == NULL)
+		return;
+
+	p->opcodes[opcode]++;
+	p->addresses[pc % MEMORY_SIZE]++;
+	p->total++;
+}
+
+// Counts every instruction of a block about to run
+void profileBlock(Chip8 *c, const Block *b) {
+	for(int i = 0; i < b->length; i++)
+		profileInstruction(c, b->start + 2 * i, b->ops[i]->opcode);
+}
+
+static int classOf(InstructionHandler handler) {
+	for(int i = 0; i < NUM_OF_CLASSES - 1; i++)
+		if(opcodeClasses[i].handler == handler)
+			return i;
+	return NUM_OF_CLASSES - 1;
+}
+
+static int compareEntries(const void *a, const void *b) {
+	unsigned long long x = ((const Entry*) a)->count, y = ((const Entry*) b)->count;
+	return (x < y) - (x > y);
+}
+
+static unsigned short opcodeAt(Chip8 *c, int address) {
+	return c->memory[address] << 8 | c->memory[(address + 1) % MEMORY_SIZE];
+}
+
+static int bitLength(unsigned long long x) {
+	int bits = 0;
+	for(; x != 0; x >>= 1)
+		bits++;
+	return bits;
+}
+
+// Writes the opcode class mix, the hottest addresses, the basic blocks ranked by instructions run
+// and a heatmap of memory
+void printProfile(Chip8 *c, FILE *out) {
+	static Entry entries[MEMORY_SIZE];
+	Profile *p = c->profile;
+	if(p == NULL || p->total == 0) {
+		fprintf(out, "Profile: no instructions counted\n");
+		return;
+	}
+
+	fprintf(out, "Profile: %llu instructions, %llu skipped in idle loops\n\n", p->total, c->elided);
+
+	// Opcode classes
+	int n = 0;
+	for(int i = 0; i < NUM_OF_CLASSES; i++)
+		entries[i] = (Entry) { 0, i, 0 };
+	for(int op = 0; op < 65536; op++)
+		if(p->opcodes[op] != 0)
+			entries[classOf(decode(op)->execute)].count += p->opcodes[op];
+	qsort(entries, NUM_OF_CLASSES, sizeof(Entry), &compareEntries);
+	fprintf(out, "%-8s %16s %8s\n", "opcode", "count", "%");
+	for(int i = 0; i < NUM_OF_CLASSES && entries[i].count != 0; i++)
+		fprintf(out, "%-8s %16llu %7.2f%%\n", opcodeClasses[entries[i].index].name, entries[i].count,
+			100.0 * entries[i].count / p->total);
+
+	// Hottest addresses
+	n = 0;
+	for(int a = 0; a < MEMORY_SIZE; a++)
+		if(p->addresses[a] != 0)
+			entries[n++] = (Entry) { p->addresses[a], a, 1 };
+	qsort(entries, n, sizeof(Entry), &compareEntries);
+	fprintf(out, "\n%-8s %-8s %16s %8s\n", "address", "opcode", "count", "%");
+	for(int i = 0; i < n && i < PROFILE_TOP; i++)
+		fprintf(out, "0x%03X    %04X     %16llu %7.2f%%\n", entries[i].index, opcodeAt(c, entries[i].index),
+			entries[i].count, 100.0 * entries[i].count / p->total);
+
+	// Basic blocks: runs of instructions executed equally often, the earlier ones falling through
+	n = 0;
+	int open = 0;
+	for(int a = 0; a < MEMORY_SIZE; a += 2) {
+		unsigned long long count = p->addresses[a];
+		if(open && count != entries[n - 1].count)
+			open = 0;
+		if(count == 0)
+			continue;
+
+		if(!open)
+			entries[n++] = (Entry) { count, a, 0 };
+		entries[n - 1].length++;
+		open = !endsBlock(decode(opcodeAt(c, a))->execute);
+	}
+	for(int i = 0; i < n; i++)
+		entries[i].count *= entries[i].length;
+	qsort(entries, n, sizeof(Entry), &compareEntries);
+	fprintf(out, "\n%-14s %8s %16s %8s\n", "block", "length", "instructions", "%");
+	for(int i = 0; i < n && i < PROFILE_TOP; i++) {
+		double share = 100.0 * entries[i].count / p->total;
+		fprintf(out, "0x%03X-0x%03X    %8d %16llu %7.2f%%%s\n", entries[i].index,
+			entries[i].index + 2 * entries[i].length - 1, entries[i].length, entries[i].count, share,
+			share >= PROFILE_DOMINANT ? "  dominant" : "");
+	}
+
+	// Heatmap: one character per 2 bytes, darker on a log scale of the hottest slot
+	unsigned long long max = 0;
+	for(int a = 0; a < MEMORY_SIZE; a += 2)
+		if(p->addresses[a] + p->addresses[a + 1] > max)
+			max = p->addresses[a] + p->addresses[a + 1];
+	int range = bitLength(max) > 1 ? bitLength(max) - 1 : 1;
+	fprintf(out, "\nHeatmap, %d bytes per row, '%c' to '%c' on a log scale\n", 2 * HEATMAP_COLS, heatLevels[1],
+		heatLevels[sizeof(heatLevels) - 2]);
+	for(int row = 0; row < MEMORY_SIZE; row += 2 * HEATMAP_COLS) {
+		char line[HEATMAP_COLS + 1];
+		for(int i = 0; i < HEATMAP_COLS; i++) {
+			unsigned long long count = p->addresses[row + 2 * i] + p->addresses[row + 2 * i + 1];
+			int level = count == 0 ? 0 : 1 + (int) (sizeof(heatLevels) - 3) * (bitLength(count) - 1) / range;
+			line[i] = heatLevels[level];
+		}
+		line[HEATMAP_COLS] = '\0';
+		fprintf(out, "0x%03X |%s|\n", row, line);
+	}
+}
@@ -0,0 +1,32 @@
+/* file profile.h */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+
+#include "blockcache.h"
+
+// #define PROFILE	// Count executed instructions per opcode and address, compile with profile.c
+
+// Execution counts of one machine, allocated on the first instruction counted
+typedef struct Profile {
+	unsigned long long opcodes[65536];			// Per opcode
+	unsigned long long addresses[MEMORY_SIZE];	// Per pc
+	unsigned long long total;
+} Profile;
+
+// Hooks in the execution engines, nothing when PROFILE is not defined
+#ifdef PROFILE
+	#define PROFILE_INSTRUCTION(c, pc, opcode) profileInstruction(c, pc, opcode)
+	#define PROFILE_BLOCK(c, b) profileBlock(c, b)
+#else
+	#define PROFILE_INSTRUCTION(c, pc, opcode)
+	#define PROFILE_BLOCK(c, b)
+#endif
+
+void profileInstruction(Chip8 *c, unsigned short pc, unsigned short opcode);
+void profileBlock(Chip8 *c, const Block *b);
+void printProfile(Chip8 *c, FILE *out);
+
+#endif /* PROFILE_H */
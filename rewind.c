@@ -0,0 +1,236 @@
+/* file rewind.c */
+
+/*
+ * Rewind history. Each captured frame is a Snapshot (see state.h); only
+ * the latest is kept whole. An earlier frame is held as the XOR of its
+ * state with the next frame's, run-length encoded: runs of unchanged
+ * bytes are skipped and only the changed bytes are stored, so a frame
+ * that ran a game loop costs tens of bytes. Stepping back applies these
+ * deltas from the latest state backwards. Every REWIND_KEYFRAME_INTERVAL
+ * frames the full state is kept too, so stepping back any distance
+ * decodes at most that many deltas. Dropping the oldest frames never
+ * breaks a newer one, which is what keeps the history within its budget.
+ *
+ * Record encoding: runs of varint bytes unchanged, varint bytes changed,
+ * then the changed bytes XORed with the previous state.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rewind.h"
+
+#define MIN_GAP 4	// Unchanged bytes that end a run of changed ones
+
+static const unsigned char zeros[SNAPSHOT_SIZE];
+
+// Allocates a history holding as many frames as fit in budget bytes
+Rewind * createRewind(size_t budget) {
+	Rewind *r = (Rewind*) calloc(1, sizeof(Rewind));
+	int maxFrames = (int) (budget / REWIND_FRAME_BYTES);
+	if(r == NULL || maxFrames < 1) {
+		fprintf(stderr, "Error: Unable to allocate rewind buffer\n");
+		free(r);
+		return NULL;
+	}
+
+	r->maxFrames = maxFrames;
+	r->sinceKey = REWIND_KEYFRAME_INTERVAL - 1;	// The first frame stored is a keyframe
+	r->size = (unsigned int) (budget - maxFrames * sizeof(RewindFrame));
+	r->frames = (RewindFrame*) malloc(maxFrames * sizeof(RewindFrame));
+	r->buffer = (unsigned char*) malloc(r->size);
+	if(r->frames == NULL || r->buffer == NULL) {
+		fprintf(stderr, "Error: Unable to allocate rewind buffer\n");
+		destroyRewind(r);
+		return NULL;
+	}
+
+	return r;
+}
+
+void destroyRewind(Rewind *r) {
+	if(r == NULL)
+		return;
+
+	free(r->frames);
+	free(r->buffer);
+	free(r);
+}
+
+static unsigned char * putVarint(unsigned char *p, unsigned int value) {
+	for(; value >= 0x80; value >>= 7)
+		*p++ = (unsigned char) (value | 0x80);
+	*p++ = (unsigned char) value;
+	return p;
+}
+
+static unsigned int getVarint(const unsigned char **p) {
+	unsigned int value = 0;
+	for(int shift = 0; ; shift += 7) {
+		unsigned char byte = *(*p)++;
+		value |= (unsigned int) (byte & 0x7F) << shift;
+		if(byte < 0x80)
+			return value;
+	}
+}
+
+// Encodes the difference of two states into out. Returns its size.
+static unsigned int encodeDelta(const unsigned char *from, const unsigned char *to, unsigned char *out) {
+	unsigned char *p = out;
+	unsigned int i = 0;
+
+	while(i < SNAPSHOT_SIZE) {
+		unsigned int start = i;
+		unsigned long long a, b;
+		for(; i + 8 <= SNAPSHOT_SIZE; i += 8) {		// Unchanged bytes, a word at a time
+			memcpy(&a, from + i, 8);
+			memcpy(&b, to + i, 8);
+			if(a != b)
+				break;
+		}
+		while(i < SNAPSHOT_SIZE && from[i] == to[i])
+			i++;
+		if(i == SNAPSHOT_SIZE)
+			break;
+
+		unsigned int changed = i;
+		for(unsigned int same = 0; i < SNAPSHOT_SIZE && same < MIN_GAP; i++)
+			same = from[i] == to[i] ? same + 1 : 0;
+		while(i > changed && from[i - 1] == to[i - 1])	// The run ends at its last change
+			i--;
+
+		p = putVarint(p, changed - start);
+		p = putVarint(p, i - changed);
+		for(unsigned int k = changed; k < i; k++)
+			*p++ = from[k] ^ to[k];
+	}
+
+	return (unsigned int) (p - out);
+}
+
+// XORs an encoded difference into state
+static void applyDelta(unsigned char *state, const unsigned char *delta, unsigned int size) {
+	const unsigned char *p = delta, *end = delta + size;
+	unsigned int i = 0;
+
+	while(p < end) {
+		i += getVarint(&p);
+		unsigned int changed = getVarint(&p);
+		for(unsigned int k = 0; k < changed; k++)
+			state[i++] ^= *p++;
+	}
+}
+
+static RewindFrame * getFrame(Rewind *r, int i) {
+	return &r->frames[(r->first + i) % r->maxFrames];
+}
+
+static void dropOldest(Rewind *r) {
+	r->first = (r->first + 1) % r->maxFrames;
+	r->count--;
+}
+
+// Appends the records of the frame before the latest, dropping the oldest frames they overwrite
+static void storeFrame(Rewind *r, unsigned int deltaSize, unsigned int keySize) {
+	unsigned int size = deltaSize + keySize;
+	if(size > r->size) {	// Not even one frame fits, forget the history
+		r->count = 0;
+		r->end = 0;
+		return;
+	}
+
+	unsigned int at = r->end;
+	if(at + size > r->size) {
+		// Wrap around, the records left at the end of the buffer are the oldest
+		while(r->count > 0 && getFrame(r, 0)->offset >= at)
+			dropOldest(r);
+		at = 0;
+	}
+	while(r->count > 0) {
+		RewindFrame *oldest = getFrame(r, 0);
+		unsigned int oldestEnd = oldest->offset + oldest->deltaSize + oldest->keySize;
+		if(r->count < r->maxFrames && (oldest->offset >= at + size || oldestEnd <= at))
+			break;
+		dropOldest(r);
+	}
+
+	memcpy(r->buffer + at, r->encoded, size);
+	RewindFrame *f = getFrame(r, r->count++);
+	f->offset = at;
+	f->deltaSize = deltaSize;
+	f->keySize = keySize;
+	r->end = at + size;
+}
+
+// Records the machine's state as the latest frame. Costs a copy and a scan of the state.
+void captureFrame(Rewind *r, Chip8 *c) {
+	if(r->captured == 0) {
+		takeSnapshot(c, &r->latest);
+		r->captured = 1;
+		return;
+	}
+
+	// A keyframe follows every REWIND_KEYFRAME_INTERVAL - 1 delta-only frames, counted in the ring
+	// so that stepping back never decodes more than REWIND_KEYFRAME_INTERVAL deltas
+	takeSnapshot(c, &r->scratch);
+	unsigned int deltaSize = encodeDelta(r->latest.bytes, r->scratch.bytes, r->encoded);
+	unsigned int keySize = 0;
+	if(r->sinceKey >= REWIND_KEYFRAME_INTERVAL - 1)
+		keySize = encodeDelta(zeros, r->latest.bytes, r->encoded + deltaSize);
+	storeFrame(r, deltaSize, keySize);
+	r->sinceKey = keySize ? 0 : r->sinceKey + 1;
+
+	r->latest = r->scratch;
+	r->captured++;
+}
+
+// Returns the machine to the state n frames before the latest (fewer if the history is shorter),
+// which becomes the latest frame. Returns the number of frames stepped back.
+int rewindFrames(Rewind *r, Chip8 *c, int n) {
+	if(n > r->count)
+		n = r->count;
+	if(n <= 0)
+		return 0;
+
+	// Start from the nearest keyframe at or after the target, or the latest frame
+	int target = r->count - n;
+	int i = target;
+	while(i < r->count && getFrame(r, i)->keySize == 0)
+		i++;
+
+	unsigned char *state = r->scratch.bytes;
+	if(i < r->count) {
+		RewindFrame *key = getFrame(r, i);
+		memset(state, 0, SNAPSHOT_SIZE);
+		applyDelta(state, r->buffer + key->offset + key->deltaSize, key->keySize);
+	} else {
+		memcpy(state, r->latest.bytes, SNAPSHOT_SIZE);
+	}
+	for(i--; i >= target; i--) {
+		RewindFrame *f = getFrame(r, i);
+		applyDelta(state, r->buffer + f->offset, f->deltaSize);
+	}
+
+	r->latest = r->scratch;
+	restoreSnapshot(c, &r->latest);
+	r->end = getFrame(r, target)->offset;
+	r->count = target;
+	r->captured -= n;
+
+	// Count the frames stored after the newest keyframe left, the next one is due as many frames on
+	r->sinceKey = REWIND_KEYFRAME_INTERVAL - 1;
+	for(i = target - 1; i >= 0 && i >= target - REWIND_KEYFRAME_INTERVAL; i--) {
+		if(getFrame(r, i)->keySize != 0) {
+			r->sinceKey = target - 1 - i;
+			break;
+		}
+	}
+
+	return n;
+}
+
+// Number of frames the machine can step back
+int getRewindFrames(Rewind *r) {
+	return r->count;
+}
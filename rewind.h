@@ -0,0 +1,43 @@
+/* file rewind.h */
+
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stddef.h>
+
+#include "state.h"
+
+#define REWIND_KEYFRAME_INTERVAL 64		// Frames between full states, bounds the deltas decoded per step back
+#define REWIND_FRAME_BYTES 256			// Budget bytes per indexed frame, the rest holds the records
+
+// Where the records of one captured frame lie in the buffer
+typedef struct RewindFrame {
+	unsigned int offset;
+	unsigned int deltaSize;		// XOR delta to the next frame
+	unsigned int keySize;		// Full state on keyframes, following the delta, 0 otherwise
+} RewindFrame;
+
+// History of one machine: the state of the latest frame and, for each earlier frame still held,
+// the difference to the frame after it. Frames and record bytes are rings, the oldest frames
+// are dropped to stay within the budget.
+typedef struct Rewind {
+	Snapshot latest;
+	Snapshot scratch;
+	unsigned long long captured;	// Frames captured and not rewound, the latest is held when non-zero
+	RewindFrame *frames;
+	int maxFrames;
+	int first, count;				// Ring of the frames before the latest, oldest first
+	int sinceKey;					// Frames stored after the newest keyframe, see storeFrame()
+	unsigned char *buffer;
+	unsigned int size;
+	unsigned int end;				// Where the next record is written
+	unsigned char encoded[4 * SNAPSHOT_SIZE];	// Delta and keyframe being stored, each under 2 * SNAPSHOT_SIZE
+} Rewind;
+
+Rewind * createRewind(size_t budget);
+void destroyRewind(Rewind *r);
+void captureFrame(Rewind *r, Chip8 *c);
+int rewindFrames(Rewind *r, Chip8 *c, int n);
+int getRewindFrames(Rewind *r);
+
+#endif /* REWIND_H */
@@ -0,0 +1,110 @@
+/* file scheduler.c */
+
+/*
+ * Runs a machine at clockHz instructions per second. Instruction n is due
+ * at start + n / clockHz, computed from the start time rather than summed
+ * sleeps, so oversleeping does not accumulate into drift. The timers tick
+ * every clockHz / 60 instructions (see setClock()), which is exactly 60 Hz
+ * of wall time while the schedule is kept. With an unlimited clock
+ * instructions run back to back and the timers follow the wall clock.
+ */
+
+#include <limits.h>
+
+#include "scheduler.h"
+#include "hrtime.h"
+
+#define NANOS_PER_SECOND 1000000000ULL
+
+// A backlog larger than this (e.g. after the process was suspended) is dropped instead of run in a burst
+#define MAX_BACKLOG_NANOS (NANOS_PER_SECOND / 10)
+
+// a * b / c without overflowing for a in nanoseconds or instructions and b, c up to 2^32
+static unsigned long long scale(unsigned long long a, unsigned long long b, unsigned long long c) {
+	return a / c * b + a % c * b / c;
+}
+
+void initScheduler(Scheduler *s, Chip8 *c, unsigned int clockHz) {
+	s->c = c;
+	s->clockHz = clockHz;
+	s->start = nanoTime();
+	s->cycles = 0;
+	s->ticks = 0;
+	s->idle = 0;
+
+	setClock(c, clockHz);
+}
+
+// Runs the instructions due by now, at most one timer tick's worth so the caller can poll input
+// and publish frames at least 60 times a second, and stops early after a draw.
+// Returns the number executed, 0 if none was due.
+int runScheduler(Scheduler *s) {
+	unsigned long long elapsed = nanoTime() - s->start;
+	int executed = 0;
+
+	s->idle = 0;
+	if(s->clockHz == CLOCK_UNLIMITED) {
+		while(executed < UNLIMITED_SLICE && !s->idle) {
+			int n;
+			int reason = emulateFrame(s->c, UNLIMITED_SLICE - executed, &n);
+			s->idle = reason == FRAME_IDLE || reason == FRAME_KEY;
+			executed += n;
+		}
+		s->cycles += executed;
+
+		unsigned long long ticks = scale(elapsed, TIMER_HZ, NANOS_PER_SECOND);
+		decrementTimers(s->c, (int) (ticks - s->ticks));
+		s->ticks = ticks;
+
+		return executed;
+	}
+
+	unsigned long long due = scale(elapsed, s->clockHz, NANOS_PER_SECOND);
+	if(due <= s->cycles)
+		return 0;
+
+	// Waiting for a key the backlog costs nothing to skip, however long the wait was
+	if(isWaitingForKey(s->c) && due - s->cycles <= INT_MAX) {
+		emulateFrame(s->c, (int) (due - s->cycles), &executed);
+		s->cycles += executed;
+		s->idle = 1;
+		return executed;
+	}
+
+	if(due - s->cycles > scale(MAX_BACKLOG_NANOS, s->clockHz, NANOS_PER_SECOND))
+		s->cycles = due - 1;	// Fell behind, resume from now
+
+	unsigned long long budget = due - s->cycles;
+	if(budget > s->c->cyclesPerTick)
+		budget = s->c->cyclesPerTick;
+
+	// Return as soon as a frame is drawn so it is presented on time
+	while((unsigned long long) executed < budget) {
+		int n;
+		int reason = emulateFrame(s->c, (int) budget - executed, &n);
+		executed += n;
+		if(reason == FRAME_DRAW)
+			break;
+		s->idle = reason == FRAME_IDLE || reason == FRAME_KEY;
+	}
+	s->cycles += executed;
+
+	return executed;
+}
+
+// Sleeps until the next instruction is due. With an unlimited clock only a machine that idled
+// sleeps, until the next timer tick.
+void waitScheduler(Scheduler *s) {
+	if(s->clockHz == CLOCK_UNLIMITED) {
+		unsigned long long tick = s->start + scale(s->ticks + 1, NANOS_PER_SECOND, TIMER_HZ);
+		unsigned long long now = nanoTime();
+		if(s->idle && tick > now)
+			sleepNanos(tick - now);
+		return;
+	}
+
+	unsigned long long next = s->start + scale(s->cycles + 1, NANOS_PER_SECOND, s->clockHz);
+	unsigned long long now = nanoTime();
+	if(next > now)
+		sleepNanos(next - now);
+}
@@ -0,0 +1,25 @@
+/* file scheduler.h */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "chip8.h"
+
+// Instructions run per call with an unlimited clock
+#define UNLIMITED_SLICE 10000
+
+// Paces one machine at a fixed instruction rate from the monotonic clock
+typedef struct Scheduler {
+	Chip8 *c;
+	unsigned int clockHz;			// Instructions per second, CLOCK_UNLIMITED for as fast as possible
+	unsigned long long start;		// nanoTime() of instruction 0
+	unsigned long long cycles;		// Instructions executed (or dropped) since start
+	unsigned long long ticks;		// Timer ticks applied since start, unlimited clock only
+	int idle;						// Last slice ended idling, see skipIdle() in chip8.c
+} Scheduler;
+
+void initScheduler(Scheduler *s, Chip8 *c, unsigned int clockHz);
+int runScheduler(Scheduler *s);
+void waitScheduler(Scheduler *s);
+
+#endif /* SCHEDULER_H */
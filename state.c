@@ -0,0 +1,297 @@
+/* file state.c */
+
+/*
+ * Save states. A Snapshot is the machine state exactly as it lies at the
+ * start of Chip8, taken and restored with one memcpy, for checkpoints
+ * kept in memory. writeState()/readState() and the saveState()/loadState()
+ * file variants use a versioned little endian layout (see state.h) that
+ * does not depend on the struct layout or the host.
+ *
+ * Branches are copy on write states for trees of runs: shareMemory()
+ * keeps the machine's memory as a read only image, after which stores
+ * mark the pages they write. branchMachine() then copies the registers
+ * and only those pages, and enterBranch() copies only the pages that
+ * differ between the machine and the branch.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "state.h"
+#include "blockcache.h"
+
+_Static_assert(offsetof(Chip8, pc) == 0, "Chip8 state must start the struct");
+_Static_assert(offsetof(Chip8, keyWait) < SNAPSHOT_SIZE, "Chip8 state fields must precede the host fields");
+
+// Drops the blocks decoded from the length bytes of memory at address about to be overwritten with
+// memory, and rebuilds the host side of a restored machine
+static void beforeRestore(Chip8 *c, int address, const unsigned char *memory, int length) {
+	if(c->blockCache == NULL)
+		return;
+
+	for(int chunk = 0; chunk < length; chunk += 64) {	// Memory rarely differs, compare it in bulk
+		const unsigned char *current = c->memory + address;
+		if(memcmp(current + chunk, memory + chunk, 64) == 0)
+			continue;
+
+		for(int i = chunk; i < chunk + 64; i++) {
+			int start = i;
+			while(i < chunk + 64 && current[i] != memory[i])
+				i++;
+			if(i > start)
+				invalidateBlocks(c, address + start, i - start);
+		}
+	}
+}
+
+static void afterRestore(Chip8 *c) {
+	c->instruction = decode(c->opcode);
+	c->dirtyRows = ~0u;		// The whole restored screen is presented
+	c->staleRows = ~0u;
+	c->dirtyPages = ALL_PAGES;
+}
+
+void takeSnapshot(Chip8 *c, Snapshot *s) {
+	memcpy(s->bytes, c, SNAPSHOT_SIZE);
+}
+
+// Returns the machine to a snapshot. Only blocks decoded from memory that differs are dropped,
+// and the whole screen is reported dirty.
+void restoreSnapshot(Chip8 *c, const Snapshot *s) {
+	beforeRestore(c, 0, s->bytes + offsetof(Chip8, memory), MEMORY_SIZE);
+	memcpy(c, s->bytes, SNAPSHOT_SIZE);
+	afterRestore(c);
+}
+
+// Returns the machine to a template: a snapshot taken right after initialize() and loading a ROM,
+// on this or any other instance. The machine is left as initializing and loading again would, but
+// without the file I/O, and the blocks decoded from memory the run did not change are kept. Call
+// setSeed() afterwards for other random numbers than the template's.
+void resetToTemplate(Chip8 *c, const Snapshot *image) {
+	beforeRestore(c, 0, image->bytes + offsetof(Chip8, memory), MEMORY_SIZE);
+	memcpy(c, image->bytes, SNAPSHOT_SIZE);
+	afterRestore(c);
+	c->elided = 0;			// As initialize() leaves them
+	c->image = NULL;
+}
+
+// Keeps the machine's memory as the image its branches share. Returns NULL if out of memory.
+MemoryImage * shareMemory(Chip8 *c) {
+	MemoryImage *image = (MemoryImage*) malloc(sizeof(MemoryImage));
+	if(image == NULL) {
+		fprintf(stderr, "Error: Unable to allocate memory image\n");
+		return NULL;
+	}
+
+	memcpy(image->memory, c->memory, MEMORY_SIZE);
+	c->image = image;
+	c->dirtyPages = 0;
+
+	return image;
+}
+
+// Frees an image no machine or branch uses any more
+void destroyMemoryImage(MemoryImage *image) {
+	free(image);
+}
+
+// Takes the state of a machine whose memory is shared, copying only the pages written since.
+// Returns NULL if the memory was never shared or out of memory.
+Branch * branchMachine(Chip8 *c) {
+	if(c->image == NULL) {
+		fprintf(stderr, "Error: Machine memory is not shared, see shareMemory()\n");
+		return NULL;
+	}
+
+	int count = 0;
+	for(int p = 0; p < NUM_OF_PAGES; p++)
+		count += c->dirtyPages >> p & 1;
+
+	Branch *b = (Branch*) malloc(sizeof(Branch) + count * MEMORY_PAGE_SIZE);
+	if(b == NULL) {
+		fprintf(stderr, "Error: Unable to allocate branch\n");
+		return NULL;
+	}
+
+	b->image = c->image;
+	b->pages = c->dirtyPages;
+	memcpy(b->head, c, BRANCH_HEAD_SIZE);
+	memcpy(b->tail, (unsigned char*) c + offsetof(Chip8, memory) + MEMORY_SIZE, BRANCH_TAIL_SIZE);
+	for(int p = 0, i = 0; p < NUM_OF_PAGES; p++)
+		if(c->dirtyPages >> p & 1)
+			memcpy(b->memory[i++], c->memory + p * MEMORY_PAGE_SIZE, MEMORY_PAGE_SIZE);
+
+	return b;
+}
+
+// Returns any machine to a branch. Only the pages written on the branch or the machine since the
+// image was shared are copied (every page if the machine shares another image), and only blocks
+// decoded from memory that differs are dropped.
+void enterBranch(Chip8 *c, const Branch *b) {
+	unsigned int stale = c->image == b->image ? c->dirtyPages | b->pages : ALL_PAGES;
+
+	for(int p = 0, i = 0; p < NUM_OF_PAGES; p++) {
+		const unsigned char *page;
+		if(b->pages >> p & 1)
+			page = b->memory[i++];
+		else if(stale >> p & 1)
+			page = b->image->memory + p * MEMORY_PAGE_SIZE;
+		else
+			continue;
+
+		beforeRestore(c, p * MEMORY_PAGE_SIZE, page, MEMORY_PAGE_SIZE);
+		memcpy(c->memory + p * MEMORY_PAGE_SIZE, page, MEMORY_PAGE_SIZE);
+	}
+	memcpy(c, b->head, BRANCH_HEAD_SIZE);
+	memcpy((unsigned char*) c + offsetof(Chip8, memory) + MEMORY_SIZE, b->tail, BRANCH_TAIL_SIZE);
+
+	afterRestore(c);
+	c->image = b->image;
+	c->dirtyPages = b->pages;
+}
+
+void destroyBranch(Branch *b) {
+	free(b);
+}
+
+static unsigned char * put(unsigned char *p, unsigned long long value, int size) {
+	for(int i = 0; i < size; i++)
+		*p++ = (unsigned char) (value >> 8 * i);
+	return p;
+}
+
+static unsigned long long get(const unsigned char **p, int size) {
+	unsigned long long value = 0;
+	for(int i = size - 1; i >= 0; i--)
+		value = value << 8 | (*p)[i];
+	*p += size;
+	return value;
+}
+
+// Serializes the machine into STATE_SIZE bytes
+void writeState(Chip8 *c, unsigned char *state) {
+	unsigned char *p = state;
+	unsigned int keys = 0;
+
+	memcpy(p, STATE_MAGIC, 4);
+	p = put(p + 4, STATE_VERSION, 2);
+
+	p = put(p, c->pc, 2);
+	p = put(p, c->I, 2);
+	p = put(p, c->sp, 2);
+	p = put(p, c->opcode, 2);
+	memcpy(p, c->V, NUM_OF_REGISTERS);
+	p += NUM_OF_REGISTERS;
+	p = put(p, c->delayTimer, 1);
+	p = put(p, c->soundTimer, 1);
+	p = put(p, c->drawFlag, 1);
+	for(int i = 0; i < STACK_SIZE; i++)
+		p = put(p, c->stack[i], 2);
+
+	for(int k = 0; k < KEYPAD_SIZE; k++)
+		keys |= (c->key[k] != 0) << k;
+	p = put(p, keys, 2);
+	p = put(p, c->keyWait, 1);
+	p = put(p, c->lazyTimers, 1);
+	p = put(p, c->cyclesPerTick, 4);
+	p = put(p, c->tickCountdown, 4);
+	p = put(p, c->tickPhase, 4);
+	p = put(p, c->cycleCount, 8);
+	p = put(p, c->rng, 8);
+
+	memcpy(p, c->memory, MEMORY_SIZE);
+	p += MEMORY_SIZE;
+	for(int i = 0; i < NUM_OF_PIXEL_ROWS; i++)
+		p = put(p, c->gfx[i], 8);
+}
+
+// Restores the machine from a serialized state. Returns -1, leaving the machine untouched, if the
+// state is not one this version wrote.
+int readState(Chip8 *c, const unsigned char *state, int size) {
+	const unsigned char *p = state + 4;
+
+	if(size != STATE_SIZE || memcmp(state, STATE_MAGIC, 4) != 0) {
+		fprintf(stderr, "Error: Not a save state\n");
+		return -1;
+	}
+	if(get(&p, 2) != STATE_VERSION) {
+		fprintf(stderr, "Error: Unsupported save state version\n");
+		return -1;
+	}
+
+	unsigned short pc = (unsigned short) get(&p, 2);
+	unsigned short I = (unsigned short) get(&p, 2);
+	unsigned short sp = (unsigned short) get(&p, 2);
+	if(sp > STACK_SIZE) {	// Any pc and I are valid, fetches and accesses through I wrap around memory
+		fprintf(stderr, "Error: Save state is corrupt\n");
+		return -1;
+	}
+
+	beforeRestore(c, 0, state + STATE_SIZE - MEMORY_SIZE - 8 * NUM_OF_PIXEL_ROWS, MEMORY_SIZE);
+	c->pc = pc;
+	c->I = I;
+	c->sp = sp;
+	c->opcode = (unsigned short) get(&p, 2);
+	memcpy(c->V, p, NUM_OF_REGISTERS);
+	p += NUM_OF_REGISTERS;
+	c->delayTimer = (unsigned char) get(&p, 1);
+	c->soundTimer = (unsigned char) get(&p, 1);
+	c->drawFlag = (unsigned char) get(&p, 1);
+	for(int i = 0; i < STACK_SIZE; i++)
+		c->stack[i] = (unsigned short) get(&p, 2);
+
+	unsigned int keys = (unsigned int) get(&p, 2);
+	for(int k = 0; k < KEYPAD_SIZE; k++)
+		c->key[k] = keys >> k & 1;
+	c->keyWait = (unsigned char) get(&p, 1);
+	c->lazyTimers = get(&p, 1) != 0;
+	c->cyclesPerTick = (unsigned int) get(&p, 4);
+	c->tickCountdown = (unsigned int) get(&p, 4);
+	c->tickPhase = (unsigned int) get(&p, 4);
+	c->cycleCount = get(&p, 8);
+	c->rng = get(&p, 8);
+
+	memcpy(c->memory, p, MEMORY_SIZE);
+	p += MEMORY_SIZE;
+	for(int i = 0; i < NUM_OF_PIXEL_ROWS; i++)
+		c->gfx[i] = get(&p, 8);
+	rehashMemory(c);
+
+	afterRestore(c);
+	return 0;
+}
+
+int saveState(Chip8 *c, const char *file) {
+	unsigned char state[STATE_SIZE];
+	writeState(c, state);
+
+	FILE *fptr = fopen(file, "wb");
+	if(!fptr) {
+		fprintf(stderr, "Error: Unable to open save state file\n");
+		return -1;
+	}
+
+	int failed = fwrite(state, 1, STATE_SIZE, fptr) != STATE_SIZE;
+	if(fclose(fptr) != 0 || failed) {
+		fprintf(stderr, "Error: Unable to write save state file\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int loadState(Chip8 *c, const char *file) {
+	unsigned char state[STATE_SIZE + 1];	// One more byte to notice a longer file
+
+	FILE *fptr = fopen(file, "rb");
+	if(!fptr) {
+		fprintf(stderr, "Error: Unable to open save state file\n");
+		return -1;
+	}
+
+	int n = (int) fread(state, 1, sizeof(state), fptr);
+	fclose(fptr);
+
+	return readState(c, state, n);
+}
@@ -0,0 +1,60 @@
+/* file state.h */
+
+#ifndef STATE_H
+#define STATE_H
+
+#include <stddef.h>
+
+#include "chip8.h"
+
+// Machine state: the start of Chip8, up to the host fields
+#define SNAPSHOT_SIZE offsetof(Chip8, pixels)
+
+// Save state layout, all fields little endian:
+//  magic "C8ST", u16 version
+//  u16 pc, I, sp, opcode, u8 V0-VF, delay timer, sound timer, drawFlag, u16 stack[16]
+//  u16 keypad (bit k for key k), u8 keyWait, lazyTimers, u32 cyclesPerTick, tickCountdown, tickPhase
+//  u64 cycle count, CXNN generator state
+//  memory, u64 framebuffer rows
+#define STATE_MAGIC "C8ST"
+#define STATE_VERSION 2
+#define STATE_SIZE (6 + 8 + NUM_OF_REGISTERS + 3 + 2 * STACK_SIZE + 4 + 12 + 16 + MEMORY_SIZE + 8 * NUM_OF_PIXEL_ROWS)
+
+// In-memory state of one machine, taken and restored with a single copy
+typedef struct Snapshot {
+	_Alignas(64) unsigned char bytes[SNAPSHOT_SIZE];
+} Snapshot;
+
+// Memory of a machine as shared by shareMemory(), read only. Branches hold only the pages written
+// since, the rest are read from here.
+typedef struct MemoryImage {
+	unsigned char memory[MEMORY_SIZE];
+} MemoryImage;
+
+// Machine state around memory: the registers before it, the framebuffer and counters after it
+#define BRANCH_HEAD_SIZE offsetof(Chip8, memory)
+#define BRANCH_TAIL_SIZE (SNAPSHOT_SIZE - BRANCH_HEAD_SIZE - MEMORY_SIZE)
+
+// Copy on write state of one machine, a few hundred bytes plus its written pages
+typedef struct Branch {
+	const MemoryImage *image;
+	unsigned int pages;				// Pages held in memory, bit p for page p, in order
+	unsigned char head[BRANCH_HEAD_SIZE];
+	unsigned char tail[BRANCH_TAIL_SIZE];
+	unsigned char memory[][MEMORY_PAGE_SIZE];
+} Branch;
+
+void takeSnapshot(Chip8 *c, Snapshot *s);
+void restoreSnapshot(Chip8 *c, const Snapshot *s);
+void resetToTemplate(Chip8 *c, const Snapshot *image);
+MemoryImage * shareMemory(Chip8 *c);
+void destroyMemoryImage(MemoryImage *image);
+Branch * branchMachine(Chip8 *c);
+void enterBranch(Chip8 *c, const Branch *b);
+void destroyBranch(Branch *b);
+void writeState(Chip8 *c, unsigned char *state);
+int readState(Chip8 *c, const unsigned char *state, int size);
+int saveState(Chip8 *c, const char *file);
+int loadState(Chip8 *c, const char *file);
+
+#endif /* STATE_H */
@@ -1,670 +1,1796 @@
-/* file tests.c */
-
-#include <stdio.h>
-#include "minunit.h"
-#include "chip8.h"
-
-int tests_run = 0;
-
-// chip8 vars
-extern unsigned short opcode;
-
-extern void (*instruction)();
-
-extern unsigned char memory[MEMORY_SIZE];
-
-extern unsigned char V[NUM_OF_REGISTERS];
-extern unsigned short I;
-extern unsigned short pc;
-
-extern unsigned char gfx[NUM_OF_PIXELS];
-extern unsigned char drawFlag;
-
-extern unsigned char chip8Fontset[FONTSET_SIZE];
-
-extern unsigned char delayTimer;
-extern unsigned char soundTimer;
-
-extern unsigned short stack[STACK_SIZE];
-extern unsigned short sp;
-
-extern unsigned char key[KEYPAD_SIZE];
-
-// Tests
-static char * testInitialize() {
-	initialize();
-
-	mu_assert("error, pc != 0x200", pc == 0x200);
-	mu_assert("error, opcode != 0", opcode == 0);
-	mu_assert("error, I != 0", I == 0);
-	mu_assert("error, sp != 0", sp == 0);
-
-	for(int i = 0; i < NUM_OF_PIXELS; i++)
-		mu_assert("error, gfx[i] != NULL", gfx[i] == NULL);
-
-	for(int i = 0; i < STACK_SIZE; i++)
-		mu_assert("error, stack[i] != NULL", stack[i] == NULL);
-
-	for(int i = 0; i < NUM_OF_REGISTERS; i++)
-		mu_assert("error, V[i] != NULL", V[i] == NULL);
-
-	for(int i = 0; i < MEMORY_FONTSET; i++)
-		mu_assert("error, memory[i] != NULL (before fontset)", memory[i] == NULL);
-	for(int i = 0; i < FONTSET_SIZE; i++)
-		mu_assert("error, fontset not loaded properly", memory[MEMORY_FONTSET + i] == chip8Fontset[i]);
-	for(int i = MEMORY_PROGRAM; i < MEMORY_SIZE; i++)
-		mu_assert("error, programmable memory[i] != NULL", memory[i] == NULL);
-
-	mu_assert("error, delayTimer != 0", delayTimer == 0);
-	mu_assert("error, soundTimer != 0", soundTimer == 0);
-
-	return 0;
-}
-
-// 00E0 Display - disp_clear: Clears the screen
-static char * test00E0() {
-    for(int i = 0; i < NUM_OF_PIXELS; i++) {
-        if(i % 45 == 0)
-            gfx[i] = 1;
-    }
-
-    instr00E0();
-
-	for(int i = 0; i < NUM_OF_PIXELS; i++)
-        mu_assert("error instr00E0, gfx[i] != 0", gfx[i] == 0);
-
-    return 0;
-}
-
-// 00EE Flow - return;: Returns from a subroutine
-static char * test00EE() {
-    // IMPLEMENT
-    // Go to subroutine
-    // test return
-    return 0;
-}
-
-// 1NNN Flow - Goto NNN;: Jumps to address NNN.
-static char * test1NNN() {
-    opcode = 0x1020;
-    instr1NNN();
-    mu_assert("error instr1NNN, pc != 0x0020", pc == 0x0020);
-
-    return 0;
-}
-
-// 2NNN Flow - *(0xNNN)(): Calls subroutine at NNN
-static char * test2NNN() {
-    opcode = 0x2020;
-    pc = 10;
-    sp = 0;
-
-    instr2NNN();
-
-    mu_assert("error instr2NNN, pc != 0x0020", pc == 0x0020);
-    mu_assert("error instr2NNN, sp != 1", sp == 1);
-    mu_assert("error instr2NNN, stack[0] != 10", stack[0] == 10);
-
-    return 0;
-}
-
-// 3XNN Cond - if(Vx == NN): Skips the next instruction if Vx equals NN.
-static char * test3XNN() {
-    // Vx != NN
-    pc = 0;
-    opcode = 0x3103;
-    V[1] = 2;
-
-    instr3XNN();
-
-    mu_assert("error instr3XNN, pc != 0x0002", pc == 0x0002);
-
-    // Vx == NN
-    pc = 0;
-    opcode = 0x3102;
-
-    instr3XNN();
-
-    mu_assert("error instr3XNN, pc != 0x0004", pc == 0x0004);
-
-    return 0;
-}
-
-// 4XNN Cond - if(Vx != NN): Skips the next instruction if Vx does not equal
-static char * test4XNN() {
-    // Vx != NN
-    pc = 0;
-    opcode = 0x3103;
-    V[1] = 2;
-
-    instr4XNN();
-
-    mu_assert("error instr4XNN, pc != 0x0004", pc == 0x0004);
-
-    // Vx == NN
-    pc = 0;
-    opcode = 0x3102;
-
-    instr4XNN();
-
-    mu_assert("error instr4XNN, pc != 0x0002", pc == 0x0002);
-
-    return 0;
-}
-
-// 5XY0 Cond - if(Vx == Vy): Skips the next instruction if Vx equals Vy.
-static char * test5XY0() {
-    // Vx != Vy
-    pc = 0;
-    opcode = 0x5120;
-    V[1] = 10;
-    V[2] = 5;
-
-    instr5XY0();
-
-    mu_assert("error instr5XY0, pc != 0x0002", pc == 0x0002);
-
-    // Vx == Vy
-    pc = 0;
-    opcode = 0x5120;
-    V[1] = 90;
-    V[2] = 90;
-
-    instr5XY0();
-
-    mu_assert("error instr5XY0, pc != 0x0004", pc == 0x0004);
-
-    return 0;
-}
-
-// 6XNN Const - Vx = NN: Sets Vx to NN.
-static char * test6XNN() {
-    pc = 0;
-    opcode = 0x6340;
-    V[3] = 10;
-
-    instr6XNN();
-
-    mu_assert("error instr6XNN, V3 != 0x0040", V[3] == 0x0040);
-    mu_assert("error instr6XNN, pc != 0x0002", pc == 0x0002);
-
-    return 0;
-}
-
-// 7XNN Const - Vx += NN: Adds NN to Vx. (Carry flag is not changed)
-static char * test7XNN() {
-    pc = 0;
-    opcode = 0x7340;
-    V[3] = 0x40;
-    V[0xF] = 0;
-
-    instr7XNN();
-
-    mu_assert("error instr7XNN, V3 != 0x0080", V[3] == 0x0080);
-    mu_assert("error instr7XNN, Carry flag changed", V[0xF] == 0);
-    mu_assert("error instr7XNN, pc != 0x0002", pc == 0x0002);
-
-    return 0;
-}
-
-// 8XY0 Assign - Vx = Vy: Sets Vx to the value of Vy.
-static char * test8XY0() {
-    pc = 0;
-    opcode = 0x8230;
-    V[2] = 10;
-    V[3] = 253;
-
-    instr8XY0();
-
-    mu_assert("error instr8XY0, Unexpected val change in V3", V[3] == 253);
-    mu_assert("error instr8XY0, V2 != V3", V[2] == V[3]);
-    mu_assert("error instr8XY0, pc != 0x0002", pc == 0x0002);
-
-    return 0;
-}
-
-// 8XY1 BitOp - Vx = Vx | Vy: Sets Vx to Vx OR Vy (Bitwise OR)
-static char * test8XY1() {
-    pc = 0;
-    opcode = 0x8581;
-    V[5] = 0b0010;
-    V[8] = 0b1100;
-
-    instr8XY1();
-
-    mu_assert("error instr8XY1, Unexpected val change in V8", V[8] == 0b1100);
-    mu_assert("error instr8XY1, V5 != 0b1110", V[5] == 0b1110);
-    mu_assert("error instr8XY1, pc != 0x0002", pc == 0x0002);
-
-    return 0;
-}
-
-// 8XY2 BitOp - Vx = Vx & Vy: Sets Vx to Vx AND Vy (Bitwise AND)
-static char * test8XY2() {
-    pc = 0;
-    opcode = 0x8582;
-    V[5] = 0b0100;
-    V[8] = 0b1100;
-
-    instr8XY2();
-
-    mu_assert("error instr8XY2, Unexpected val change in V8", V[8] == 0b1100);
-    mu_assert("error instr8XY2, V5 != 0b0100", V[5] == 0b0100);
-    mu_assert("error instr8XY2, pc != 0x0002", pc == 0x0002);
-
-    return 0;
-}
-
-// 8XY3 BitOp - Vx = Vx ^ Vy: Sets Vx to Vx XOR Vy
-static char * test8XY3() {
-    pc = 0;
-    opcode = 0x8583;
-    V[5] = 0b1010;
-    V[8] = 0b0010;
-
-    instr8XY3();
-
-    mu_assert("error instr8XY2, Unexpected val change in V8", V[8] == 0b0010);
-    mu_assert("error instr8XY3, V5 != 0b1000", V[5] == 0b1000);
-    mu_assert("error instr8XY3, pc != 0x0002", pc == 0x0002);
-
-    return 0;
-}
-
-// 8XY4 Math - Vx += Vy: Adds Vy to Vx. VF is set to 1 when there's a carry, and to 0 when there isn't.
-static char * test8XY4() {
-    // No carry
-    pc = 0;
-    opcode = 0x8584;
-    V[5] = 0x10;
-    V[8] = 0x20;
-    V[0xF] = 0;
-
-    instr8XY4();
-
-    mu_assert("error instr8XY4, V5 != 0x30", V[5] == 0x30);
-    mu_assert("error instr8XY4, Unexpected val change in VF", V[0xF] == 0);
-    mu_assert("error instr8XY4, pc != 0x0002", pc == 0x0002);
-
-    // Carry
-    V[5] = 0xFF;
-    V[8] = 0x01;
-
-    instr8XY4();
-
-    mu_assert("error instr8XY4, V5 != 0x0", V[5] == 0x0);
-    mu_assert("error instr8XY4, VF not set on overflow", V[0xF] == 1);
-
-    return 0;
-}
-
-// 8XY5 Math - Vx -= Vy: Vy is subtracted from Vx. VF is set to 0 when there's a borrow and 1 when there isn't.
-static char * test8XY5() {
-    // No borrow
-    pc = 0;
-    opcode = 0x8584;
-    V[5] = 0x20;
-    V[8] = 0x10;
-    V[0xF] = 0;
-
-    instr8XY5();
-
-    mu_assert("error instr8XY5, V5 != 0x10", V[5] == 0x10);
-    mu_assert("error instr8XY5, VF = 0 on borrow", V[0xF] == 1);
-    mu_assert("error instr8XY5, pc != 0x0002", pc == 0x0002);
-
-    // Borrow
-    V[5] = 0x05;
-    V[8] = 0x07;
-
-    instr8XY5();
-
-    mu_assert("error instr8XY5, V5 != 254", V[5] == 254);
-    mu_assert("error instr8XY5, VF = 1 on borrow", V[0xF] == 0);
-
-    return 0;
-}
-
-// 8XY6 BitOp - Vx = Vy >> 1: Shifts Vy right by one and stores the result to Vx. Set register VF to the least significant bit prior to the shift
-static char * test8XY6() {
-    pc = 0;
-    opcode = 0x8236;
-    V[2] = 83;
-    V[3] = 2;
-
-    instr8XY6();
-
-    mu_assert("error instr8XY6, unexpected val change in V3", V[3] == 0x0002);
-    mu_assert("error instr8XY6, VF != 0", V[0xF] == 0);
-    mu_assert("error instr8XY6, V2 != 1", V[2] == 0x0001);
-    mu_assert("error instr8XY6, pc != 0x0002", pc == 0x0002);
-
-    V[2] = 83;
-    V[3] = 9;
-
-    instr8XY6();
-
-    mu_assert("error instr8XY6, unexpected val change in V3", V[3] == 0x0009);
-    mu_assert("error instr8XY6, VF != 1", V[0xF] == 1);
-    mu_assert("error instr8XY6, V2 != 4", V[2] == 0x0004);
-
-    return 0;
-}
-
-// 8XY7 Math - Vx = Vy - Vx: Sets Vx to Vy minus Vx. VF is set to 0 when there's a borrow and 1 when there isn't.
-static char * test8XY7() {
-    // No borrow
-    pc = 0;
-    opcode = 0x8587;
-    V[5] = 0x10;
-    V[8] = 0x20;
-    V[0xF] = 0;
-
-    instr8XY7();
-
-    mu_assert("error instr8XY7, V5 != 0x10", V[5] == 0x10);
-    mu_assert("error instr8XY7, VF = 0 on no borrow", V[0xF] == 1);
-    mu_assert("error instr8XY7, Unexpected val change in V8", V[8] == 0x20);
-    mu_assert("error instr8XY7, pc != 0x0002", pc == 0x0002);
-
-    // Borrow
-    opcode = 0x8587;
-    V[5] = 0x01;
-    V[8] = 0x00;
-    V[0xF] = 0;
-
-    instr8XY7();
-
-    mu_assert("error instr8XY7, V5 != 0xFF", V[5] == 0xFF);
-    mu_assert("error instr8XY7, VF = 1 on borrow", V[0xF] == 0);
-    mu_assert("error instr8XY7, Unexpected val change in V8", V[8] == 0x00);
-
-    return 0;
-}
-
-// 8XYE BitOp - Vx = Vy << 1: Store the value of register VY shifted left one bit in register VX. Set register VF to the most significant bit prior to the shift
-static char * test8XYE() {
-    pc = 0;
-    opcode = 0x823E;
-    V[2] = 83;
-    V[3] = 2;
-
-    instr8XYE();
-
-    mu_assert("error instr8XYE, unexpected val change in V3", V[3] == 0x0002);
-    mu_assert("error instr8XYE, VF != 0", V[0xF] == 0);
-    mu_assert("error instr8XYE, V2 != 4", V[2] == 0x0004);
-    mu_assert("error instr8XYE, pc != 0x0002", pc == 0x0002);
-
-    V[2] = 83;
-    V[3] = 128;
-
-    instr8XYE();
-
-    mu_assert("error instr8XYE, unexpected val change in V3", V[3] == 128);
-    mu_assert("error instr8XYE, VF != 1", V[0xF] == 1);
-    mu_assert("error instr8XYE, V2 != 0", V[2] == 0x0000);
-}
-
-// 9XY0 Cond - if(Vx != Vy): Skips the next instruction if Vx doesn't equal Vy.
-static char * test9XY0() {
-    // Skip
-    pc = 0;
-    opcode = 0x9120;
-    V[1] = 0x10;
-    V[2] = 0x20;
-
-    instr9XY0();
-
-    mu_assert("error instr9XY0, pc != 0x0004", pc == 0x0004);
-
-    // No skip
-    pc = 0;
-    V[1] = 0x10;
-    V[2] = 0x10;
-
-    instr9XY0();
-
-    mu_assert("error instr9XY0, pc != 0x0002", pc == 0x0002);
-
-    return 0;
-}
-
-// ANNN MEM - I = NNN: Sets I to the address NNN.
-static char * testANNN() {
-    pc = 0;
-    opcode = 0xA120;
-    I = 0x20;
-
-    instrANNN();
-
-    mu_assert("error instrANNN, I != 0x0120", I == 0x0120);
-    mu_assert("error instrANNN, pc != 0x0002", pc == 0x0002);
-
-    return 0;
-}
-
-// BNNN Flow - PC = V0 + NNN: Jumps to the address NNN plus V0.
-static char * testBNNN() {
-    pc = 0;
-    opcode = 0xB100;
-    V[0] = 0x01;
-
-    instrBNNN();
-
-    mu_assert("error instrBNNN, pc != 0x0101", pc == 0x0101);
-
-    return 0;
-}
-
-// CXNN Rand - Vx = rand() & NN: Sets Vx to the result of a bitwise AND operation on a random number and NN.
-static char * testCXNN() {
-    pc = 0;
-    opcode = 0xC180;
-    V[1] = 0x10;
-
-    instrCXNN();
-
-    mu_assert("error instrCXNN, V1 unchanged (small chance this test fails since it uses a randomised number, run again for certainty)", V[1] != 0x0010);
-    mu_assert("error instrCXNN, pc != 0x0002", pc == 0x0002);
-
-    return 0;
-}
-
-// DXYN Disp - draw(Vx, Vy, N): Draws a sprite at coordinate (VX, VY) that has a width of 8 pixels and a height of N pixels.
-static char * testDXYN() {
-    // TODO
-    return 0;
-}
-
-// EX9E KeyOp - if(key() == Vx): Skips the next instruction if the key stored in Vx is pressed.
-static char * testEX9E() {
-    // Not pressed
-    pc = 0;
-    opcode = 0xE19E;
-    V[1] = 0;
-    key[0] = 0;
-
-    instrEX9E();
-
-    mu_assert("error instrEX9E, pc != 0x0002", pc == 0x0002);
-
-    // Pressed
-    pc = 0;
-    key[0] = 1;
-
-    instrEX9E();
-
-    mu_assert("error instrEX9E, pc != 0x0004", pc == 0x0004);
-
-    return 0;
-}
-
-// EXA1 KeyOp - if(key() != Vx): Skips the next instruction if the key stored in Vx is not pressed.
-static char * testEXA1() {
-    // Not pressed
-    pc = 0;
-    opcode = 0xE3A1;
-    V[3] = 5;
-    key[5] = 0;
-
-    instrEXA1();
-
-    mu_assert("error instrEXA1, pc != 0x0004", pc == 0x0004);
-
-    // Pressed
-    pc = 0;
-    key[5] = 1;
-
-    instrEXA1();
-
-    mu_assert("error instrEXA1, pc != 0x0002", pc == 0x0002);
-
-    return 0;
-}
-
-// FX07 Timer - Vx = get_delay(): Sets Vx to the value of the delay timer.
-static char * testFX07() {
-    pc = 0;
-    opcode = 0xF707;
-    V[7] = 230;
-    delayTimer = 50;
-
-    instrFX07();
-
-    mu_assert("error instrFX07, unexpected val change in delayTimer", delayTimer == 50);
-    mu_assert("error instrFX07, V7 != 50", V[7] == 50);
-    mu_assert("error instrFX07, pc != 0x0002", pc == 0x0002);
-
-    return 0;
-}
-
-// FX0A KeyOp - Vx = get_key(): A key press is awaited, and then stored in VX.
-static char * testFX0A() {
-    // TODO
-    return 0;
-}
-
-// FX15 Timer - delay_timer(Vx): Sets the delay timer to Vx.
-static char * testFX15() {
-    pc = 0;
-    opcode = 0xF215;
-    V[2] = 89;
-    delayTimer = 100;
-
-    instrFX15();
-
-    mu_assert("error instrFX15, unexpected val change in V2", V[2] == 89);
-    mu_assert("error instrFX15, delayTimer != 89", delayTimer == 89);
-    mu_assert("error instrFX15, pc != 0x0002", pc == 0x0002);
-
-    return 0;
-}
-
-// FX18 Sound - sound_timer(Vx): Sets the sound timer to Vx.
-static char * testFX18() {
-    pc = 0;
-    opcode = 0xF215;
-    V[2] = 89;
-    soundTimer = 100;
-
-    instrFX18();
-
-    mu_assert("error instrFX18, unexpected val change in V2", V[2] == 89);
-    mu_assert("error instrFX18, soundTimer != 89", delayTimer == 89);
-    mu_assert("error instrFX18, pc != 0x0002", pc == 0x0002);
-
-    return 0;
-}
-
-// FX1E MEM - I += Vx: Adds Vx to I.
-static char * testFX1E() {
-    pc = 0;
-    opcode = 0xF91E;
-    V[9] = 10;
-    I = 255;
-
-    instrFX1E();
-
-    mu_assert("error instrFX1E, unexpected val change in V9", V[9] == 10);
-    mu_assert("error instrFX1E, I != 265", I == 265);
-    mu_assert("error instrFX1E, pc != 0x0002", pc == 0x0002);
-
-    return 0;
-}
-
-// FX29 MEM - I = sprite_addr[Vx]: Sets I to the location of the sprite for the character in Vx.
-static char * testFX29() {
-    // TODO
-    return 0;
-}
-
-// FX33 BCD: Store binary-coded decimal representation of VX at the addresses I, I + 1 and I + 2
-static char * testFX33() {
-    // TODO
-    return 0;
-}
-
-// FX55 MEM - reg_dump(Vx, &I): Stores V0 to Vx (including Vx) in memory starting at address I.
-static char * testFX55() {
-    // TODO
-    return 0;
-}
-
-// FX65 MEM - reg_load(Vx, &I): Fills V0 to Vx (including Vx) with values from memory starting at address I.
-static char * testFX65() {
-    // TODO
-    return 0;
-}
-
-static char * all_tests() {
-    mu_run_test(testInitialize);
-
-    // Instructions
-    mu_run_test(test00E0);
-    mu_run_test(test00EE);
-    mu_run_test(test1NNN);
-    mu_run_test(test2NNN);
-    mu_run_test(test3XNN);
-    mu_run_test(test4XNN);
-    mu_run_test(test5XY0);
-    mu_run_test(test6XNN);
-    mu_run_test(test7XNN);
-    mu_run_test(test8XY0);
-    mu_run_test(test8XY1);
-    mu_run_test(test8XY2);
-    mu_run_test(test8XY3);
-    mu_run_test(test8XY4);
-    mu_run_test(test8XY5);
-    mu_run_test(test8XY6);
-    mu_run_test(test8XY7);
-    mu_run_test(test8XYE);
-    mu_run_test(test9XY0);
-    mu_run_test(testANNN);
-    mu_run_test(testBNNN);
-    mu_run_test(testCXNN);
-    mu_run_test(testDXYN);
-    mu_run_test(testEX9E);
-    mu_run_test(testEXA1);
-    mu_run_test(testFX07);
-    mu_run_test(testFX0A);
-    mu_run_test(testFX15);
-    mu_run_test(testFX18);
-    mu_run_test(testFX1E);
-
-    return 0;
-}
-
-// Run tests
-int testmain(int argc, char **argv) {
-	char *result = all_tests();
-	if (result != 0) {
-		printf("%s\n", result);
-	}
-	else {
-		printf("ALL TESTS PASSED\n");
-	}
-	printf("Tests run: %d\n", tests_run);
-
-	return result != 0;
-}
+/* file tests.c */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minunit.h"
+#include "chip8.h"
+#include "lockstep.h"
+#include "rewind.h"
+#include "input.h"
+#include "state.h"
+#include "profile.h"
+#include "trace.h"
+#include "triplebuffer.h"
+
+int tests_run = 0;
+
+// chip8 vars
+extern unsigned char chip8Fontset[FONTSET_SIZE];
+
+// Machine under test
+static Chip8 chip8;
+static Chip8 *c = &chip8;
+
+// Tests
+static char * testInitialize() {
+	initialize(c);
+
+	mu_assert("error, pc != 0x200", c->pc == 0x200);
+	mu_assert("error, opcode != 0", c->opcode == 0);
+	mu_assert("error, I != 0", c->I == 0);
+	mu_assert("error, sp != 0", c->sp == 0);
+
+	for(int i = 0; i < NUM_OF_PIXEL_ROWS; i++)
+		mu_assert("error, gfx[i] != 0", c->gfx[i] == 0);
+
+	for(int i = 0; i < STACK_SIZE; i++)
+		mu_assert("error, stack[i] != NULL", c->stack[i] == NULL);
+
+	for(int i = 0; i < NUM_OF_REGISTERS; i++)
+		mu_assert("error, V[i] != NULL", c->V[i] == NULL);
+
+	for(int i = 0; i < MEMORY_FONTSET; i++)
+		mu_assert("error, memory[i] != NULL (before fontset)", c->memory[i] == NULL);
+	for(int i = 0; i < FONTSET_SIZE; i++)
+		mu_assert("error, fontset not loaded properly", c->memory[MEMORY_FONTSET + i] == chip8Fontset[i]);
+	for(int i = MEMORY_PROGRAM; i < MEMORY_SIZE; i++)
+		mu_assert("error, programmable memory[i] != NULL", c->memory[i] == NULL);
+
+	mu_assert("error, delayTimer != 0", c->delayTimer == 0);
+	mu_assert("error, soundTimer != 0", c->soundTimer == 0);
+
+	return 0;
+}
+
+// Decode table agrees with the switch decoder for every opcode
+static char * testDecodeTable() {
+    for(int i = 0; i < 65536; i++) {
+        const Instruction *in = decode(i);
+        InstructionHandler expected = decodeOpcode(i);
+
+        if(expected == NULL)
+            expected = &instrUnknown;
+
+        mu_assert("error decode, handler differs from switch decoder", in->execute == expected);
+        mu_assert("error decode, opcode not stored", in->opcode == i);
+        mu_assert("error decode, X != opcode >> 8 & 0xF", in->x == (i >> 8 & 0x0F));
+        mu_assert("error decode, Y != opcode >> 4 & 0xF", in->y == (i >> 4 & 0x0F));
+        mu_assert("error decode, N != opcode & 0xF", in->n == (i & 0x000F));
+        mu_assert("error decode, NN != opcode & 0xFF", in->nn == (i & 0x00FF));
+        mu_assert("error decode, NNN != opcode & 0xFFF", in->nnn == (i & 0x0FFF));
+    }
+
+    mu_assert("error decode, 0x1234 != instr1NNN", decode(0x1234)->execute == &instr1NNN);
+    mu_assert("error decode, 0x8AB4 != instr8XY4", decode(0x8AB4)->execute == &instr8XY4);
+    mu_assert("error decode, 0xF155 != instrFX55", decode(0xF155)->execute == &instrFX55);
+    mu_assert("error decode, 0xE1FF not unknown", decode(0xE1FF)->execute == &instrUnknown);
+
+    return 0;
+}
+
+// 00E0 Display - disp_clear: Clears the screen
+static char * test00E0() {
+    for(int i = 0; i < NUM_OF_PIXEL_ROWS; i++) {
+        if(i % 3 == 0)
+            c->gfx[i] = 0x8000000000000001ULL << (i % 45);
+    }
+
+    takeDirtyRows(c);
+    instr00E0(c, decode(c->opcode));
+
+	for(int i = 0; i < NUM_OF_PIXEL_ROWS; i++)
+        mu_assert("error instr00E0, gfx[i] != 0", c->gfx[i] == 0);
+    mu_assert("error instr00E0, dirty rows != lit rows", takeDirtyRows(c) == 0x49249249);
+
+    return 0;
+}
+
+// 00EE Flow - return;: Returns from a subroutine
+static char * test00EE() {
+    // IMPLEMENT
+    // Go to subroutine
+    // test return
+    return 0;
+}
+
+// 1NNN Flow - Goto NNN;: Jumps to address NNN.
+static char * test1NNN() {
+    c->opcode = 0x1020;
+    instr1NNN(c, decode(c->opcode));
+    mu_assert("error instr1NNN, pc != 0x0020", c->pc == 0x0020);
+
+    return 0;
+}
+
+// 2NNN Flow - *(0xNNN)(): Calls subroutine at NNN
+static char * test2NNN() {
+    c->opcode = 0x2020;
+    c->pc = 10;
+    c->sp = 0;
+
+    instr2NNN(c, decode(c->opcode));
+
+    mu_assert("error instr2NNN, pc != 0x0020", c->pc == 0x0020);
+    mu_assert("error instr2NNN, sp != 1", c->sp == 1);
+    mu_assert("error instr2NNN, stack[0] != 10", c->stack[0] == 10);
+
+    return 0;
+}
+
+// 3XNN Cond - if(Vx == NN): Skips the next instruction if Vx equals NN.
+static char * test3XNN() {
+    // Vx != NN
+    c->pc = 0;
+    c->opcode = 0x3103;
+    c->V[1] = 2;
+
+    instr3XNN(c, decode(c->opcode));
+
+    mu_assert("error instr3XNN, pc != 0x0002", c->pc == 0x0002);
+
+    // Vx == NN
+    c->pc = 0;
+    c->opcode = 0x3102;
+
+    instr3XNN(c, decode(c->opcode));
+
+    mu_assert("error instr3XNN, pc != 0x0004", c->pc == 0x0004);
+
+    return 0;
+}
+
+// 4XNN Cond - if(Vx != NN): Skips the next instruction if Vx does not equal
+static char * test4XNN() {
+    // Vx != NN
+    c->pc = 0;
+    c->opcode = 0x3103;
+    c->V[1] = 2;
+
+    instr4XNN(c, decode(c->opcode));
+
+    mu_assert("error instr4XNN, pc != 0x0004", c->pc == 0x0004);
+
+    // Vx == NN
+    c->pc = 0;
+    c->opcode = 0x3102;
+
+    instr4XNN(c, decode(c->opcode));
+
+    mu_assert("error instr4XNN, pc != 0x0002", c->pc == 0x0002);
+
+    return 0;
+}
+
+// 5XY0 Cond - if(Vx == Vy): Skips the next instruction if Vx equals Vy.
+static char * test5XY0() {
+    // Vx != Vy
+    c->pc = 0;
+    c->opcode = 0x5120;
+    c->V[1] = 10;
+    c->V[2] = 5;
+
+    instr5XY0(c, decode(c->opcode));
+
+    mu_assert("error instr5XY0, pc != 0x0002", c->pc == 0x0002);
+
+    // Vx == Vy
+    c->pc = 0;
+    c->opcode = 0x5120;
+    c->V[1] = 90;
+    c->V[2] = 90;
+
+    instr5XY0(c, decode(c->opcode));
+
+    mu_assert("error instr5XY0, pc != 0x0004", c->pc == 0x0004);
+
+    return 0;
+}
+
+// 6XNN Const - Vx = NN: Sets Vx to NN.
+static char * test6XNN() {
+    c->pc = 0;
+    c->opcode = 0x6340;
+    c->V[3] = 10;
+
+    instr6XNN(c, decode(c->opcode));
+
+    mu_assert("error instr6XNN, V3 != 0x0040", c->V[3] == 0x0040);
+    mu_assert("error instr6XNN, pc != 0x0002", c->pc == 0x0002);
+
+    return 0;
+}
+
+// 7XNN Const - Vx += NN: Adds NN to Vx. (Carry flag is not changed)
+static char * test7XNN() {
+    c->pc = 0;
+    c->opcode = 0x7340;
+    c->V[3] = 0x40;
+    c->V[0xF] = 0;
+
+    instr7XNN(c, decode(c->opcode));
+
+    mu_assert("error instr7XNN, V3 != 0x0080", c->V[3] == 0x0080);
+    mu_assert("error instr7XNN, Carry flag changed", c->V[0xF] == 0);
+    mu_assert("error instr7XNN, pc != 0x0002", c->pc == 0x0002);
+
+    return 0;
+}
+
+// 8XY0 Assign - Vx = Vy: Sets Vx to the value of Vy.
+static char * test8XY0() {
+    c->pc = 0;
+    c->opcode = 0x8230;
+    c->V[2] = 10;
+    c->V[3] = 253;
+
+    instr8XY0(c, decode(c->opcode));
+
+    mu_assert("error instr8XY0, Unexpected val change in V3", c->V[3] == 253);
+    mu_assert("error instr8XY0, V2 != V3", c->V[2] == c->V[3]);
+    mu_assert("error instr8XY0, pc != 0x0002", c->pc == 0x0002);
+
+    return 0;
+}
+
+// 8XY1 BitOp - Vx = Vx | Vy: Sets Vx to Vx OR Vy (Bitwise OR)
+static char * test8XY1() {
+    c->pc = 0;
+    c->opcode = 0x8581;
+    c->V[5] = 0b0010;
+    c->V[8] = 0b1100;
+
+    instr8XY1(c, decode(c->opcode));
+
+    mu_assert("error instr8XY1, Unexpected val change in V8", c->V[8] == 0b1100);
+    mu_assert("error instr8XY1, V5 != 0b1110", c->V[5] == 0b1110);
+    mu_assert("error instr8XY1, pc != 0x0002", c->pc == 0x0002);
+
+    return 0;
+}
+
+// 8XY2 BitOp - Vx = Vx & Vy: Sets Vx to Vx AND Vy (Bitwise AND)
+static char * test8XY2() {
+    c->pc = 0;
+    c->opcode = 0x8582;
+    c->V[5] = 0b0100;
+    c->V[8] = 0b1100;
+
+    instr8XY2(c, decode(c->opcode));
+
+    mu_assert("error instr8XY2, Unexpected val change in V8", c->V[8] == 0b1100);
+    mu_assert("error instr8XY2, V5 != 0b0100", c->V[5] == 0b0100);
+    mu_assert("error instr8XY2, pc != 0x0002", c->pc == 0x0002);
+
+    return 0;
+}
+
+// 8XY3 BitOp - Vx = Vx ^ Vy: Sets Vx to Vx XOR Vy
+static char * test8XY3() {
+    c->pc = 0;
+    c->opcode = 0x8583;
+    c->V[5] = 0b1010;
+    c->V[8] = 0b0010;
+
+    instr8XY3(c, decode(c->opcode));
+
+    mu_assert("error instr8XY2, Unexpected val change in V8", c->V[8] == 0b0010);
+    mu_assert("error instr8XY3, V5 != 0b1000", c->V[5] == 0b1000);
+    mu_assert("error instr8XY3, pc != 0x0002", c->pc == 0x0002);
+
+    return 0;
+}
+
+// 8XY4 Math - Vx += Vy: Adds Vy to Vx. VF is set to 1 when there's a carry, and to 0 when there isn't.
+static char * test8XY4() {
+    // No carry
+    c->pc = 0;
+    c->opcode = 0x8584;
+    c->V[5] = 0x10;
+    c->V[8] = 0x20;
+    c->V[0xF] = 0;
+
+    instr8XY4(c, decode(c->opcode));
+
+    mu_assert("error instr8XY4, V5 != 0x30", c->V[5] == 0x30);
+    mu_assert("error instr8XY4, Unexpected val change in VF", c->V[0xF] == 0);
+    mu_assert("error instr8XY4, pc != 0x0002", c->pc == 0x0002);
+
+    // Carry
+    c->V[5] = 0xFF;
+    c->V[8] = 0x01;
+
+    instr8XY4(c, decode(c->opcode));
+
+    mu_assert("error instr8XY4, V5 != 0x0", c->V[5] == 0x0);
+    mu_assert("error instr8XY4, VF not set on overflow", c->V[0xF] == 1);
+
+    return 0;
+}
+
+// 8XY5 Math - Vx -= Vy: Vy is subtracted from Vx. VF is set to 0 when there's a borrow and 1 when there isn't.
+static char * test8XY5() {
+    // No borrow
+    c->pc = 0;
+    c->opcode = 0x8584;
+    c->V[5] = 0x20;
+    c->V[8] = 0x10;
+    c->V[0xF] = 0;
+
+    instr8XY5(c, decode(c->opcode));
+
+    mu_assert("error instr8XY5, V5 != 0x10", c->V[5] == 0x10);
+    mu_assert("error instr8XY5, VF = 0 on borrow", c->V[0xF] == 1);
+    mu_assert("error instr8XY5, pc != 0x0002", c->pc == 0x0002);
+
+    // Borrow
+    c->V[5] = 0x05;
+    c->V[8] = 0x07;
+
+    instr8XY5(c, decode(c->opcode));
+
+    mu_assert("error instr8XY5, V5 != 254", c->V[5] == 254);
+    mu_assert("error instr8XY5, VF = 1 on borrow", c->V[0xF] == 0);
+
+    return 0;
+}
+
+// 8XY6 BitOp - Vx = Vy >> 1: Shifts Vy right by one and stores the result to Vx. Set register VF to the least significant bit prior to the shift
+static char * test8XY6() {
+    c->pc = 0;
+    c->opcode = 0x8236;
+    c->V[2] = 83;
+    c->V[3] = 2;
+
+    instr8XY6(c, decode(c->opcode));
+
+    mu_assert("error instr8XY6, unexpected val change in V3", c->V[3] == 0x0002);
+    mu_assert("error instr8XY6, VF != 0", c->V[0xF] == 0);
+    mu_assert("error instr8XY6, V2 != 1", c->V[2] == 0x0001);
+    mu_assert("error instr8XY6, pc != 0x0002", c->pc == 0x0002);
+
+    c->V[2] = 83;
+    c->V[3] = 9;
+
+    instr8XY6(c, decode(c->opcode));
+
+    mu_assert("error instr8XY6, unexpected val change in V3", c->V[3] == 0x0009);
+    mu_assert("error instr8XY6, VF != 1", c->V[0xF] == 1);
+    mu_assert("error instr8XY6, V2 != 4", c->V[2] == 0x0004);
+
+    return 0;
+}
+
+// 8XY7 Math - Vx = Vy - Vx: Sets Vx to Vy minus Vx. VF is set to 0 when there's a borrow and 1 when there isn't.
+static char * test8XY7() {
+    // No borrow
+    c->pc = 0;
+    c->opcode = 0x8587;
+    c->V[5] = 0x10;
+    c->V[8] = 0x20;
+    c->V[0xF] = 0;
+
+    instr8XY7(c, decode(c->opcode));
+
+    mu_assert("error instr8XY7, V5 != 0x10", c->V[5] == 0x10);
+    mu_assert("error instr8XY7, VF = 0 on no borrow", c->V[0xF] == 1);
+    mu_assert("error instr8XY7, Unexpected val change in V8", c->V[8] == 0x20);
+    mu_assert("error instr8XY7, pc != 0x0002", c->pc == 0x0002);
+
+    // Borrow
+    c->opcode = 0x8587;
+    c->V[5] = 0x01;
+    c->V[8] = 0x00;
+    c->V[0xF] = 0;
+
+    instr8XY7(c, decode(c->opcode));
+
+    mu_assert("error instr8XY7, V5 != 0xFF", c->V[5] == 0xFF);
+    mu_assert("error instr8XY7, VF = 1 on borrow", c->V[0xF] == 0);
+    mu_assert("error instr8XY7, Unexpected val change in V8", c->V[8] == 0x00);
+
+    return 0;
+}
+
+// 8XYE BitOp - Vx = Vy << 1: Store the value of register VY shifted left one bit in register VX. Set register VF to the most significant bit prior to the shift
+static char * test8XYE() {
+    c->pc = 0;
+    c->opcode = 0x823E;
+    c->V[2] = 83;
+    c->V[3] = 2;
+
+    instr8XYE(c, decode(c->opcode));
+
+    mu_assert("error instr8XYE, unexpected val change in V3", c->V[3] == 0x0002);
+    mu_assert("error instr8XYE, VF != 0", c->V[0xF] == 0);
+    mu_assert("error instr8XYE, V2 != 4", c->V[2] == 0x0004);
+    mu_assert("error instr8XYE, pc != 0x0002", c->pc == 0x0002);
+
+    c->V[2] = 83;
+    c->V[3] = 128;
+
+    instr8XYE(c, decode(c->opcode));
+
+    mu_assert("error instr8XYE, unexpected val change in V3", c->V[3] == 128);
+    mu_assert("error instr8XYE, VF != 1", c->V[0xF] == 1);
+    mu_assert("error instr8XYE, V2 != 0", c->V[2] == 0x0000);
+}
+
+// 9XY0 Cond - if(Vx != Vy): Skips the next instruction if Vx doesn't equal Vy.
+static char * test9XY0() {
+    // Skip
+    c->pc = 0;
+    c->opcode = 0x9120;
+    c->V[1] = 0x10;
+    c->V[2] = 0x20;
+
+    instr9XY0(c, decode(c->opcode));
+
+    mu_assert("error instr9XY0, pc != 0x0004", c->pc == 0x0004);
+
+    // No skip
+    c->pc = 0;
+    c->V[1] = 0x10;
+    c->V[2] = 0x10;
+
+    instr9XY0(c, decode(c->opcode));
+
+    mu_assert("error instr9XY0, pc != 0x0002", c->pc == 0x0002);
+
+    return 0;
+}
+
+// ANNN MEM - I = NNN: Sets I to the address NNN.
+static char * testANNN() {
+    c->pc = 0;
+    c->opcode = 0xA120;
+    c->I = 0x20;
+
+    instrANNN(c, decode(c->opcode));
+
+    mu_assert("error instrANNN, I != 0x0120", c->I == 0x0120);
+    mu_assert("error instrANNN, pc != 0x0002", c->pc == 0x0002);
+
+    return 0;
+}
+
+// BNNN Flow - PC = V0 + NNN: Jumps to the address NNN plus V0.
+static char * testBNNN() {
+    c->pc = 0;
+    c->opcode = 0xB100;
+    c->V[0] = 0x01;
+
+    instrBNNN(c, decode(c->opcode));
+
+    mu_assert("error instrBNNN, pc != 0x0101", c->pc == 0x0101);
+
+    return 0;
+}
+
+// CXNN Rand - Vx = rand() & NN: Sets Vx to the result of a bitwise AND operation on a random number and NN.
+static char * testCXNN() {
+    c->pc = 0;
+    c->opcode = 0xC180;
+    c->V[1] = 0x10;
+
+    instrCXNN(c, decode(c->opcode));
+
+    mu_assert("error instrCXNN, V1 unchanged (small chance this test fails since it uses a randomised number, run again for certainty)", c->V[1] != 0x0010);
+    mu_assert("error instrCXNN, pc != 0x0002", c->pc == 0x0002);
+
+    return 0;
+}
+
+// DXYN Disp - draw(Vx, Vy, N): Draws a sprite at coordinate (VX, VY) that has a width of 8 pixels and a height of N pixels.
+static char * testDXYN() {
+    initialize(c);
+    c->I = 0x300;
+    c->memory[0x300] = 0xF0;
+    c->memory[0x301] = 0x81;
+
+    // Two rows at (4, 2)
+    c->pc = 0;
+    c->opcode = 0xD122;
+    c->V[1] = 4;
+    c->V[2] = 2;
+    takeDirtyRows(c);
+    instrDXYN(c, decode(c->opcode));
+
+    mu_assert("error instrDXYN, pc != 0x0002", c->pc == 0x0002);
+    mu_assert("error instrDXYN, drawFlag != 1", c->drawFlag == 1);
+    mu_assert("error instrDXYN, VF != 0", c->V[0xF] == 0);
+    mu_assert("error instrDXYN, row 2 not drawn", c->gfx[2] == 0x0F00000000000000ULL);
+    mu_assert("error instrDXYN, row 3 not drawn", c->gfx[3] == 0x0810000000000000ULL);
+    mu_assert("error instrDXYN, dirty rows != rows 2 and 3", takeDirtyRows(c) == 0x0000000C);
+
+    unsigned char *pixels = getGfx(c);
+    mu_assert("error getGfx, pixel (4, 2) != 1", pixels[2 * NUM_OF_PIXEL_COLS + 4] == 1);
+    mu_assert("error getGfx, pixel (8, 2) != 0", pixels[2 * NUM_OF_PIXEL_COLS + 8] == 0);
+    mu_assert("error getGfx, pixel (11, 3) != 1", pixels[3 * NUM_OF_PIXEL_COLS + 11] == 1);
+
+    // Drawing again erases the sprite and reports the collision
+    instrDXYN(c, decode(c->opcode));
+
+    mu_assert("error instrDXYN, VF != 1", c->V[0xF] == 1);
+    mu_assert("error instrDXYN, sprite not erased", c->gfx[2] == 0 && c->gfx[3] == 0);
+
+    // Clipped at the right and bottom edges
+    takeDirtyRows(c);
+    c->V[1] = 60;
+    c->V[2] = 31;
+    instrDXYN(c, decode(c->opcode));
+
+    mu_assert("error instrDXYN, right edge not clipped", c->gfx[31] == 0x000000000000000FULL);
+    mu_assert("error instrDXYN, wrapped to the top", c->gfx[0] == 0);
+    mu_assert("error instrDXYN, dirty rows != row 31", takeDirtyRows(c) == 0x80000000);
+
+    // Start coordinates wrap
+    c->V[1] = 64 + 4;
+    c->V[2] = 32 + 2;
+    instrDXYN(c, decode(c->opcode));
+
+    mu_assert("error instrDXYN, start coordinates not wrapped", c->gfx[2] == 0x0F00000000000000ULL);
+
+    return 0;
+}
+
+// EX9E KeyOp - if(key() == Vx): Skips the next instruction if the key stored in Vx is pressed.
+static char * testEX9E() {
+    // Not pressed
+    c->pc = 0;
+    c->opcode = 0xE19E;
+    c->V[1] = 0;
+    c->key[0] = 0;
+
+    instrEX9E(c, decode(c->opcode));
+
+    mu_assert("error instrEX9E, pc != 0x0002", c->pc == 0x0002);
+
+    // Pressed
+    c->pc = 0;
+    c->key[0] = 1;
+
+    instrEX9E(c, decode(c->opcode));
+
+    mu_assert("error instrEX9E, pc != 0x0004", c->pc == 0x0004);
+
+    return 0;
+}
+
+// EXA1 KeyOp - if(key() != Vx): Skips the next instruction if the key stored in Vx is not pressed.
+static char * testEXA1() {
+    // Not pressed
+    c->pc = 0;
+    c->opcode = 0xE3A1;
+    c->V[3] = 5;
+    c->key[5] = 0;
+
+    instrEXA1(c, decode(c->opcode));
+
+    mu_assert("error instrEXA1, pc != 0x0004", c->pc == 0x0004);
+
+    // Pressed
+    c->pc = 0;
+    c->key[5] = 1;
+
+    instrEXA1(c, decode(c->opcode));
+
+    mu_assert("error instrEXA1, pc != 0x0002", c->pc == 0x0002);
+
+    return 0;
+}
+
+// FX07 Timer - Vx = get_delay(): Sets Vx to the value of the delay timer.
+static char * testFX07() {
+    c->pc = 0;
+    c->opcode = 0xF707;
+    c->V[7] = 230;
+    c->delayTimer = 50;
+
+    instrFX07(c, decode(c->opcode));
+
+    mu_assert("error instrFX07, unexpected val change in delayTimer", c->delayTimer == 50);
+    mu_assert("error instrFX07, V7 != 50", c->V[7] == 50);
+    mu_assert("error instrFX07, pc != 0x0002", c->pc == 0x0002);
+
+    return 0;
+}
+
+// FX0A KeyOp - Vx = get_key(): A key press is awaited, and then stored in VX.
+static char * testFX0A() {
+    for(int i = 0; i < KEYPAD_SIZE; i++)
+        setKey(c, i, 0);
+    c->pc = 0;
+    c->opcode = 0xF30A;
+    c->V[3] = 0;
+
+    instrFX0A(c, decode(c->opcode));
+
+    mu_assert("error instrFX0A, pc moved without a key", c->pc == 0);
+    mu_assert("error instrFX0A, not waiting for a key", isWaitingForKey(c));
+
+    setKey(c, 0xB, 1);
+    mu_assert("error instrFX0A, key press did not end the wait", !isWaitingForKey(c));
+
+    instrFX0A(c, decode(c->opcode));
+    setKey(c, 0xB, 0);
+
+    mu_assert("error instrFX0A, V3 != 0xB", c->V[3] == 0xB);
+    mu_assert("error instrFX0A, pc != 0x0002", c->pc == 0x0002);
+
+    return 0;
+}
+
+// FX15 Timer - delay_timer(Vx): Sets the delay timer to Vx.
+static char * testFX15() {
+    c->pc = 0;
+    c->opcode = 0xF215;
+    c->V[2] = 89;
+    c->delayTimer = 100;
+
+    instrFX15(c, decode(c->opcode));
+
+    mu_assert("error instrFX15, unexpected val change in V2", c->V[2] == 89);
+    mu_assert("error instrFX15, delayTimer != 89", c->delayTimer == 89);
+    mu_assert("error instrFX15, pc != 0x0002", c->pc == 0x0002);
+
+    return 0;
+}
+
+// FX18 Sound - sound_timer(Vx): Sets the sound timer to Vx.
+static char * testFX18() {
+    c->pc = 0;
+    c->opcode = 0xF215;
+    c->V[2] = 89;
+    c->soundTimer = 100;
+
+    instrFX18(c, decode(c->opcode));
+
+    mu_assert("error instrFX18, unexpected val change in V2", c->V[2] == 89);
+    mu_assert("error instrFX18, soundTimer != 89", c->delayTimer == 89);
+    mu_assert("error instrFX18, pc != 0x0002", c->pc == 0x0002);
+
+    return 0;
+}
+
+// FX1E MEM - I += Vx: Adds Vx to I.
+static char * testTimers() {
+    setClock(c, DEFAULT_CLOCK_HZ);
+    c->delayTimer = 20;
+    c->soundTimer = 0;
+
+    for(int i = 0; i < 9; i++)
+        updateTimers(c);
+    mu_assert("error timers, delayTimer ticked before 10 instructions", c->delayTimer == 20);
+    updateTimers(c);
+    mu_assert("error timers, delayTimer != 19 after 10 instructions", c->delayTimer == 19);
+
+    tickTimers(c, 25);
+    mu_assert("error timers, tickTimers(25) != 2 ticks", c->delayTimer == 17);
+    for(int i = 0; i < 4; i++)
+        updateTimers(c);
+    mu_assert("error timers, tickTimers left the wrong countdown", c->delayTimer == 17);
+    updateTimers(c);
+    mu_assert("error timers, delayTimer != 16", c->delayTimer == 16);
+
+    tickTimers(c, 1000);
+    mu_assert("error timers, delayTimer did not stop at 0", c->delayTimer == 0);
+
+    return 0;
+}
+
+static char * testFX1E() {
+    c->pc = 0;
+    c->opcode = 0xF91E;
+    c->V[9] = 10;
+    c->I = 255;
+
+    instrFX1E(c, decode(c->opcode));
+
+    mu_assert("error instrFX1E, unexpected val change in V9", c->V[9] == 10);
+    mu_assert("error instrFX1E, I != 265", c->I == 265);
+    mu_assert("error instrFX1E, pc != 0x0002", c->pc == 0x0002);
+
+    return 0;
+}
+
+// FX29 MEM - I = sprite_addr[Vx]: Sets I to the location of the sprite for the character in Vx.
+static char * testFX29() {
+    // TODO
+    return 0;
+}
+
+// FX33 BCD: Store binary-coded decimal representation of VX at the addresses I, I + 1 and I + 2
+static char * testFX33() {
+    // TODO
+    return 0;
+}
+
+// FX55 MEM - reg_dump(Vx, &I): Stores V0 to Vx (including Vx) in memory starting at address I.
+static char * testFX55() {
+    // TODO
+    return 0;
+}
+
+// FX65 MEM - reg_load(Vx, &I): Fills V0 to Vx (including Vx) with values from memory starting at address I.
+static char * testFX65() {
+    // TODO
+    return 0;
+}
+
+// Engines
+
+// Runs a draw/ALU/BCD/call loop
+static const unsigned short loopProgram[] = {
+    0x6000, 0x6100, 0x6205, 0xF029, 0xD125, 0x7001, 0x8014, 0x7108,
+    0x4140, 0x6100, 0xA300, 0xF033, 0xA310, 0xF355, 0xA310, 0xF365,
+    0x2230, 0x3003, 0x1206, 0x1204, 0x0000, 0x0000, 0x0000, 0x0000,
+    0x8346, 0x834E, 0xC30F, 0x8235, 0x8237, 0x6205, 0xF31E, 0x00EE
+};
+
+// On its 20th pass patches its own loop body from 7301 (V3 += 1) to 7305 (V3 += 5) with FX55
+static const unsigned short selfModifyingProgram[] = {
+    0x6073, 0x6105, 0x6300, 0x6400, 0x7301, 0x7401, 0x3414, 0x1214,
+    0xA208, 0xF155, 0x3428, 0x1208, 0x1218
+};
+
+// Sets the timers, then polls the delay timer with FX07 until it runs out
+static const unsigned short timerProgram[] = {
+    0x6A1F, 0x6CFF, 0xFA15, 0xFC18, 0xF107, 0x8B14, 0x3100, 0x1208,
+    0x7A03, 0x1204
+};
+
+typedef struct MachineState {
+    unsigned short pc, I, sp;
+    unsigned char V[NUM_OF_REGISTERS];
+    unsigned short stack[STACK_SIZE];
+    unsigned char delayTimer, soundTimer;
+    unsigned long hash;     // memory and gfx
+} MachineState;
+
+static MachineState blockStates[256];
+static int blockEnds[256];
+
+static void loadProgram(const unsigned short *program, int length) {
+    initialize(c);
+    for(int i = 0; i < length; i++) {
+        c->memory[MEMORY_PROGRAM + 2 * i] = program[i] >> 8;
+        c->memory[MEMORY_PROGRAM + 2 * i + 1] = program[i] & 0xFF;
+    }
+    rehashMemory(c);
+}
+
+static void captureState(MachineState *s) {
+    s->pc = c->pc;
+    s->I = c->I;
+    s->sp = c->sp;
+    for(int i = 0; i < NUM_OF_REGISTERS; i++)
+        s->V[i] = c->V[i];
+    for(int i = 0; i < STACK_SIZE; i++)
+        s->stack[i] = c->stack[i];
+    s->delayTimer = c->delayTimer;
+    s->soundTimer = c->soundTimer;
+
+    s->hash = 5381;
+    for(int i = 0; i < MEMORY_SIZE; i++)
+        s->hash = s->hash * 33 + c->memory[i];
+    for(int i = 0; i < NUM_OF_PIXEL_ROWS; i++)
+        s->hash = s->hash * 33 + c->gfx[i];
+}
+
+static int sameState(const MachineState *a, const MachineState *b) {
+    if(a->pc != b->pc || a->I != b->I || a->sp != b->sp || a->hash != b->hash)
+        return 0;
+    if(a->delayTimer != b->delayTimer || a->soundTimer != b->soundTimer)
+        return 0;
+    for(int i = 0; i < NUM_OF_REGISTERS; i++)
+        if(a->V[i] != b->V[i])
+            return 0;
+    for(int i = 0; i < STACK_SIZE; i++)
+        if(a->stack[i] != b->stack[i])
+            return 0;
+    return 1;
+}
+
+// Runs a program with the given engine, then checks the interpreter reaches the same state after every step
+static char * compareWithInterpreter(int e, const unsigned short *program, int length) {
+    MachineState reference;
+    int executed = 0;
+
+    loadProgram(program, length);
+    setEngine(c, e);
+    for(int i = 0; i < 256; i++) {
+        executed += emulate(c);
+        blockEnds[i] = executed;
+        captureState(&blockStates[i]);
+    }
+
+    loadProgram(program, length);
+    setEngine(c, ENGINE_INTERPRETER);
+    executed = 0;
+    for(int i = 0; i < 256; i++) {
+        while(executed < blockEnds[i])
+            executed += emulate(c);
+        captureState(&reference);
+        mu_assert("error engine, state differs from interpreter", sameState(&reference, &blockStates[i]));
+    }
+
+    return 0;
+}
+
+// Stale blocks must not survive the FX55 store into the loop
+static char * runSelfModifying(int e) {
+    loadProgram(selfModifyingProgram, sizeof(selfModifyingProgram) / 2);
+    setEngine(c, e);
+    for(int i = 0; i < 256; i++)
+        emulate(c);
+    setEngine(c, ENGINE_INTERPRETER);
+
+    mu_assert("error engine, V4 != 40", c->V[4] == 40);
+    mu_assert("error engine, self-modified code not re-decoded", c->V[3] == 120);
+
+    return 0;
+}
+
+static char * testBlockCache() {
+    char *message = compareWithInterpreter(ENGINE_BLOCK_CACHE, loopProgram, sizeof(loopProgram) / 2);
+    if(message)
+        return message;
+
+    message = runSelfModifying(ENGINE_BLOCK_CACHE);
+    if(message)
+        return message;
+
+    return compareWithInterpreter(ENGINE_BLOCK_CACHE, selfModifyingProgram, sizeof(selfModifyingProgram) / 2);
+}
+
+static char * testJit() {
+    char *message = compareWithInterpreter(ENGINE_JIT, loopProgram, sizeof(loopProgram) / 2);
+    if(message)
+        return message;
+
+    message = runSelfModifying(ENGINE_JIT);
+    if(message)
+        return message;
+
+    return compareWithInterpreter(ENGINE_JIT, selfModifyingProgram, sizeof(selfModifyingProgram) / 2);
+}
+
+// No block starts where a whole instruction does not fit before the end of memory, the block
+// engines step that one as the interpreter does
+static char * testBlockBounds() {
+    for(int e = ENGINE_BLOCK_CACHE; e <= ENGINE_JIT; e++) {
+        loadProgram(loopProgram, sizeof(loopProgram) / 2);
+        setEngine(c, e);
+        c->memory[MEMORY_SIZE - 1] = 0x12;  // 1200, the fetch wraps to address 0 for the low byte
+        c->memory[0] = 0x00;
+        c->pc = MEMORY_SIZE - 1;
+        mu_assert("error block bounds, block past the end of memory", getBlock(c, MEMORY_SIZE - 1) == NULL && getBlock(c, MEMORY_SIZE) == NULL);
+        mu_assert("error block bounds, instruction at the last byte not stepped", emulate(c) == 1 && c->pc == 0x200);
+        c->memory[0xFE] = 0x12;             // 1200 again, from 0x10FE where BNNN can jump
+        c->memory[0xFF] = 0x00;
+        c->pc = 0x10FE;
+        mu_assert("error block bounds, instruction past the end of memory not wrapped", emulate(c) == 1 && c->pc == 0x200);
+    }
+    setEngine(c, ENGINE_INTERPRETER);
+
+    return 0;
+}
+
+#ifdef PROFILE
+// Runs loopProgram for at least cycles instructions with a fresh profile. Returns the number executed.
+static int runProfiled(int e, int cycles) {
+    int executed = 0;
+
+    free(c->profile);
+    c->profile = NULL;
+    loadProgram(loopProgram, sizeof(loopProgram) / 2);
+    setEngine(c, e);
+    while(executed < cycles)
+        executed += emulate(c);
+    setEngine(c, ENGINE_INTERPRETER);
+
+    return executed;
+}
+
+// Every engine counts each instruction it runs once, at its address
+static char * testProfile() {
+    static unsigned long long counts[MEMORY_SIZE];
+    const int engines[] = { ENGINE_BLOCK_CACHE, ENGINE_JIT };
+
+    for(int e = 0; e < 2; e++) {
+        int executed = runProfiled(engines[e], 5000);
+        mu_assert("error profile, total != instructions executed", c->profile->total == (unsigned long long) executed);
+        for(int a = 0; a < MEMORY_SIZE; a++)
+            counts[a] = c->profile->addresses[a];
+
+        runProfiled(ENGINE_INTERPRETER, executed);
+        mu_assert("error profile, interpreter total != instructions executed", c->profile->total == (unsigned long long) executed);
+        for(int a = 0; a < MEMORY_SIZE; a++)
+            mu_assert("error profile, address count differs from interpreter", c->profile->addresses[a] == counts[a]);
+    }
+
+    free(c->profile);
+    c->profile = NULL;
+    loadProgram(timerProgram, sizeof(timerProgram) / 2);
+    setClock(c, DEFAULT_CLOCK_HZ);
+    int n;
+    emulateFrame(c, 1000, &n);
+    mu_assert("error profile, emulateFrame total != instructions executed", c->profile->total == (unsigned long long) n);
+    free(c->profile);
+    c->profile = NULL;
+
+    return 0;
+}
+#endif /* PROFILE */
+
+#ifdef TRACE
+#define TRACE_TEST_FILE "trace_test.bin"
+
+// Every engine records the same instructions and registers as the interpreter, and an unknown
+// opcode stops the trace with it as the last entry and dumps it
+static char * testTrace() {
+    static TraceEntry reference[TRACE_ENTRIES];
+    const unsigned short faultProgram[] = { 0x6005, 0x7001, 0x3008, 0x1202, 0xF0FF };
+    const int engines[] = { ENGINE_BLOCK_CACHE, ENGINE_JIT };
+
+    for(int e = 0; e < 2; e++) {
+        int executed = 0;
+        loadProgram(loopProgram, sizeof(loopProgram) / 2);
+        mu_assert("error trace, startTrace failed", startTrace(c, TRACE_TEST_FILE) == 0);
+        setEngine(c, engines[e]);
+        while(executed < 3 * TRACE_ENTRIES / 2)     // Wraps around the ring
+            executed += emulate(c);
+        mu_assert("error trace, cycle != instructions executed", c->trace->cycle == (unsigned long long) executed);
+        for(int i = 0; i < TRACE_ENTRIES; i++)
+            reference[i] = c->trace->entries[i];
+
+        loadProgram(loopProgram, sizeof(loopProgram) / 2);
+        startTrace(c, TRACE_TEST_FILE);
+        setEngine(c, ENGINE_INTERPRETER);
+        for(int i = 0; i < executed; i++)
+            emulate(c);
+        for(int i = 0; i < TRACE_ENTRIES; i++)
+            mu_assert("error trace, entry differs from interpreter", memcmp(&reference[i], &c->trace->entries[i], sizeof(TraceEntry)) == 0);
+    }
+
+    loadProgram(faultProgram, sizeof(faultProgram) / 2);
+    startTrace(c, TRACE_TEST_FILE);
+    for(int i = 0; i < 12; i++)
+        emulateCycle(c);
+    Trace *t = c->trace;
+    mu_assert("error trace, fault not flagged", t->flags & TRACE_FAULTED);
+    mu_assert("error trace, recorded past the fault", t->cycle == 1 + 3 + 3 + 2 + 1);
+    mu_assert("error trace, last entry not the unknown opcode", t->entries[t->cycle - 1].opcode == 0xF0FF && t->entries[t->cycle - 1].pc == 0x208);
+    mu_assert("error trace, V0 not recorded", t->entries[t->cycle - 2].vx == 8);
+
+    unsigned char header[TRACE_HEADER_SIZE];
+    FILE *dump = fopen(TRACE_TEST_FILE, "rb");
+    mu_assert("error trace, not dumped on fault", dump != NULL);
+    int read = (int) fread(header, 1, TRACE_HEADER_SIZE, dump);
+    fseek(dump, 0, SEEK_END);
+    long size = ftell(dump);
+    fclose(dump);
+    remove(TRACE_TEST_FILE);
+    mu_assert("error trace, bad dump header", read == TRACE_HEADER_SIZE && memcmp(header, TRACE_MAGIC, 4) == 0 && header[8] == t->cycle);
+    mu_assert("error trace, bad dump size", size == TRACE_HEADER_SIZE + (long) t->cycle * TRACE_ENTRY_SIZE);
+    stopTrace(c);
+
+    return 0;
+}
+#endif /* TRACE */
+
+// Runs at least cycles instructions with the current engine, lazy timers synced for captureState()
+static void runFor(int cycles) {
+    for(int n = 0; n < cycles; )
+        n += emulate(c);
+    syncTimers(c);
+}
+
+// Restoring a snapshot and running again repeats the run, on every engine. The self-modifying
+// program patches its code after the snapshot, so stale blocks must be dropped on restore.
+static char * testSnapshot() {
+    static Snapshot snapshot;
+    const unsigned short *programs[] = { selfModifyingProgram, timerProgram };
+    const int lengths[] = { sizeof(selfModifyingProgram) / 2, sizeof(timerProgram) / 2 };
+    MachineState first, second;
+
+    for(int p = 0; p < 2; p++) {
+        for(int e = ENGINE_INTERPRETER; e <= ENGINE_JIT; e++) {
+            for(int lazy = 0; lazy <= 1; lazy++) {
+                loadProgram(programs[p], lengths[p]);
+                setEngine(c, e);
+                setLazyTimers(c, lazy);
+                runFor(50);
+                takeSnapshot(c, &snapshot);
+                runFor(400);
+                captureState(&first);
+
+                restoreSnapshot(c, &snapshot);
+                mu_assert("error snapshot, restored screen not reported", takeDirtyRows(c) == ~0u);
+                mu_assert("error snapshot, drawFlag not restored", c->drawFlag == snapshot.bytes[offsetof(Chip8, drawFlag)]);
+                runFor(400);
+                captureState(&second);
+                setEngine(c, ENGINE_INTERPRETER);
+                mu_assert("error snapshot, run after restore differs", sameState(&first, &second));
+            }
+        }
+    }
+
+    return 0;
+}
+
+// A saved state loaded over another program resumes the same run, and states from another
+// version or of the wrong size are refused without touching the machine
+static char * testSaveState() {
+    static unsigned char state[STATE_SIZE];
+    MachineState first, second;
+
+    loadProgram(timerProgram, sizeof(timerProgram) / 2);
+    setLazyTimers(c, 1);
+    setKey(c, 3, 1);
+    runFor(40);
+    mu_assert("error saveState, save failed", saveState(c, "state_test.bin") == 0);
+    writeState(c, state);
+    runFor(300);
+    captureState(&first);
+
+    loadProgram(loopProgram, sizeof(loopProgram) / 2);
+    runFor(100);
+    int loaded = loadState(c, "state_test.bin");
+    remove("state_test.bin");
+    mu_assert("error loadState, load failed", loaded == 0);
+    mu_assert("error loadState, keypad not restored", c->key[3] == 1 && c->key[2] == 0);
+    runFor(300);
+    captureState(&second);
+    mu_assert("error loadState, run after load differs", sameState(&first, &second));
+
+    unsigned short pc = c->pc;
+    state[4]++;     // Version
+    mu_assert("error readState, other version accepted", readState(c, state, STATE_SIZE) == -1);
+    state[4]--;
+    mu_assert("error readState, truncated state accepted", readState(c, state, STATE_SIZE - 1) == -1);
+    mu_assert("error readState, machine changed by a refused state", c->pc == pc);
+
+    // FX1E can leave I past the end of memory, where stores wrap around, and the fetch wraps at 0xFFF
+    c->I = 0xFFFE;
+    c->pc = MEMORY_SIZE - 1;
+    c->drawFlag = 1;
+    writeState(c, state);
+    c->I = 0;
+    c->pc = pc;
+    c->drawFlag = 0;
+    mu_assert("error readState, I past the end of memory refused", readState(c, state, STATE_SIZE) == 0 && c->I == 0xFFFE);
+    mu_assert("error readState, pc at the last byte of memory refused", c->pc == MEMORY_SIZE - 1);
+    mu_assert("error readState, drawFlag not restored", c->drawFlag == 1);
+    c->V[0] = 0xAA;
+    c->V[1] = 0xBB;
+    c->V[2] = 0xCC;
+    instrFX55(c, decode(0xF255));
+    mu_assert("error FX55, stores past the end of memory not wrapped", c->memory[0xFFE] == 0xAA && c->memory[0xFFF] == 0xBB && c->memory[0] == 0xCC);
+    mu_assert("error FX55, state hash not kept across the wrap", getStateHash(c) == computeStateHash(c));
+    setKey(c, 3, 0);
+    setLazyTimers(c, 0);
+
+    return 0;
+}
+
+// Stepping back lands on the state captured that many frames earlier, across keyframes, after
+// the oldest frames were dropped to stay within the budget and after capturing again past a rewind
+static char * testRewind() {
+    static MachineState states[700];
+    const int steps[] = { 1, 10, 70, 3, 64 };
+    MachineState now;
+    int f;
+
+    Rewind *r = createRewind(64 * 1024);
+    mu_assert("error rewind, allocation failed", r != NULL);
+    loadProgram(loopProgram, sizeof(loopProgram) / 2);
+    setEngine(c, ENGINE_BLOCK_CACHE);
+    for(f = 0; f < 600; f++) {
+        runFor(37);
+        captureFrame(r, c);
+        captureState(&states[f]);
+    }
+    f--;
+    mu_assert("error rewind, history not bounded", getRewindFrames(r) > 150 && getRewindFrames(r) <= 64 * 1024 / REWIND_FRAME_BYTES);
+
+    for(int i = 0; i < 5; i++) {
+        f -= rewindFrames(r, c, steps[i]);
+        captureState(&now);
+        mu_assert("error rewind, state differs from the frame stepped back to", sameState(&now, &states[f]));
+        if(i == 2) {
+            for(int k = 0; k < 20; k++) {
+                runFor(37);
+                captureFrame(r, c);
+                captureState(&states[++f]);
+            }
+        }
+    }
+
+    // Keyframes stay at most REWIND_KEYFRAME_INTERVAL frames apart however the history is rewound
+    for(int i = 0; i < 40; i++) {
+        f -= rewindFrames(r, c, 1 + i * 7 % 50);
+        for(int k = 0; k < 3 + i % 30; k++) {
+            runFor(37);
+            captureFrame(r, c);
+            captureState(&states[++f]);
+        }
+        int next = getRewindFrames(r);  // The latest frame is held whole
+        for(int j = next - 1; j >= 0; j--) {
+            if(r->frames[(r->first + j) % r->maxFrames].keySize != 0)
+                next = j;
+            mu_assert("error rewind, keyframes too far apart", next - j <= REWIND_KEYFRAME_INTERVAL);
+        }
+    }
+    captureState(&now);
+    mu_assert("error rewind, state differs after rewinding and capturing again", sameState(&now, &states[f]));
+
+    int held = getRewindFrames(r);
+    mu_assert("error rewind, history not fully rewound", rewindFrames(r, c, 100000) == held && getRewindFrames(r) == 0);
+    captureState(&now);
+    mu_assert("error rewind, oldest frame differs", sameState(&now, &states[f - held]));
+    setEngine(c, ENGINE_INTERPRETER);
+    destroyRewind(r);
+
+    return 0;
+}
+
+// Draws a random number and counts the passes with key V0 down, V0 alternating between keys 0 and 1.
+// The key is read at the end of a long block.
+static const unsigned short inputProgram[] = {
+    0xC3FF, 0x8134, 0x7401, 0x7401, 0x7401, 0x7401, 0x7401, 0x7401,
+    0xE09E, 0x1216, 0x7201, 0x7001, 0x6E01, 0x80E2, 0xA300, 0xF255,
+    0x1200
+};
+
+// The same seed draws the same numbers. A recorded run, keys set between frames of the interpreter
+// and so inside blocks, replays to the same state and cycle on every engine, also from the saved log.
+static char * testInputReplay() {
+    MachineState recorded, replayed;
+    unsigned char drawn[16];
+    int n;
+
+    loadProgram(loopProgram, sizeof(loopProgram) / 2);
+    setSeed(c, 7);
+    for(int i = 0; i < 16; i++) {
+        instrCXNN(c, decode(0xC0FF));
+        drawn[i] = c->V[0];
+    }
+    setSeed(c, 7);
+    for(int i = 0; i < 16; i++) {
+        instrCXNN(c, decode(0xC0FF));
+        mu_assert("error setSeed, same seed drew other numbers", c->V[0] == drawn[i]);
+    }
+
+    loadProgram(inputProgram, sizeof(inputProgram) / 2);
+    setKey(c, 2, 1);
+    setSeed(c, 99);
+    InputLog *log = createInputLog(c);
+    mu_assert("error input log, allocation failed", log != NULL);
+    for(int frame = 0; frame < 300; frame++) {
+        emulateFrame(c, 37, &n);
+        recordKey(log, c, frame & 1, frame / 2 & 1);
+    }
+    unsigned long long cycles = c->cycleCount;
+    captureState(&recorded);
+    mu_assert("error input log, keys not counted", c->V[2] != 0);
+    mu_assert("error saveInputLog, save failed", saveInputLog(log, "input_test.bin") == 0);
+    InputLog *loaded = loadInputLog("input_test.bin");
+    remove("input_test.bin");
+    mu_assert("error loadInputLog, load failed", loaded != NULL && loaded->size == log->size);
+
+    for(int e = ENGINE_INTERPRETER; e <= ENGINE_JIT; e++) {
+        loadProgram(inputProgram, sizeof(inputProgram) / 2);
+        setKey(c, 2, 0);
+        setEngine(c, e);
+        startReplay(e == ENGINE_JIT ? loaded : log, c);
+        mu_assert("error replayInput, replay halted", replayInput(e == ENGINE_JIT ? loaded : log, c, cycles) == FRAME_DONE);
+        captureState(&replayed);
+        mu_assert("error replayInput, replay stopped on another cycle", c->cycleCount == cycles);
+        mu_assert("error replayInput, replay differs from the recorded run", sameState(&replayed, &recorded));
+    }
+
+    static const unsigned short haltProgram[] = { 0x6001, 0xFFFF };
+    loadProgram(haltProgram, 2);
+    startReplay(log, c);
+    mu_assert("error replayInput, unknown opcode not stopping the replay", replayInput(log, c, cycles) == FRAME_HALT && c->pc == 0x202 && c->cycleCount < cycles);
+
+    for(int k = 0; k < KEYPAD_SIZE; k++)
+        setKey(c, k, 0);
+    setEngine(c, ENGINE_INTERPRETER);
+    destroyInputLog(log);
+    destroyInputLog(loaded);
+
+    return 0;
+}
+
+// A reset to a template repeats the run of a freshly loaded machine, on the same instance after a
+// run that patched its code (the stale blocks are dropped) and on another instance
+static char * testTemplateReset() {
+    static Snapshot image;
+    MachineState fresh, reset;
+
+    loadProgram(selfModifyingProgram, sizeof(selfModifyingProgram) / 2);
+    setKey(c, 4, 1);
+    setEngine(c, ENGINE_JIT);
+    takeSnapshot(c, &image);
+    runFor(3000);
+    captureState(&fresh);
+    unsigned long long cycles = c->cycleCount;
+    setKey(c, 4, 0);
+
+    for(int i = 0; i < 2; i++) {
+        Chip8 *first = c;
+        if(i == 1) {
+            c = createChip8();
+            mu_assert("error template, allocation failed", c != NULL);
+            setEngine(c, ENGINE_BLOCK_CACHE);
+        }
+        MemoryImage *shared = shareMemory(c);
+        mu_assert("error template, sharing memory failed", shared != NULL && c->image == shared);
+        resetToTemplate(c, &image);
+        destroyMemoryImage(shared);
+        mu_assert("error template, host counters not reset", c->elided == 0 && c->dirtyRows == ~0u && !c->drawFlag);
+        mu_assert("error template, shared memory image kept", c->image == NULL);
+        mu_assert("error template, keypad not reset", c->key[4] == 1);
+        runFor(3000);
+        captureState(&reset);
+        mu_assert("error template, run after reset differs", sameState(&fresh, &reset) && c->cycleCount == cycles);
+        if(i == 1) {
+            destroyChip8(c);
+            c = first;
+        }
+    }
+    setKey(c, 4, 0);
+    setEngine(c, ENGINE_INTERPRETER);
+
+    return 0;
+}
+
+// A branch holds only the pages written since memory was shared, and entering it on this or
+// another instance repeats the run from there. The self-modifying program patches its code after
+// the root branch, so stale blocks must be dropped on entering it.
+static char * testBranches() {
+    const unsigned short *programs[] = { loopProgram, selfModifyingProgram };
+    const int lengths[] = { sizeof(loopProgram) / 2, sizeof(selfModifyingProgram) / 2 };
+    MachineState loaded, first, second, now;
+
+    for(int k = 0; k < 2; k++) {
+        loadProgram(programs[k], lengths[k]);
+        setEngine(c, ENGINE_JIT);
+        MemoryImage *image = shareMemory(c);
+        Branch *root = branchMachine(c);
+        captureState(&loaded);
+        mu_assert("error branch, no image", image != NULL && c->dirtyPages == 0 && root->pages == 0);
+        runFor(300);
+        Branch *early = branchMachine(c);
+        captureState(&first);
+        runFor(700);
+        Branch *late = branchMachine(c);
+        captureState(&second);
+        mu_assert("error branch, allocation failed", early != NULL && late != NULL);
+        if(k == 0)
+            mu_assert("error branch, pages not written copied", early->pages == 1u << 3 && late->pages == 1u << 3);
+        else
+            mu_assert("error branch, patched page not copied", late->pages == 1u << 2);
+
+        enterBranch(c, early);
+        captureState(&now);
+        mu_assert("error enterBranch, state differs from the branch", sameState(&now, &first));
+        runFor(700);
+        captureState(&now);
+        mu_assert("error enterBranch, run from the branch differs", sameState(&now, &second));
+
+        Chip8 *original = c;
+        c = createChip8();
+        mu_assert("error branch, allocation failed", c != NULL);
+        setEngine(c, ENGINE_BLOCK_CACHE);
+        enterBranch(c, late);
+        captureState(&now);
+        mu_assert("error enterBranch, other instance differs from the branch", sameState(&now, &second));
+        enterBranch(c, early);
+        runFor(700);
+        captureState(&now);
+        mu_assert("error enterBranch, run on other instance differs", sameState(&now, &second));
+        destroyChip8(c);
+        c = original;
+
+        enterBranch(c, root);
+        captureState(&now);
+        mu_assert("error enterBranch, written pages not restored from the image", sameState(&now, &loaded));
+        runFor(300);
+        captureState(&now);
+        mu_assert("error enterBranch, run from the root differs", sameState(&now, &first));
+        setEngine(c, ENGINE_INTERPRETER);
+        destroyBranch(root);
+        destroyBranch(early);
+        destroyBranch(late);
+        destroyMemoryImage(image);
+    }
+
+    initialize(c);
+    mu_assert("error branch, image kept after initialize", c->image == NULL && c->dirtyPages == ALL_PAGES);
+
+    return 0;
+}
+
+// The state hash kept as memory and the framebuffer are written matches hashing from scratch, on
+// every engine, after loading and after restoring a state
+static char * testStateHash() {
+    static Snapshot image, snapshot;
+    static unsigned char state[STATE_SIZE];
+    unsigned char rom[sizeof(loopProgram)];
+    const unsigned short *programs[] = { loopProgram, selfModifyingProgram, inputProgram };
+    const int lengths[] = { sizeof(loopProgram) / 2, sizeof(selfModifyingProgram) / 2, sizeof(inputProgram) / 2 };
+
+    for(int p = 0; p < 3; p++) {
+        for(int e = ENGINE_INTERPRETER; e <= ENGINE_JIT; e++) {
+            initialize(c);
+            mu_assert("error state hash, initialized machine", getStateHash(c) == computeStateHash(c));
+            for(int i = 0; i < lengths[p]; i++) {
+                rom[2 * i] = programs[p][i] >> 8;
+                rom[2 * i + 1] = programs[p][i] & 0xFF;
+            }
+            loadRom(c, rom, 2 * lengths[p]);
+            mu_assert("error state hash, loaded ROM", getStateHash(c) == computeStateHash(c));
+            unsigned long long loaded = getStateHash(c);
+            takeSnapshot(c, &image);
+
+            setEngine(c, e);
+            for(int i = 0; i < 500; i++) {     // Hashed after every step, then after runs of steps
+                emulate(c);
+                if(i < 250 || i % 16 == 15)
+                    mu_assert("error state hash, differs from hashing from scratch", getStateHash(c) == computeStateHash(c));
+            }
+            unsigned long long hash = getStateHash(c);
+            takeSnapshot(c, &snapshot);
+            writeState(c, state);
+            instr00E0(c, decode(0x00E0));
+            mu_assert("error state hash, cleared screen", getStateHash(c) == computeStateHash(c) && getStateHash(c) != hash);
+
+            restoreSnapshot(c, &snapshot);
+            mu_assert("error state hash, restored snapshot", getStateHash(c) == hash);
+            runFor(100);
+            readState(c, state, STATE_SIZE);
+            mu_assert("error state hash, read state", getStateHash(c) == hash && computeStateHash(c) == hash);
+            resetToTemplate(c, &image);
+            mu_assert("error state hash, reset to template", getStateHash(c) == loaded);
+            setEngine(c, ENGINE_INTERPRETER);
+        }
+    }
+
+    return 0;
+}
+
+// Timers computed on demand must match ticking them after every instruction, on every engine.
+// States are only captured every 16 steps so the lazy timers go unsynced in between.
+static char * testLazyTimers() {
+    static const unsigned int clocks[] = { 60, 420, DEFAULT_CLOCK_HZ };
+    MachineState reference;
+
+    for(int k = 0; k < 3; k++) {
+        for(int e = ENGINE_INTERPRETER; e <= ENGINE_JIT; e++) {
+            int executed = 0;
+
+            loadProgram(timerProgram, sizeof(timerProgram) / 2);
+            setLazyTimers(c, 1);
+            setClock(c, clocks[k]);
+            setEngine(c, e);
+            for(int i = 0; i < 256 * 16; i++) {
+                executed += emulate(c);
+                if(i % 16 == 15) {
+                    blockEnds[i / 16] = executed;
+                    syncTimers(c);
+                    captureState(&blockStates[i / 16]);
+                }
+            }
+            setLazyTimers(c, 0);
+
+            loadProgram(timerProgram, sizeof(timerProgram) / 2);
+            setClock(c, clocks[k]);
+            setEngine(c, ENGINE_INTERPRETER);
+            executed = 0;
+            for(int i = 0; i < 256; i++) {
+                while(executed < blockEnds[i])
+                    executed += emulate(c);
+                captureState(&reference);
+                mu_assert("error lazy timers, state differs from eager timers", sameState(&reference, &blockStates[i]));
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Frames must end at draws and reach the same state, timers included, as stepping one
+// instruction at a time
+static char * testEmulateFrame() {
+    MachineState reference;
+    int executed, n, reason;
+
+    for(int k = 0; k < 2 * 3; k++) {
+        const unsigned short *program = k < 3 ? loopProgram : timerProgram;
+        int length = k < 3 ? sizeof(loopProgram) / 2 : sizeof(timerProgram) / 2;
+        int e = k % 3;
+
+        loadProgram(program, length);
+        setEngine(c, e);
+        executed = 0;
+        for(int i = 0; i < 256; i++) {
+            reason = emulateFrame(c, 7, &n);
+            mu_assert("error emulateFrame, ran more than a block past the budget", n >= 1 && n < 7 + 32);
+            mu_assert("error emulateFrame, FRAME_DRAW without a draw", (reason == FRAME_DRAW) == (c->drawFlag != 0));
+            mu_assert("error emulateFrame, FRAME_DONE before the budget", reason != FRAME_DONE || n >= 7);
+            c->drawFlag = 0;
+            executed += n;
+            blockEnds[i] = executed;
+            captureState(&blockStates[i]);
+        }
+
+        loadProgram(program, length);
+        setEngine(c, ENGINE_INTERPRETER);
+        n = 0;
+        for(int i = 0; i < 256; i++) {
+            while(n < blockEnds[i]) {
+                emulateCycle(c);
+                n++;
+            }
+            captureState(&reference);
+            mu_assert("error emulateFrame, state differs from emulateCycle", sameState(&reference, &blockStates[i]));
+        }
+    }
+
+    return 0;
+}
+
+// Wait for the delay timer with FX07/3XNN/1NNN and FX07/4XNN/1NNN, and a jump to itself and a key wait
+static const unsigned short pollProgram[] = {
+    0x6A1F, 0xFA15, 0xF107, 0x3100, 0x1204, 0x7B01, 0xFA15, 0xF107,
+    0x411F, 0x120E, 0x7B01, 0x3B08, 0x1202, 0xF00A, 0x121C
+};
+static const unsigned short idleProgram[] = { 0x6005, 0x6A09, 0xFA15, 0x1206 };
+
+// Skipping idle loops must reach the same state, timers included, as running them
+static char * runIdle(const unsigned short *program, int length, unsigned int clock, int e, int lazy) {
+    MachineState reference;
+    int executed = 0, n, idle = 0;
+
+    loadProgram(program, length);
+    setLazyTimers(c, lazy);
+    setClock(c, clock);
+    setEngine(c, e);
+    for(int i = 0; i < 256; i++) {
+        if(emulateFrame(c, 10, &n) == FRAME_IDLE)
+            idle++;
+        c->drawFlag = 0;
+        executed += n;
+        blockEnds[i] = executed;
+        syncTimers(c);
+        captureState(&blockStates[i]);
+    }
+    mu_assert("error idle loops, no frame idled", idle > 0 && c->elided > 0);
+    setLazyTimers(c, 0);
+
+    loadProgram(program, length);
+    setClock(c, clock);
+    setEngine(c, ENGINE_INTERPRETER);
+    n = 0;
+    for(int i = 0; i < 256; i++) {
+        while(n < blockEnds[i]) {
+            emulateCycle(c);
+            n++;
+        }
+        captureState(&reference);
+        mu_assert("error idle loops, state differs from running the loop", sameState(&reference, &blockStates[i]));
+    }
+    mu_assert("error idle loops, emulateCycle skipped instructions", c->elided == 0);
+
+    return 0;
+}
+
+static char * testIdleLoops() {
+    static const unsigned int clocks[] = { 60, 420, DEFAULT_CLOCK_HZ, CLOCK_UNLIMITED };
+
+    for(int k = 0; k < 4; k++) {
+        for(int e = ENGINE_INTERPRETER; e <= ENGINE_JIT; e++) {
+            for(int lazy = 0; lazy <= 1; lazy++) {
+                char *message = runIdle(pollProgram, sizeof(pollProgram) / 2, clocks[k], e, lazy);
+                if(message)
+                    return message;
+                message = runIdle(idleProgram, sizeof(idleProgram) / 2, clocks[k], e, lazy);
+                if(message)
+                    return message;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// A machine waiting in FX0A skips whole frames until a key is pressed, then takes the key
+static char * testKeyWait() {
+    static const unsigned short keyProgram[] = { 0x6A1F, 0xFA15, 0xF20A, 0x6301 };
+    int n;
+
+    loadProgram(keyProgram, sizeof(keyProgram) / 2);
+    for(int i = 0; i < KEYPAD_SIZE; i++)
+        setKey(c, i, 0);
+
+    mu_assert("error key wait, FX0A without a key not FRAME_KEY", emulateFrame(c, 50, &n) == FRAME_KEY && n == 50);
+    mu_assert("error key wait, machine not waiting", isWaitingForKey(c) && c->pc == 0x204);
+    mu_assert("error key wait, timers stopped while waiting", c->delayTimer == 31 - 50 / 10);
+    mu_assert("error key wait, waiting frame not skipped", emulateFrame(c, 1000, &n) == FRAME_KEY && c->elided == 47 + 1000);
+
+    setKey(c, 5, 1);
+    emulateFrame(c, 2, &n);
+    setKey(c, 5, 0);
+    mu_assert("error key wait, key not stored in V2", c->V[2] == 5 && c->V[3] == 1);
+
+    return 0;
+}
+
+// Instances do not share state
+static char * testInstances() {
+    Chip8 *a = createChip8();
+    Chip8 *b = createChip8();
+    mu_assert("error createChip8, allocation failed", a != NULL && b != NULL);
+    mu_assert("error createChip8, instance not cache line aligned", ((size_t) a & 63) == 0);
+
+    for(int i = 0; i < (int) (sizeof(selfModifyingProgram) / 2); i++) {
+        a->memory[MEMORY_PROGRAM + 2 * i] = selfModifyingProgram[i] >> 8;
+        a->memory[MEMORY_PROGRAM + 2 * i + 1] = selfModifyingProgram[i] & 0xFF;
+    }
+    b->memory[MEMORY_PROGRAM] = 0x63;      // V3 = 5
+    b->memory[MEMORY_PROGRAM + 1] = 0x05;
+    b->memory[MEMORY_PROGRAM + 2] = 0x12;  // Jump to self
+    b->memory[MEMORY_PROGRAM + 3] = 0x02;
+
+    setEngine(a, ENGINE_JIT);
+    setEngine(b, ENGINE_BLOCK_CACHE);
+    for(int i = 0; i < 256; i++) {
+        emulate(a);
+        emulate(b);
+    }
+
+    mu_assert("error instances, V3 != 120", a->V[3] == 120);
+    mu_assert("error instances, state leaked between instances", b->V[3] == 5 && b->V[4] == 0 && b->pc == 0x202);
+
+    destroyChip8(a);
+    destroyChip8(b);
+
+    return 0;
+}
+
+// Lane 0 holds key 0 down and loops, lane 1 parks in FX0A below it. Both lanes then run
+// from the last byte of memory, where no whole instruction fits.
+static char * testLockstepProgress() {
+    static const unsigned short parkProgram[] = { 0xE09E, 0xF10A, 0x7101, 0x1204 };
+    Lockstep *l = createLockstep(2);
+    mu_assert("error lockstep, allocation failed", l != NULL);
+
+    for(int i = 0; i < 2; i++) {
+        for(int j = 0; j < 4; j++) {
+            l->lanes[i]->memory[MEMORY_PROGRAM + 2 * j] = parkProgram[j] >> 8;
+            l->lanes[i]->memory[MEMORY_PROGRAM + 2 * j + 1] = parkProgram[j] & 0xFF;
+        }
+    }
+    setKey(l->lanes[0], 0, 1);
+    for(int i = 0; i < 20000; i++)
+        emulateLockstep(l);
+    mu_assert("error lockstep, lane 1 not parked", getLane(l, 1)->pc == 0x202 && l->executed[1] > 1000);
+    mu_assert("error lockstep, lane 0 starved by the parked lane", l->executed[0] > 5000 && getLane(l, 0)->pc >= 0x204);
+
+    for(int i = 0; i < 2; i++) {
+        l->lanes[i]->memory[MEMORY_SIZE - 1] = 0x12;    // 1200, the fetch wraps to address 0 for the low byte
+        l->lanes[i]->memory[0] = 0x00;
+        l->pc[i] = MEMORY_SIZE - 1;
+    }
+    mu_assert("error lockstep, lanes at the last byte not stepped", emulateLockstep(l) == 2 && l->pc[0] == 0x200 && l->pc[1] == 0x200);
+
+    l->lanes[1]->memory[0xFE] = 0x12;                   // 1200 from 0x10FE, where BNNN can jump
+    l->lanes[1]->memory[0xFF] = 0x00;
+    l->pc[0] = 0x204;
+    l->pc[1] = 0x10FE;
+    unsigned long long executed = l->executed[1];
+    for(int i = 0; i < 2 * LOCKSTEP_MAX_LAG && l->pc[1] != 0x200; i++)
+        emulateLockstep(l);
+    mu_assert("error lockstep, lane past the end of memory not stepped", l->pc[1] == 0x200 && l->executed[1] == executed + 1);
+
+    destroyLockstep(l);
+
+    return 0;
+}
+
+// Scans the keypad, then runs ALU, skip, timer, call and draw instructions whose results depend on the keys held.
+// V8 accumulates every flag result through VC.
+static const unsigned short divergentProgram[] = {
+    0x6000, 0x6100, 0x6200, 0xE29E, 0x120E, 0x7137, 0x8014, 0x7201,
+    0x3210, 0x1206, 0x8304, 0x8CF0, 0x88C4, 0x8415, 0x8CF0, 0x88C4,
+    0x8517, 0x8CF0, 0x88C4, 0x8606, 0x8CF0, 0x88C4, 0x870E, 0x8CF0,
+    0x88C4, 0x6C00, 0x5340, 0x9560, 0xA300, 0xFB1E, 0x7B03, 0x4B30,
+    0x6B00, 0x2250, 0x1204, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+    0xFD15, 0x7D05, 0xFE07, 0xF029, 0xDCC5, 0x00EE
+};
+
+// Every lane reaches the state the interpreter reaches after as many instructions
+static char * testLockstep() {
+    const int lanes = 40;   // One full and one partial vector of lanes
+    const int length = sizeof(divergentProgram) / 2;
+    Lockstep *l = createLockstep(lanes);
+    mu_assert("error lockstep, allocation failed", l != NULL);
+
+    for(int i = 0; i < lanes; i++) {
+        Chip8 *lane = l->lanes[i];
+        for(int j = 0; j < length; j++) {
+            lane->memory[MEMORY_PROGRAM + 2 * j] = divergentProgram[j] >> 8;
+            lane->memory[MEMORY_PROGRAM + 2 * j + 1] = divergentProgram[j] & 0xFF;
+        }
+        setKey(lane, i % KEYPAD_SIZE, 1);
+        if(i & 16)
+            setKey(lane, i * 7 % KEYPAD_SIZE, 1);
+    }
+
+    for(int i = 0; i < 5000; i++)
+        emulateLockstep(l);
+
+    for(int i = 0; i < lanes; i++) {
+        MachineState reference, state;
+
+        loadProgram(divergentProgram, length);
+        for(int k = 0; k < KEYPAD_SIZE; k++)    // initialize() leaves the keypad alone
+            setKey(c, k, 0);
+        setKey(c, i % KEYPAD_SIZE, 1);
+        if(i & 16)
+            setKey(c, i * 7 % KEYPAD_SIZE, 1);
+        for(unsigned long long j = 0; j < l->executed[i]; j++)
+            emulateCycle(c);
+        captureState(&reference);
+
+        Chip8 *saved = c;
+        c = getLane(l, i);
+        captureState(&state);
+        c = saved;
+
+        mu_assert("error lockstep, lane did not run", l->executed[i] > 1000);
+        mu_assert("error lockstep, lane state differs from interpreter", sameState(&reference, &state));
+    }
+
+    // Lanes re-read code that FX55 stored over
+    resetLockstep(l);
+    for(int i = 0; i < lanes; i++) {
+        for(int j = 0; j < (int) (sizeof(selfModifyingProgram) / 2); j++) {
+            l->lanes[i]->memory[MEMORY_PROGRAM + 2 * j] = selfModifyingProgram[j] >> 8;
+            l->lanes[i]->memory[MEMORY_PROGRAM + 2 * j + 1] = selfModifyingProgram[j] & 0xFF;
+        }
+    }
+    for(int i = 0; i < 256; i++)
+        emulateLockstep(l);
+    for(int i = 0; i < lanes; i++)
+        mu_assert("error lockstep, self-modified code not re-read", getLane(l, i)->V[3] == 120);
+
+    destroyLockstep(l);
+
+    return 0;
+}
+
+// The reader gets the latest frame, with the dirty rows of the frames it skipped
+static char * testTripleBuffer() {
+    static TripleBuffer tb;
+    initTripleBuffer(&tb);
+
+    mu_assert("error triple buffer, frame before first publish", readFrame(&tb) == NULL);
+
+    for(int i = 0; i < 3; i++) {
+        Frame *f = writeFrame(&tb);
+        f->rows[0] = i;
+        f->dirty = 1u << i;
+        publishFrame(&tb);
+    }
+
+    const Frame *f = readFrame(&tb);
+    mu_assert("error triple buffer, not the latest frame", f != NULL && f->rows[0] == 2);
+    mu_assert("error triple buffer, skipped dirty rows lost", f->dirty == 0x7);
+    mu_assert("error triple buffer, frame read twice", readFrame(&tb) == NULL);
+
+    Frame *w = writeFrame(&tb);
+    mu_assert("error triple buffer, writer got the reader's frame", w != f);
+    w->rows[0] = 3;
+    w->dirty = 1u << 3;
+    publishFrame(&tb);
+
+    f = readFrame(&tb);
+    mu_assert("error triple buffer, taken frame dirty rows carried", f != NULL && f->rows[0] == 3 && f->dirty == 0x8);
+
+    return 0;
+}
+
+static char * all_tests() {
+    mu_run_test(testInitialize);
+    mu_run_test(testDecodeTable);
+
+    // Instructions
+    mu_run_test(test00E0);
+    mu_run_test(test00EE);
+    mu_run_test(test1NNN);
+    mu_run_test(test2NNN);
+    mu_run_test(test3XNN);
+    mu_run_test(test4XNN);
+    mu_run_test(test5XY0);
+    mu_run_test(test6XNN);
+    mu_run_test(test7XNN);
+    mu_run_test(test8XY0);
+    mu_run_test(test8XY1);
+    mu_run_test(test8XY2);
+    mu_run_test(test8XY3);
+    mu_run_test(test8XY4);
+    mu_run_test(test8XY5);
+    mu_run_test(test8XY6);
+    mu_run_test(test8XY7);
+    mu_run_test(test8XYE);
+    mu_run_test(test9XY0);
+    mu_run_test(testANNN);
+    mu_run_test(testBNNN);
+    mu_run_test(testCXNN);
+    mu_run_test(testDXYN);
+    mu_run_test(testEX9E);
+    mu_run_test(testEXA1);
+    mu_run_test(testFX07);
+    mu_run_test(testFX0A);
+    mu_run_test(testFX15);
+    mu_run_test(testFX18);
+    mu_run_test(testFX1E);
+    mu_run_test(testTimers);
+
+    // Engines
+    mu_run_test(testBlockCache);
+    mu_run_test(testJit);
+    mu_run_test(testBlockBounds);
+    mu_run_test(testLazyTimers);
+    mu_run_test(testEmulateFrame);
+    mu_run_test(testIdleLoops);
+    mu_run_test(testKeyWait);
+    mu_run_test(testSnapshot);
+    mu_run_test(testSaveState);
+    mu_run_test(testRewind);
+    mu_run_test(testInputReplay);
+    mu_run_test(testTemplateReset);
+    mu_run_test(testBranches);
+    mu_run_test(testStateHash);
+#ifdef PROFILE
+    mu_run_test(testProfile);
+#endif /* PROFILE */
+#ifdef TRACE
+    mu_run_test(testTrace);
+#endif /* TRACE */
+    mu_run_test(testInstances);
+    mu_run_test(testLockstep);
+    mu_run_test(testLockstepProgress);
+    mu_run_test(testTripleBuffer);
+
+    return 0;
+}
+
+// Run tests
+int testmain(int argc, char **argv) {
+	char *result = all_tests();
+	if (result != 0) {
+		printf("%s\n", result);
+	}
+	else {
+		printf("ALL TESTS PASSED\n");
+	}
+	printf("Tests run: %d\n", tests_run);
+
+	return result != 0;
+}
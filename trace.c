@@ -0,0 +1,105 @@
+/* file trace.c */
+
+/*
+ * Execution trace of one machine: the last TRACE_ENTRIES instructions run,
+ * with the registers they may have changed, kept in a ring buffer by the
+ * TRACE_INSTRUCTION hooks in the interpreter and block paths (while a
+ * trace runs the JIT replays blocks instead of running native code). The
+ * ring is written to a compact binary file on demand with dumpTrace(),
+ * and on the first unknown opcode, where recording stops so the
+ * instructions leading up to the fault are kept. tracedump.c prints a
+ * dump as a disassembled listing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+// Starts recording into a new ring buffer, dumped to file. Returns -1 if it cannot be allocated.
+int startTrace(Chip8 *c, const char *file) {
+	stopTrace(c);
+
+	Trace *t = (Trace*) calloc(1, sizeof(Trace));
+	char *name = (char*) malloc(strlen(file) + 1);
+	if(t == NULL || name == NULL) {
+		fprintf(stderr, "Error: Unable to allocate trace buffer\n");
+		free(t);
+		free(name);
+		return -1;
+	}
+
+	strcpy(name, file);
+	t->file = name;
+	c->trace = t;
+
+	return 0;
+}
+
+void stopTrace(Chip8 *c) {
+	if(c->trace == NULL)
+		return;
+
+	free(c->trace->file);
+	free(c->trace);
+	c->trace = NULL;
+}
+
+static void putLittleEndian(unsigned char *p, unsigned long long value, int size) {
+	for(int i = 0; i < size; i++)
+		p[i] = (unsigned char) (value >> 8 * i);
+}
+
+// Writes the recorded instructions, oldest first, to the trace file. Returns -1 on failure.
+int dumpTrace(Chip8 *c) {
+	Trace *t = c->trace;
+	if(t == NULL)
+		return -1;
+
+	FILE *out = fopen(t->file, "wb");
+	if(out == NULL) {
+		fprintf(stderr, "Error: Unable to open trace file\n");
+		return -1;
+	}
+
+	unsigned long long count = t->cycle < TRACE_ENTRIES ? t->cycle : TRACE_ENTRIES;
+	unsigned long long first = t->cycle - count;
+	unsigned char header[TRACE_HEADER_SIZE];
+	memcpy(header, TRACE_MAGIC, 4);
+	putLittleEndian(header + 4, TRACE_VERSION, 2);
+	putLittleEndian(header + 6, TRACE_ENTRY_SIZE, 2);
+	putLittleEndian(header + 8, count, 4);
+	putLittleEndian(header + 12, t->flags, 4);
+	putLittleEndian(header + 16, first, 8);
+	int failed = fwrite(header, 1, TRACE_HEADER_SIZE, out) != TRACE_HEADER_SIZE;
+
+	for(unsigned long long i = first; i < t->cycle && !failed; i++) {
+		const TraceEntry *e = &t->entries[i & (TRACE_ENTRIES - 1)];
+		unsigned char entry[TRACE_ENTRY_SIZE];
+		putLittleEndian(entry, e->pc, 2);
+		putLittleEndian(entry + 2, e->opcode, 2);
+		putLittleEndian(entry + 4, e->I, 2);
+		entry[6] = e->vx;
+		entry[7] = e->vf;
+		failed = fwrite(entry, 1, TRACE_ENTRY_SIZE, out) != TRACE_ENTRY_SIZE;
+	}
+
+	if(fclose(out) != 0 || failed) {
+		fprintf(stderr, "Error: Unable to write trace file\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+// Records the unknown opcode at pc, stops recording and dumps the trace. Later faults are ignored.
+void traceFault(Chip8 *c, const Instruction *in) {
+	Trace *t = c->trace;
+	if(t == NULL || t->flags & TRACE_FAULTED)
+		return;
+
+	traceInstruction(c, c->pc, in->opcode);
+	t->flags |= TRACE_FAULTED;
+	dumpTrace(c);
+}
@@ -0,0 +1,66 @@
+/* file trace.h */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "chip8.h"
+
+// #define TRACE	// Record executed instructions in a ring buffer, compile with trace.c
+
+#define TRACE_ENTRIES 65536		// Instructions kept, a power of two
+
+// Dump file layout, all fields little endian: a TRACE_HEADER_SIZE byte header
+//  magic "C8TR", u16 version, u16 entry size, u32 entries, u32 flags, u64 cycle of the first entry
+// followed by the entries oldest first, each u16 pc, u16 opcode, u16 I, u8 V[x], u8 VF.
+// tracedump.c decodes it.
+#define TRACE_MAGIC "C8TR"
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 24
+#define TRACE_ENTRY_SIZE 8
+#define TRACE_FAULTED 1			// Flag: recording stopped at an unknown opcode
+
+// One executed instruction and the registers it may have changed, read after it ran. Entries are
+// consecutive instructions, so the cycle of each follows from its position.
+typedef struct TraceEntry {
+	unsigned short pc;
+	unsigned short opcode;
+	unsigned short I;
+	unsigned char vx;	// V[x] of the opcode
+	unsigned char vf;
+} TraceEntry;
+
+typedef struct Trace {
+	TraceEntry entries[TRACE_ENTRIES];
+	unsigned long long cycle;		// Instructions recorded since startTrace()
+	unsigned int flags;
+	char *file;						// Written by dumpTrace() and on a fault
+} Trace;
+
+// Hooks in the execution engines. Without TRACE they compile to nothing, pc is only evaluated so
+// the locals kept for the hook are used.
+#ifdef TRACE
+	#define TRACE_INSTRUCTION(c, pc, opcode) traceInstruction(c, pc, opcode)
+	#define TRACE_FAULT(c, in) traceFault(c, in)
+	#define TRACING(c) ((c)->trace != NULL)
+#else
+	#define TRACE_INSTRUCTION(c, pc, opcode) ((void) (pc))
+	#define TRACE_FAULT(c, in)
+	#define TRACING(c) 0
+#endif
+
+int startTrace(Chip8 *c, const char *file);
+void stopTrace(Chip8 *c);
+int dumpTrace(Chip8 *c);
+void traceFault(Chip8 *c, const Instruction *in);
+
+// Records an instruction that just ran from pc. Called for every instruction, so kept inline and
+// given the opcode rather than loading it from the Instruction again.
+static inline void traceInstruction(Chip8 *c, unsigned short pc, unsigned short opcode) {
+	Trace *t = c->trace;
+	if(t == NULL || t->flags & TRACE_FAULTED)
+		return;
+
+	t->entries[t->cycle++ & (TRACE_ENTRIES - 1)] = (TraceEntry) { pc, opcode, c->I, c->V[opcode >> 8 & 0xF], c->V[0xF] };
+}
+
+#endif /* TRACE_H */
@@ -0,0 +1,149 @@
+/* file tracedump.c */
+
+/*
+ * Prints an execution trace written by dumpTrace() (see trace.h) as a
+ * disassembled listing, one instruction per line with its cycle, address,
+ * opcode and the registers it changed. Standalone, build with
+ * gcc -O2 -o tracedump tracedump.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+static unsigned long long getLittleEndian(const unsigned char *p, int size) {
+	unsigned long long value = 0;
+	for(int i = size - 1; i >= 0; i--)
+		value = value << 8 | p[i];
+	return value;
+}
+
+// Writes the mnemonic of opcode to text and the registers it writes, read from entry, to effect
+static void disassemble(const unsigned char *entry, char *text, char *effect) {
+	unsigned short opcode = (unsigned short) getLittleEndian(entry + 2, 2);
+	unsigned short I = (unsigned short) getLittleEndian(entry + 4, 2);
+	unsigned char vx = entry[6], vf = entry[7];
+	int x = opcode >> 8 & 0xF, y = opcode >> 4 & 0xF, n = opcode & 0xF;
+	int nn = opcode & 0xFF, nnn = opcode & 0xFFF;
+	static const char *alu[16] = { "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN",
+		NULL, NULL, NULL, NULL, NULL, NULL, "SHL", NULL };
+	int writesVx = 0, writesVf = 0, writesI = 0;
+
+	text[0] = effect[0] = '\0';
+	switch(opcode >> 12) {
+		case 0x0:
+			if(opcode == 0x00E0)
+				sprintf(text, "CLS");
+			else if(opcode == 0x00EE)
+				sprintf(text, "RET");
+			else
+				sprintf(text, "SYS 0x%03X", nnn);
+			break;
+		case 0x1: sprintf(text, "JP 0x%03X", nnn); break;
+		case 0x2: sprintf(text, "CALL 0x%03X", nnn); break;
+		case 0x3: sprintf(text, "SE V%X, 0x%02X", x, nn); break;
+		case 0x4: sprintf(text, "SNE V%X, 0x%02X", x, nn); break;
+		case 0x5:
+			if(n == 0)
+				sprintf(text, "SE V%X, V%X", x, y);
+			break;
+		case 0x6: sprintf(text, "LD V%X, 0x%02X", x, nn); writesVx = 1; break;
+		case 0x7: sprintf(text, "ADD V%X, 0x%02X", x, nn); writesVx = 1; break;
+		case 0x8:
+			if(alu[n] != NULL) {
+				sprintf(text, "%s V%X, V%X", alu[n], x, y);
+				writesVx = 1;
+				writesVf = n >= 4;
+			}
+			break;
+		case 0x9:
+			if(n == 0)
+				sprintf(text, "SNE V%X, V%X", x, y);
+			break;
+		case 0xA: sprintf(text, "LD I, 0x%03X", nnn); writesI = 1; break;
+		case 0xB: sprintf(text, "JP V0, 0x%03X", nnn); break;
+		case 0xC: sprintf(text, "RND V%X, 0x%02X", x, nn); writesVx = 1; break;
+		case 0xD: sprintf(text, "DRW V%X, V%X, %d", x, y, n); writesVf = 1; break;
+		case 0xE:
+			if(nn == 0x9E)
+				sprintf(text, "SKP V%X", x);
+			else if(nn == 0xA1)
+				sprintf(text, "SKNP V%X", x);
+			break;
+		case 0xF:
+			switch(nn) {
+				case 0x07: sprintf(text, "LD V%X, DT", x); writesVx = 1; break;
+				case 0x0A: sprintf(text, "LD V%X, K", x); writesVx = 1; break;
+				case 0x15: sprintf(text, "LD DT, V%X", x); break;
+				case 0x18: sprintf(text, "LD ST, V%X", x); break;
+				case 0x1E: sprintf(text, "ADD I, V%X", x); writesI = 1; break;
+				case 0x29: sprintf(text, "LD F, V%X", x); writesI = 1; break;
+				case 0x33: sprintf(text, "LD B, V%X", x); break;
+				case 0x55: sprintf(text, "LD [I], V%X", x); break;
+				case 0x65: sprintf(text, "LD V%X, [I]", x); writesVx = 1; break;
+			}
+			break;
+	}
+
+	if(text[0] == '\0') {
+		sprintf(text, "??? (unknown opcode)");
+		return;
+	}
+	if(writesVx)
+		effect += sprintf(effect, " V%X=0x%02X", x, vx);
+	if(writesVf && x != 0xF)
+		effect += sprintf(effect, " VF=0x%02X", vf);
+	if(writesI)
+		sprintf(effect, " I=0x%03X", I);
+}
+
+int main(int argc, char **argv) {
+	if(argc != 2) {
+		printf("Usage: tracedump <trace file>\n\n");
+		exit(EXIT_FAILURE);
+	}
+
+	FILE *in = fopen(argv[1], "rb");
+	if(in == NULL) {
+		fprintf(stderr, "Error: Unable to open trace file\n");
+		exit(EXIT_FAILURE);
+	}
+
+	unsigned char header[TRACE_HEADER_SIZE];
+	if(fread(header, 1, TRACE_HEADER_SIZE, in) != TRACE_HEADER_SIZE || memcmp(header, TRACE_MAGIC, 4) != 0) {
+		fprintf(stderr, "Error: Not a trace file\n");
+		exit(EXIT_FAILURE);
+	}
+
+	unsigned int version = (unsigned int) getLittleEndian(header + 4, 2);
+	unsigned int entrySize = (unsigned int) getLittleEndian(header + 6, 2);
+	unsigned long long count = getLittleEndian(header + 8, 4);
+	unsigned int flags = (unsigned int) getLittleEndian(header + 12, 4);
+	unsigned long long cycle = getLittleEndian(header + 16, 8);
+	if(version != TRACE_VERSION || entrySize < TRACE_ENTRY_SIZE) {
+		fprintf(stderr, "Error: Unsupported trace version %u\n", version);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%llu instructions from cycle %llu%s\n\n", count, cycle,
+		flags & TRACE_FAULTED ? ", stopped at an unknown opcode" : "");
+	printf("%12s  %-5s  %-6s  %-20s %s\n", "cycle", "pc", "opcode", "instruction", " changed");
+
+	unsigned char entry[256];
+	for(unsigned long long i = 0; i < count; i++, cycle++) {
+		if(entrySize > sizeof(entry) || fread(entry, 1, entrySize, in) != entrySize) {
+			fprintf(stderr, "Error: Trace file truncated\n");
+			exit(EXIT_FAILURE);
+		}
+
+		char text[32], effect[48];
+		disassemble(entry, text, effect);
+		printf("%12llu  0x%03X  %04X    %-20s %s\n", cycle, (unsigned int) getLittleEndian(entry, 2),
+			(unsigned int) getLittleEndian(entry + 2, 2), text, effect);
+	}
+
+	fclose(in);
+	return 0;
+}
@@ -0,0 +1,45 @@
+/* file triplebuffer.c */
+
+#include <string.h>
+
+#include "triplebuffer.h"
+
+// Set in middle while it holds a frame the reader has not taken
+#define FRAME_FRESH 4
+
+void initTripleBuffer(TripleBuffer *tb) {
+	memset(tb->frames, 0, sizeof(tb->frames));
+	atomic_init(&tb->middle, 1);
+	tb->back = 0;
+	tb->front = 2;
+	tb->published = 0;
+}
+
+// Writer: the frame to fill before publishFrame()
+Frame * writeFrame(TripleBuffer *tb) {
+	return &tb->frames[tb->back];
+}
+
+// Writer: hands the filled frame to the reader, replacing a frame it has not taken yet
+void publishFrame(TripleBuffer *tb) {
+	Frame *f = &tb->frames[tb->back];
+
+	// The previous frame may be replaced before the reader takes it, so its rows stay dirty
+	if(atomic_load_explicit(&tb->middle, memory_order_relaxed) & FRAME_FRESH)
+		f->dirty |= tb->published;
+	tb->published = f->dirty;
+
+	int previous = atomic_exchange_explicit(&tb->middle, tb->back | FRAME_FRESH, memory_order_acq_rel);
+	tb->back = previous & 3;
+}
+
+// Reader: the latest published frame, or NULL if there is none since the last call
+const Frame * readFrame(TripleBuffer *tb) {
+	if(!(atomic_load_explicit(&tb->middle, memory_order_relaxed) & FRAME_FRESH))
+		return NULL;
+
+	int previous = atomic_exchange_explicit(&tb->middle, tb->front, memory_order_acq_rel);
+	tb->front = previous & 3;
+
+	return &tb->frames[tb->front];
+}
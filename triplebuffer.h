@@ -0,0 +1,31 @@
+/* file triplebuffer.h */
+
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <stdatomic.h>
+
+#include "chip8.h"
+
+// Framebuffer published by the emulation thread
+typedef struct Frame {
+	unsigned long long rows[NUM_OF_PIXEL_ROWS];	// As getGfxRows()
+	unsigned int dirty;							// Rows changed since the last frame the reader took
+} Frame;
+
+// Lock-free single producer, single consumer handoff of the latest frame. The writer always has
+// a frame to fill and the reader a frame to draw, neither ever waits for the other.
+typedef struct TripleBuffer {
+	Frame frames[3];
+	atomic_int middle;		// Index of the frame in transit, plus FRAME_FRESH once published
+	int back;				// Writer's frame
+	int front;				// Reader's frame
+	unsigned int published;	// Dirty rows of the last published frame
+} TripleBuffer;
+
+void initTripleBuffer(TripleBuffer *tb);
+Frame * writeFrame(TripleBuffer *tb);
+void publishFrame(TripleBuffer *tb);
+const Frame * readFrame(TripleBuffer *tb);
+
+#endif /* TRIPLEBUFFER_H */
@@ -1,77 +1,141 @@
-/* file view.c */
-
-#include <SDL.h>
-#include <stdio.h>
-#include "view.h"
-
-const int SCREEN_WIDTH = 640;
-const int SCREEN_HEIGHT = 320;
-
-int windowInit() {
-    int success = 1;
-
-    // Initialize SDL
-    if(SDL_Init(SDL_INIT_VIDEO) < 0) {
-        printf( "Error: SDL could not initialize! SDL_Error: %s\n", SDL_GetError() );
-        success = 0;
-    } else {
-        // Create window
-        window = SDL_CreateWindow("Chip8E", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
-        if(window == NULL) {
-            printf( "Error: Window could not be created! SDL_Error: %s\n", SDL_GetError() );
-            success = 0;
-        } else {
-            // Get window surface
-            screenSurface = SDL_GetWindowSurface(window);
-            // Renderer
-            renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-            if(renderer == NULL) {
-                printf( "Error: Renderer could not be created! SDL_Error: %s\n", SDL_GetError() );
-                success = 0;
-            }
-        }
-    }
-
-    return success;
-}
-
-void windowDraw(unsigned char* gfx, int NUM_OF_PIXEL_COLS, int NUM_OF_PIXEL_ROWS) {
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
-    SDL_RenderClear(renderer);
-
-    // Pixel position
-    SDL_Rect r;
-    int x = 0;
-    int y = 0;
-    int w = SCREEN_WIDTH / NUM_OF_PIXEL_COLS;
-    int h = SCREEN_HEIGHT / NUM_OF_PIXEL_ROWS;
-
-    // Rendering
-    int i = 0;
-    for(int j = 0; j < NUM_OF_PIXEL_ROWS; j++) {
-        x = 0;
-        y = j * h;
-        for(int k = 0; k < NUM_OF_PIXEL_COLS; k++) {
-            i++;
-            x = k * w;
-            if(gfx[i] == 1) {
-                r.x = x;
-                r.y = y;
-                r.w = w;
-                r.h = h;
-                SDL_SetRenderDrawColor(renderer, 0xFF, 0xFF, 0xFF, 0xFF);
-                SDL_RenderFillRect(renderer, &r);
-                SDL_RenderPresent(renderer);
-            }
-        }
-    }
-}
-
-void windowClose() {
-    SDL_DestroyWindow(window);
-    window = NULL;
-    screenSurface = NULL;
-    renderer = NULL;
-
-    SDL_Quit();
-}
+/* file view.c */
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "view.h"
+#include "hrtime.h"
+
+const int SCREEN_WIDTH = 640;
+const int SCREEN_HEIGHT = 320;
+
+// Colours of the streaming texture, ARGB8888
+#define PIXEL_ON 0xFFFFFFFF
+#define PIXEL_OFF 0xFF000000
+
+static Uint32 *texturePixels = NULL;
+static int textureCols = 0;
+static int textureRows = 0;
+
+// Frame time of windowDraw(): expand, upload, copy and present
+static unsigned long long frames = 0;
+static unsigned long long frameTimeTotal = 0;
+static unsigned long long frameTimeMax = 0;
+static unsigned long long rowsUploaded = 0;
+
+int windowInit() {
+    int success = 1;
+
+    // Initialize SDL
+    if(SDL_Init(SDL_INIT_VIDEO) < 0) {
+        printf( "Error: SDL could not initialize! SDL_Error: %s\n", SDL_GetError() );
+        success = 0;
+    } else {
+        // Create window
+        window = SDL_CreateWindow("Chip8E", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
+        if(window == NULL) {
+            printf( "Error: Window could not be created! SDL_Error: %s\n", SDL_GetError() );
+            success = 0;
+        } else {
+            // Get window surface
+            screenSurface = SDL_GetWindowSurface(window);
+            // Renderer
+            renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+            if(renderer == NULL) {
+                printf( "Error: Renderer could not be created! SDL_Error: %s\n", SDL_GetError() );
+                success = 0;
+            }
+            // Scale the framebuffer texture to the window with nearest-neighbour sampling
+            SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
+        }
+    }
+
+    return success;
+}
+
+// Creates the streaming texture the framebuffer is uploaded to
+static int textureInit(int cols, int rows) {
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, cols, rows);
+    if(texture == NULL) {
+        printf( "Error: Texture could not be created! SDL_Error: %s\n", SDL_GetError() );
+        return 0;
+    }
+
+    texturePixels = (Uint32*) malloc(sizeof(Uint32) * cols * rows);
+    if(texturePixels == NULL) {
+        printf("Error: Unable to allocate texture memory\n");
+        SDL_DestroyTexture(texture);
+        texture = NULL;
+        return 0;
+    }
+
+    textureCols = cols;
+    textureRows = rows;
+    return 1;
+}
+
+// Uploads the framebuffer rows selected by dirty, bit n for row n, and presents once.
+// Row n is a word with column 0 in its most significant bit.
+void windowDraw(const unsigned long long* gfx, unsigned int dirty, int NUM_OF_PIXEL_COLS, int NUM_OF_PIXEL_ROWS) {
+    unsigned long long start = nanoTime();
+
+    if(texture == NULL) {
+        if(!textureInit(NUM_OF_PIXEL_COLS, NUM_OF_PIXEL_ROWS))
+            return;
+        dirty = ~0u;    // Texture content is undefined
+    }
+
+    // One upload per run of consecutive dirty rows
+    int row = 0;
+    while(row < textureRows) {
+        if(!(dirty >> row & 1)) {
+            row++;
+            continue;
+        }
+
+        int first = row;
+        for(; row < textureRows && (dirty >> row & 1); row++) {
+            Uint32 *p = texturePixels + row * textureCols;
+            for(int col = 0; col < textureCols; col++)
+                p[col] = gfx[row] >> (63 - col) & 1 ? PIXEL_ON : PIXEL_OFF;
+        }
+
+        SDL_Rect r = { 0, first, textureCols, row - first };
+        SDL_UpdateTexture(texture, &r, texturePixels + first * textureCols, textureCols * sizeof(Uint32));
+        rowsUploaded += row - first;
+    }
+
+    SDL_RenderCopy(renderer, texture, NULL, NULL);
+    SDL_RenderPresent(renderer);
+
+    unsigned long long elapsed = nanoTime() - start;
+    frames++;
+    frameTimeTotal += elapsed;
+    if(elapsed > frameTimeMax)
+        frameTimeMax = elapsed;
+}
+
+// Prints the number of frames drawn, their average and worst frame time and the rows uploaded
+void windowStats() {
+    if(frames == 0)
+        return;
+
+    printf("Frames: %llu, frame time avg %.3f ms, max %.3f ms, rows uploaded per frame %.1f\n", frames,
+        frameTimeTotal / (double) frames / 1e6, frameTimeMax / 1e6, rowsUploaded / (double) frames);
+}
+
+void windowClose() {
+    if(texture != NULL)
+        SDL_DestroyTexture(texture);
+    free(texturePixels);
+    texture = NULL;
+    texturePixels = NULL;
+
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    window = NULL;
+    screenSurface = NULL;
+    renderer = NULL;
+
+    SDL_Quit();
+}
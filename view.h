@@ -1,15 +1,17 @@
-/* file view.h */
-
-#ifndef VIEW_H
-#define VIEW_H
-
-SDL_Window* window;
-SDL_Surface* screenSurface;
-SDL_Renderer* renderer;
-
-int windowInit();
-int loadMedia();
-void windowDraw();
-void windowClose();
-
-#endif /* VIEW_H */
+/* file view.h */
+
+#ifndef VIEW_H
+#define VIEW_H
+
+SDL_Window* window;
+SDL_Surface* screenSurface;
+SDL_Renderer* renderer;
+SDL_Texture* texture;
+
+int windowInit();
+int loadMedia();
+void windowDraw();
+void windowStats();
+void windowClose();
+
+#endif /* VIEW_H */